@@ -0,0 +1,259 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-session-manager-bench.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh session manager bench
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hev-rbtree.h"
+#include "hev-compiler.h"
+#include "hev-fsh-session.h"
+#include "hev-fsh-session-manager.h"
+
+typedef struct _BenchTreeSession BenchTreeSession;
+typedef struct _BenchResult BenchResult;
+
+/* the former index, a node in every session ordered by (type, token) */
+struct _BenchTreeSession
+{
+    HevFshSession s;
+    HevRBTreeNode node;
+};
+
+struct _BenchResult
+{
+    double insert;
+    double find;
+    double miss;
+    double remove;
+};
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+bench_random (void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    return seed;
+}
+
+static void
+bench_token (HevFshToken token)
+{
+    uint64_t a = bench_random ();
+    uint64_t b = bench_random ();
+
+    memcpy (&token[0], &a, sizeof (a));
+    memcpy (&token[8], &b, sizeof (b));
+}
+
+static unsigned long long
+bench_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench_tree_insert (HevRBTree *tree, HevFshSession *s)
+{
+    BenchTreeSession *bs = container_of (s, BenchTreeSession, s);
+    HevRBTreeNode **n = &tree->root, *parent = NULL;
+
+    while (*n) {
+        HevFshSession *t = &container_of (*n, BenchTreeSession, node)->s;
+
+        parent = *n;
+
+        if (s->type < t->type) {
+            n = &((*n)->left);
+        } else if (s->type > t->type) {
+            n = &((*n)->right);
+        } else {
+            if (memcmp (s->token, t->token, sizeof (HevFshToken)) < 0)
+                n = &((*n)->left);
+            else
+                n = &((*n)->right);
+        }
+    }
+
+    hev_rbtree_node_link (&bs->node, parent, n);
+    hev_rbtree_insert_color (tree, &bs->node);
+}
+
+static void
+bench_tree_remove (HevRBTree *tree, HevFshSession *s)
+{
+    BenchTreeSession *bs = container_of (s, BenchTreeSession, s);
+
+    hev_rbtree_erase (tree, &bs->node);
+}
+
+static HevFshSession *
+bench_tree_find (HevRBTree *tree, int type, HevFshToken *token)
+{
+    HevRBTreeNode **n = &tree->root;
+
+    while (*n) {
+        HevFshSession *t = &container_of (*n, BenchTreeSession, node)->s;
+
+        if (type < t->type) {
+            n = &((*n)->left);
+        } else if (type > t->type) {
+            n = &((*n)->right);
+        } else {
+            int res = memcmp (*token, t->token, sizeof (HevFshToken));
+            if (res < 0)
+                n = &((*n)->left);
+            else if (res > 0)
+                n = &((*n)->right);
+            else
+                return t;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+bench_hash (BenchTreeSession *sessions, HevFshToken *misses, unsigned int n,
+            BenchResult *r)
+{
+    HevFshSessionManager *manager;
+    unsigned long long t;
+    unsigned int i, found = 0;
+
+    manager = hev_fsh_session_manager_new ();
+    if (!manager)
+        return -1;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++) {
+        if (hev_fsh_session_manager_insert (manager, &sessions[i].s) < 0)
+            return -1;
+    }
+    r->insert = (double)(bench_now () - t) / n;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++) {
+        HevFshSession *s = &sessions[i].s;
+
+        found += !!hev_fsh_session_manager_find (manager, s->type, &s->token);
+    }
+    r->find = (double)(bench_now () - t) / n;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++)
+        found += !!hev_fsh_session_manager_find (manager, 1, &misses[i]);
+    r->miss = (double)(bench_now () - t) / n;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++)
+        hev_fsh_session_manager_remove (manager, &sessions[i].s);
+    r->remove = (double)(bench_now () - t) / n;
+
+    hev_object_unref (HEV_OBJECT (manager));
+
+    return (found == n) ? 0 : -1;
+}
+
+static int
+bench_tree (BenchTreeSession *sessions, HevFshToken *misses, unsigned int n,
+            BenchResult *r)
+{
+    HevRBTree tree = { NULL };
+    unsigned long long t;
+    unsigned int i, found = 0;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++)
+        bench_tree_insert (&tree, &sessions[i].s);
+    r->insert = (double)(bench_now () - t) / n;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++) {
+        HevFshSession *s = &sessions[i].s;
+
+        found += !!bench_tree_find (&tree, s->type, &s->token);
+    }
+    r->find = (double)(bench_now () - t) / n;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++)
+        found += !!bench_tree_find (&tree, 1, &misses[i]);
+    r->miss = (double)(bench_now () - t) / n;
+
+    t = bench_now ();
+    for (i = 0; i < n; i++)
+        bench_tree_remove (&tree, &sessions[i].s);
+    r->remove = (double)(bench_now () - t) / n;
+
+    return (found == n) ? 0 : -1;
+}
+
+static void
+bench_print (const char *name, unsigned int n, BenchResult *r)
+{
+    printf ("%-6s %8u  insert %7.1f  find %7.1f  miss %7.1f  remove %7.1f\n",
+            name, n, r->insert, r->find, r->miss, r->remove);
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const unsigned int sizes[] = { 10000, 100000, 1000000 };
+    unsigned int i;
+
+    printf ("ns/op, forwarders and connectors in a 3:1 mix\n");
+
+    for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+        unsigned int j, n = sizes[i];
+        BenchTreeSession *sessions;
+        HevFshToken *misses;
+        BenchResult r;
+
+        sessions = calloc (n, sizeof (BenchTreeSession));
+        misses = calloc (n, sizeof (HevFshToken));
+        if (!sessions || !misses) {
+            fprintf (stderr, "out of memory at %u\n", n);
+            return -1;
+        }
+
+        for (j = 0; j < n; j++) {
+            sessions[j].s.type = (j & 3) ? 1 : 2;
+            bench_token (sessions[j].s.token);
+            bench_token (misses[j]);
+        }
+
+        if (bench_hash (sessions, misses, n, &r) < 0) {
+            fprintf (stderr, "hash failed at %u\n", n);
+            return -1;
+        }
+        bench_print ("hash", n, &r);
+
+        if (bench_tree (sessions, misses, n, &r) < 0) {
+            fprintf (stderr, "rbtree failed at %u\n", n);
+            return -1;
+        }
+        bench_print ("rbtree", n, &r);
+
+        free (sessions);
+        free (misses);
+    }
+
+    return 0;
+}
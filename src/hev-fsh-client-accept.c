@@ -8,6 +8,7 @@
  */
 
 #include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 
 #include <hev-task.h>
@@ -15,11 +16,13 @@
 #include <hev-task-io-socket.h>
 
 #include "hev-logger.h"
+#include "hev-fsh-mux.h"
+#include "hev-fsh-client-forward.h"
 
 #include "hev-fsh-client-accept.h"
 
-int
-hev_fsh_client_accept_send_accept (HevFshClientAccept *self)
+static int
+hev_fsh_client_accept_write_accept (HevFshClientAccept *self)
 {
     HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
     HevFshMessageToken msg_token;
@@ -28,7 +31,7 @@ hev_fsh_client_accept_send_accept (HevFshClientAccept *self)
     struct msghdr mh;
     int res;
 
-    LOG_D ("%p fsh client accept send accept", self);
+    LOG_D ("%p fsh client accept write accept", self);
 
     res = hev_fsh_client_base_connect (base);
     if (res < 0)
@@ -52,6 +55,112 @@ hev_fsh_client_accept_send_accept (HevFshClientAccept *self)
     if (res <= 0)
         return -1;
 
+    return 0;
+}
+
+static int
+hev_fsh_client_accept_write_park (HevFshClientAccept *self)
+{
+    HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    HevTaskIOYielder yielder = NULL;
+    HevFshMessageToken msg_token;
+    HevFshMessageToken msg_key;
+    HevFshMessage msg;
+    unsigned int timeout;
+    struct iovec iov[3];
+    struct msghdr mh;
+    int res;
+
+    LOG_D ("%p fsh client accept write park", self);
+
+    res = hev_fsh_client_base_connect (base);
+    if (res < 0)
+        return -1;
+
+    msg.ver = 1;
+    msg.cmd = HEV_FSH_CMD_PARK;
+    memcpy (msg_token.token, self->token, sizeof (HevFshToken));
+    memcpy (msg_key.token, self->key, sizeof (HevFshToken));
+
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof (msg);
+    iov[1].iov_base = &msg_token;
+    iov[1].iov_len = sizeof (msg_token);
+    iov[2].iov_base = &msg_key;
+    iov[2].iov_len = sizeof (msg_key);
+
+    __builtin_bzero (&mh, sizeof (mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 3;
+
+    res = hev_task_io_socket_sendmsg (base->fd, &mh, MSG_WAITALL, io_yielder,
+                                      self);
+    if (res <= 0)
+        return -1;
+
+    /* wait for connect, re-parked on timeout without keep-alive */
+    timeout = HEV_FSH_IO (self)->timeout / 1000;
+    res = hev_fsh_protocol_set_keep_alive (base->fd, timeout);
+    if (res < 0)
+        yielder = io_yielder;
+    res = hev_task_io_socket_recv (base->fd, &msg, sizeof (msg), MSG_WAITALL,
+                                   yielder, self);
+    if (res <= 0)
+        return 1;
+
+    if (msg.cmd != HEV_FSH_CMD_CONNECT)
+        return -1;
+
+    res = hev_task_io_socket_recv (base->fd, &msg_token, sizeof (msg_token),
+                                   MSG_WAITALL, io_yielder, self);
+    if (res <= 0)
+        return -1;
+
+    memcpy (self->token, msg_token.token, sizeof (HevFshToken));
+
+    return 0;
+}
+
+void
+hev_fsh_client_accept_set_pool (HevFshClientAccept *self,
+                                HevFshClientForward *forward, HevFshToken key)
+{
+    self->forward = forward;
+    memcpy (self->key, key, sizeof (HevFshToken));
+    hev_object_ref (HEV_OBJECT (forward));
+}
+
+void
+hev_fsh_client_accept_set_fd (HevFshClientAccept *self, int fd)
+{
+    HEV_FSH_CLIENT_BASE (self)->fd = fd;
+}
+
+int
+hev_fsh_client_accept_send_accept (HevFshClientAccept *self)
+{
+    HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    int res;
+
+    LOG_D ("%p fsh client accept send accept", self);
+
+    if (base->fd >= 0) {
+        hev_task_add_fd (hev_task_self (), base->fd, POLLIN | POLLOUT);
+        return 0;
+    }
+
+    if (self->forward) {
+        res = hev_fsh_client_accept_write_park (self);
+        /* closed while parked, refilled without back off */
+        hev_fsh_client_forward_pool_put (self->forward, (res > 0) ? 0 : res);
+        if (res > 0)
+            return -1;
+    } else {
+        res = hev_fsh_client_accept_write_accept (self);
+    }
+    if (res < 0)
+        return -1;
+
     res = hev_fsh_client_base_encrypt (base);
     if (res < 0)
         return -1;
@@ -59,13 +168,77 @@ hev_fsh_client_accept_send_accept (HevFshClientAccept *self)
     return 0;
 }
 
+static int
+hev_fsh_client_accept_mux_accept (HevFshMux *mux, HevFshToken token,
+                                  void *data)
+{
+    HevFshClientAcceptClass *klass = HEV_OBJECT_GET_CLASS (data);
+    HevFshClientAccept *self = data;
+    HevFshClientBase *accept;
+    int fds[2];
+    int res;
+
+    LOG_D ("%p fsh client accept mux accept", self);
+
+    res = hev_task_io_socket_socketpair (PF_UNIX, SOCK_STREAM, 0, fds);
+    if (res < 0)
+        return -1;
+
+    accept = klass->new_stream (self, token);
+    if (!accept) {
+        close (fds[0]);
+        close (fds[1]);
+        return -1;
+    }
+
+    hev_fsh_client_accept_set_fd (HEV_FSH_CLIENT_ACCEPT (accept), fds[0]);
+    hev_fsh_io_run (HEV_FSH_IO (accept));
+
+    return fds[1];
+}
+
+int
+hev_fsh_client_accept_serve_mux (HevFshClientAccept *self)
+{
+    HevFshClientAcceptClass *klass = HEV_OBJECT_GET_CLASS (self);
+    HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    unsigned int timeout = HEV_FSH_IO (self)->timeout;
+    HevFshMessage msg;
+    HevFshMux *mux;
+    int res;
+
+    LOG_D ("%p fsh client accept serve mux", self);
+
+    if (!klass->new_stream)
+        return -1;
+
+    msg.ver = 1;
+    msg.cmd = HEV_FSH_CMD_MUX;
+
+    res = hev_task_io_socket_send (base->fd, &msg, sizeof (msg), MSG_WAITALL,
+                                   io_yielder, self);
+    if (res <= 0)
+        return -1;
+
+    mux = hev_fsh_mux_new (base->fd, timeout,
+                           hev_fsh_client_accept_mux_accept, self);
+    if (!mux)
+        return -1;
+
+    hev_fsh_mux_serve (mux);
+    hev_fsh_mux_stop (mux);
+    hev_object_unref (HEV_OBJECT (mux));
+
+    return 0;
+}
+
 int
 hev_fsh_client_accept_construct (HevFshClientAccept *self, HevFshConfig *config,
-                                 HevFshToken token)
+                                 HevFshToken token, HevFshTaskRole role)
 {
     int res;
 
-    res = hev_fsh_client_base_construct (&self->base, config);
+    res = hev_fsh_client_base_construct (&self->base, config, role);
     if (res < 0)
         return res;
 
@@ -85,6 +258,8 @@ hev_fsh_client_accept_destruct (HevObject *base)
 
     LOG_D ("%p fsh client accept destruct", self);
 
+    if (self->forward)
+        hev_object_unref (HEV_OBJECT (self->forward));
     HEV_FSH_CLIENT_BASE_TYPE->finalizer (base);
 }
 
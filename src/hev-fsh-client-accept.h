@@ -19,9 +19,10 @@ extern "C" {
 #endif
 
 #define HEV_FSH_CLIENT_ACCEPT(p) ((HevFshClientAccept *)p)
-#define HEV_FSH_CLIENT_ACCEPT_CLASS(P) ((HevFshClientAcceptClass *)p)
+#define HEV_FSH_CLIENT_ACCEPT_CLASS(p) ((HevFshClientAcceptClass *)p)
 #define HEV_FSH_CLIENT_ACCEPT_TYPE (hev_fsh_client_accept_class ())
 
+typedef struct _HevFshClientForward HevFshClientForward;
 typedef struct _HevFshClientAccept HevFshClientAccept;
 typedef struct _HevFshClientAcceptClass HevFshClientAcceptClass;
 
@@ -29,21 +30,35 @@ struct _HevFshClientAccept
 {
     HevFshClientBase base;
 
+    HevFshToken key;
     HevFshToken token;
+    HevFshClientForward *forward;
 };
 
 struct _HevFshClientAcceptClass
 {
     HevFshClientBaseClass base;
+
+    HevFshClientBase *(*new_stream) (HevFshClientAccept *self,
+                                     HevFshToken token);
 };
 
 HevObjectClass *hev_fsh_client_accept_class (void);
 
 int hev_fsh_client_accept_construct (HevFshClientAccept *self,
-                                     HevFshConfig *config, HevFshToken token);
+                                     HevFshConfig *config, HevFshToken token,
+                                     HevFshTaskRole role);
+
+void hev_fsh_client_accept_set_pool (HevFshClientAccept *self,
+                                     HevFshClientForward *forward,
+                                     HevFshToken key);
+
+void hev_fsh_client_accept_set_fd (HevFshClientAccept *self, int fd);
 
 int hev_fsh_client_accept_send_accept (HevFshClientAccept *self);
 
+int hev_fsh_client_accept_serve_mux (HevFshClientAccept *self);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,6 +7,8 @@
  ============================================================================
  */
 
+#include <poll.h>
+#include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -26,9 +28,12 @@
 
 #include "hev-logger.h"
 #include "hev-random.h"
+#include "hev-task-io-us.h"
 
 #include "hev-fsh-client-base.h"
 
+#define HEV_FSH_CLIENT_BASE_STAGGER (250)
+
 #ifndef TLS_TX
 #define TLS_TX 1
 #endif
@@ -111,33 +116,114 @@ hev_fsh_client_base_listen (HevFshClientBase *self)
     return 0;
 }
 
-int
-hev_fsh_client_base_connect (HevFshClientBase *self)
+static int
+hev_fsh_client_base_attempt (HevFshClientBase *self, HevFshResolverAddr *addr)
 {
-    struct sockaddr *addr;
-    socklen_t addr_len;
+    struct sockaddr *sa = (struct sockaddr *)&addr->addr;
     int res;
     int fd;
 
-    addr = hev_fsh_config_get_server_sockaddr (self->config, &addr_len);
-    if (!addr) {
-        LOG_E ("%p fsh client base addr", self);
+    fd = hev_fsh_client_base_socket (self, sa->sa_family);
+    if (fd < 0)
         return -1;
-    }
 
-    fd = hev_fsh_client_base_socket (self, addr->sa_family);
-    if (fd < 0)
+    res = connect (fd, sa, addr->len);
+    if ((res < 0) && (errno != EINPROGRESS)) {
+        close (fd);
         return -1;
+    }
 
     hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
 
-    res = hev_task_io_socket_connect (fd, addr, addr_len, io_yielder, self);
-    if (res < 0) {
+    return fd;
+}
+
+int
+hev_fsh_client_base_connect (HevFshClientBase *self)
+{
+    HevFshResolverAddr addrs[HEV_FSH_RESOLVER_ADDRS];
+    struct pollfd pfds[HEV_FSH_RESOLVER_ADDRS];
+    unsigned char from[HEV_FSH_RESOLVER_ADDRS];
+    unsigned int wait = 0;
+    int family = 0;
+    int live = 0;
+    int next = 0;
+    int fd = -1;
+    int i;
+    int n;
+
+    n = hev_fsh_config_get_server_addrs (self->config, addrs,
+                                         HEV_FSH_RESOLVER_ADDRS);
+    if (n <= 0) {
+        LOG_E ("%p fsh client base addr", self);
+        return -1;
+    }
+
+    /* rfc 8305 happy eyeballs */
+    for (;;) {
+        if ((next < n) && (!live || !wait)) {
+            int afd = hev_fsh_client_base_attempt (self, &addrs[next]);
+
+            wait = 0;
+            if (afd >= 0) {
+                pfds[live].fd = afd;
+                pfds[live].events = POLLOUT;
+                from[live] = next;
+                wait = HEV_FSH_CLIENT_BASE_STAGGER;
+                live++;
+            }
+            next++;
+        }
+
+        if (poll (pfds, live, 0) > 0) {
+            for (i = 0; i < live;) {
+                socklen_t len = sizeof (int);
+                int err = 0;
+
+                if (!pfds[i].revents) {
+                    i++;
+                    continue;
+                }
+
+                getsockopt (pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (!err && (fd < 0)) {
+                    fd = pfds[i].fd;
+                    family = addrs[from[i]].addr.ss_family;
+                } else {
+                    close (pfds[i].fd);
+                }
+
+                live--;
+                pfds[i] = pfds[live];
+                from[i] = from[live];
+            }
+        }
+
+        if (fd >= 0)
+            break;
+
+        if (!live) {
+            if (next >= n)
+                break;
+            wait = 0;
+            continue;
+        }
+
+        if (next < n)
+            wait = hev_task_sleep (wait);
+        else if (io_yielder (HEV_TASK_WAITIO, self) < 0)
+            break;
+    }
+
+    for (i = 0; i < live; i++)
+        close (pfds[i].fd);
+
+    if (fd < 0) {
         LOG_E ("%p fsh client base connect", self);
-        close (fd);
         return -1;
     }
 
+    hev_fsh_config_set_server_family (self->config, family);
     self->fd = fd;
 
     return 0;
@@ -192,14 +278,30 @@ hev_fsh_client_base_encrypt (HevFshClientBase *self)
     return 0;
 }
 
+void
+hev_fsh_client_base_splice (HevFshClientBase *self, int fd_a_i, int fd_a_o,
+                            int fd_b_i, int fd_b_o, HevFshSpliceType type)
+{
+    LOG_D ("%p fsh client base splice", self);
+
+    /* the kernel tls can't splice, copy through user space */
+    if (hev_fsh_config_is_ugly_ktls (self->config))
+        hev_task_io_us_splice (fd_a_i, fd_a_o, fd_b_i, fd_b_o, 8192,
+                               io_yielder, self);
+    else
+        hev_fsh_splice (type, fd_a_i, fd_a_o, fd_b_i, fd_b_o, io_yielder,
+                        self);
+}
+
 int
-hev_fsh_client_base_construct (HevFshClientBase *self, HevFshConfig *config)
+hev_fsh_client_base_construct (HevFshClientBase *self, HevFshConfig *config,
+                               HevFshTaskRole role)
 {
     int res;
     unsigned int timeout;
 
     timeout = hev_fsh_config_get_timeout (config);
-    res = hev_fsh_io_construct (&self->base, timeout);
+    res = hev_fsh_io_construct (&self->base, timeout, role);
     if (res < 0)
         return res;
 
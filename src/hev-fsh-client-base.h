@@ -12,6 +12,7 @@
 
 #include "hev-fsh-io.h"
 #include "hev-fsh-config.h"
+#include "hev-fsh-splice.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -40,12 +41,16 @@ struct _HevFshClientBaseClass
 HevObjectClass *hev_fsh_client_base_class (void);
 
 int hev_fsh_client_base_construct (HevFshClientBase *self,
-                                   HevFshConfig *config);
+                                   HevFshConfig *config, HevFshTaskRole role);
 
 int hev_fsh_client_base_listen (HevFshClientBase *self);
 int hev_fsh_client_base_connect (HevFshClientBase *self);
 int hev_fsh_client_base_encrypt (HevFshClientBase *self);
 
+void hev_fsh_client_base_splice (HevFshClientBase *self, int fd_a_i,
+                                 int fd_a_o, int fd_b_i, int fd_b_o,
+                                 HevFshSpliceType type);
+
 #ifdef __cplusplus
 }
 #endif
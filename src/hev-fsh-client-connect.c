@@ -64,13 +64,47 @@ hev_fsh_client_connect_send_connect (HevFshClientConnect *self)
     return 0;
 }
 
+void
+hev_fsh_client_connect_set_mux (HevFshClientConnect *self, HevFshMux *mux)
+{
+    if (mux)
+        hev_object_ref (HEV_OBJECT (mux));
+    self->mux = mux;
+}
+
+int
+hev_fsh_client_connect_splice_mux (HevFshClientConnect *self, int fd,
+                                   void *head, size_t size)
+{
+    HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    HevFshToken token;
+    const char *str;
+    int res;
+
+    LOG_D ("%p fsh client connect splice mux", self);
+
+    str = hev_fsh_config_get_token (base->config);
+    res = hev_fsh_protocol_token_from_string (token, str);
+    if (res == -1)
+        return -1;
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+
+    res = hev_fsh_mux_splice (self->mux, fd, token, head, size);
+    if (res < 0)
+        hev_task_del_fd (hev_task_self (), fd);
+
+    return res;
+}
+
 int
 hev_fsh_client_connect_construct (HevFshClientConnect *self,
                                   HevFshConfig *config)
 {
     int res;
 
-    res = hev_fsh_client_base_construct (&self->base, config);
+    res = hev_fsh_client_base_construct (&self->base, config,
+                                         HEV_FSH_TASK_CONNECT);
     if (res < 0)
         return res;
 
@@ -88,6 +122,9 @@ hev_fsh_client_connect_destruct (HevObject *base)
 
     LOG_D ("%p fsh client connect destruct", self);
 
+    if (self->mux)
+        hev_object_unref (HEV_OBJECT (self->mux));
+
     HEV_FSH_CLIENT_BASE_TYPE->finalizer (base);
 }
 
@@ -10,6 +10,7 @@
 #ifndef __HEV_FSH_CLIENT_CONNECT_H__
 #define __HEV_FSH_CLIENT_CONNECT_H__
 
+#include "hev-fsh-mux.h"
 #include "hev-fsh-config.h"
 #include "hev-fsh-client-base.h"
 
@@ -27,6 +28,8 @@ typedef struct _HevFshClientConnectClass HevFshClientConnectClass;
 struct _HevFshClientConnect
 {
     HevFshClientBase base;
+
+    HevFshMux *mux;
 };
 
 struct _HevFshClientConnectClass
@@ -41,6 +44,12 @@ int hev_fsh_client_connect_construct (HevFshClientConnect *self,
 
 int hev_fsh_client_connect_send_connect (HevFshClientConnect *self);
 
+void hev_fsh_client_connect_set_mux (HevFshClientConnect *self,
+                                     HevFshMux *mux);
+
+int hev_fsh_client_connect_splice_mux (HevFshClientConnect *self, int fd,
+                                       void *head, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,6 +9,7 @@
 
 #include <string.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
@@ -16,6 +17,7 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
+#include "hev-random.h"
 #include "hev-fsh-client-term-accept.h"
 #include "hev-fsh-client-port-accept.h"
 #include "hev-fsh-client-sock-accept.h"
@@ -62,6 +64,75 @@ hev_fsh_client_forward_write_login (HevFshClientForward *self)
     return 0;
 }
 
+static int
+hev_fsh_client_forward_write_pool (HevFshClientForward *self)
+{
+    HevFshMessageToken mkey;
+    HevFshMessage msg;
+    struct iovec iov[2];
+    struct msghdr mh;
+    int res;
+
+    LOG_D ("%p fsh client forward write pool", self);
+
+    msg.ver = 1;
+    msg.cmd = HEV_FSH_CMD_POOL;
+    memcpy (mkey.token, self->pool_key, sizeof (HevFshToken));
+
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof (msg);
+    iov[1].iov_base = &mkey;
+    iov[1].iov_len = sizeof (mkey);
+
+    __builtin_bzero (&mh, sizeof (mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+
+    hev_task_mutex_lock (&self->wlock);
+    res = hev_task_io_socket_sendmsg (self->base.fd, &mh, MSG_WAITALL,
+                                      io_yielder, self);
+    hev_task_mutex_unlock (&self->wlock);
+    if (res <= 0)
+        return -1;
+
+    self->is_pool = 1;
+    hev_task_wakeup (self->pool_task);
+
+    return 0;
+}
+
+static int
+hev_fsh_client_forward_mux_accept (HevFshMux *mux, HevFshToken token,
+                                   void *data);
+
+static int
+hev_fsh_client_forward_write_mux (HevFshClientForward *self)
+{
+    HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    unsigned int timeout = HEV_FSH_IO (self)->timeout;
+    HevFshMessage msg;
+    int res;
+
+    LOG_D ("%p fsh client forward write mux", self);
+
+    msg.ver = 1;
+    msg.cmd = HEV_FSH_CMD_MUX;
+
+    hev_task_mutex_lock (&self->wlock);
+    res = hev_task_io_socket_send (base->fd, &msg, sizeof (msg), MSG_WAITALL,
+                                   io_yielder, self);
+    hev_task_mutex_unlock (&self->wlock);
+    if (res <= 0)
+        return -1;
+
+    self->mux = hev_fsh_mux_new (base->fd, timeout,
+                                 hev_fsh_client_forward_mux_accept, self);
+    if (!self->mux)
+        return -1;
+
+    return 0;
+}
+
 static int
 hev_fsh_client_forward_read_token (HevFshClientForward *self)
 {
@@ -78,6 +149,20 @@ hev_fsh_client_forward_read_token (HevFshClientForward *self)
     if (res <= 0)
         return -1;
 
+    if (msg.cmd == HEV_FSH_CMD_RETRY) {
+        HevFshMessageRetry mr;
+
+        res = hev_task_io_socket_recv (self->base.fd, &mr, sizeof (mr),
+                                       MSG_WAITALL, io_yielder, self);
+        if (res <= 0)
+            return -1;
+
+        self->retry_delay = ntohl (mr.delay);
+        LOG_I ("%p fsh client forward retry in %u ms", self,
+               self->retry_delay);
+        return -1;
+    }
+
     if (msg.cmd != HEV_FSH_CMD_TOKEN) {
         LOG_E ("%p fsh client forward login", self);
         return -1;
@@ -101,20 +186,37 @@ hev_fsh_client_forward_read_token (HevFshClientForward *self)
     else
         LOG_I ("token %s (from %s)", buf, src);
 
+    self->is_klive = (msg.ver >= 5) ? 1 : 0;
+
+    if ((msg.ver >= 2) && hev_fsh_config_get_pool_size (self->base.config))
+        return hev_fsh_client_forward_write_pool (self);
+
+    if ((msg.ver >= 4) && hev_fsh_config_get_mux (self->base.config) &&
+        !hev_fsh_config_get_key (self->base.config))
+        return hev_fsh_client_forward_write_mux (self);
+
     return 0;
 }
 
 static int
-hev_fsh_client_forward_write_keep_alive (HevFshClientForward *self)
+hev_fsh_client_forward_write_keep_alive (HevFshClientForward *self, int ver)
 {
+    HevFshMux *mux = self->mux;
     HevFshMessage msg;
     int res;
 
-    LOG_D ("%p fsh client forward keep alive", self);
+    LOG_D ("%p fsh client forward keep alive %d", self, ver);
 
-    msg.ver = 2;
+    msg.ver = ver;
     msg.cmd = HEV_FSH_CMD_KEEP_ALIVE;
 
+    if (mux) {
+        hev_object_ref (HEV_OBJECT (mux));
+        res = hev_fsh_mux_write_message (mux, msg.ver, msg.cmd, NULL, 0);
+        hev_object_unref (HEV_OBJECT (mux));
+        return res;
+    }
+
     hev_task_mutex_lock (&self->wlock);
     res = hev_task_io_socket_send (self->base.fd, &msg, sizeof (msg),
                                    MSG_WAITALL, io_yielder, self);
@@ -123,15 +225,14 @@ hev_fsh_client_forward_write_keep_alive (HevFshClientForward *self)
     return res;
 }
 
-static void
-hev_fsh_client_forward_accept (HevFshClientForward *self, HevFshToken token)
+static HevFshClientBase *
+hev_fsh_client_forward_new_accept (HevFshClientForward *self,
+                                   HevFshToken token)
 {
     HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
     HevFshClientBase *accept;
     int mode;
 
-    LOG_D ("%p fsh client forward accept", self);
-
     mode = hev_fsh_config_get_mode (base->config);
     switch (mode) {
     case HEV_FSH_CONFIG_MODE_FORWARDER_PORT:
@@ -145,43 +246,180 @@ hev_fsh_client_forward_accept (HevFshClientForward *self, HevFshToken token)
         break;
     }
 
-    if (accept)
-        hev_fsh_io_run (HEV_FSH_IO (accept));
+    return accept;
+}
+
+static int
+hev_fsh_client_forward_accept (HevFshClientForward *self, HevFshToken token,
+                               int pool)
+{
+    HevFshClientBase *accept;
+
+    LOG_D ("%p fsh client forward accept", self);
+
+    accept = hev_fsh_client_forward_new_accept (self, token);
+    if (!accept)
+        return -1;
+
+    if (pool)
+        hev_fsh_client_accept_set_pool (HEV_FSH_CLIENT_ACCEPT (accept), self,
+                                        self->pool_key);
+
+    hev_fsh_io_run (HEV_FSH_IO (accept));
+
+    return 0;
+}
+
+static int
+hev_fsh_client_forward_mux_accept (HevFshMux *mux, HevFshToken token,
+                                   void *data)
+{
+    HevFshClientForward *self = data;
+    HevFshClientBase *accept;
+    int fds[2];
+    int res;
+
+    LOG_D ("%p fsh client forward mux accept", self);
+
+    res = hev_task_io_socket_socketpair (PF_UNIX, SOCK_STREAM, 0, fds);
+    if (res < 0)
+        return -1;
+
+    accept = hev_fsh_client_forward_new_accept (self, token);
+    if (!accept) {
+        close (fds[0]);
+        close (fds[1]);
+        return -1;
+    }
+
+    hev_fsh_client_accept_set_fd (HEV_FSH_CLIENT_ACCEPT (accept), fds[0]);
+    hev_fsh_io_run (HEV_FSH_IO (accept));
+
+    return fds[1];
+}
+
+void
+hev_fsh_client_forward_pool_put (HevFshClientForward *self, int res)
+{
+    LOG_D ("%p fsh client forward pool put %d", self, res);
+
+    self->pool_idle--;
+    if (res < 0)
+        self->pool_fail = 1;
+    hev_task_wakeup (self->pool_task);
+}
+
+static void
+hev_fsh_client_forward_kalive_handler (HevFshTimerWheel *wheel,
+                                       HevFshTimer *timer)
+{
+    HevFshClientForward *self = timer->data;
+    HevFshIO *io = HEV_FSH_IO (self);
+
+    self->is_kalive = 1;
+    hev_task_wakeup (io->task);
+    hev_fsh_timer_wheel_add (wheel, timer, io->timeout / 2);
+}
+
+static int
+hev_fsh_client_forward_yielder (HevTaskYieldType type, void *data)
+{
+    HevFshClientForward *self = data;
+
+    if (self->is_klive) {
+        hev_task_yield (type);
+        return 0;
+    }
+
+    if (self->is_kalive) {
+        self->is_kalive = 0;
+        hev_fsh_client_forward_write_keep_alive (self, 2);
+    }
+
+    return io_yielder (type, data);
 }
 
 static void
 hev_fsh_client_forward_dispatch (HevFshClientForward *self)
 {
     HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    HevFshTimerWheel *wheel = hev_fsh_timer_wheel_get ();
+    unsigned int timeout = HEV_FSH_IO (self)->timeout;
+    size_t ahead = 0;
 
     LOG_D ("%p fsh client forward dispatch", self);
 
+    if (!wheel)
+        return;
+
+    if (self->is_klive) {
+        unsigned int t = hev_fsh_config_get_timeout (base->config);
+        int res;
+
+        res = hev_fsh_protocol_set_keep_alive (base->fd, t);
+        if (res == 0)
+            res = hev_fsh_client_forward_write_keep_alive (self, 3);
+        if (res < 0)
+            self->is_klive = 0;
+    }
+
+    self->is_kalive = 0;
+    hev_fsh_reader_init (&self->reader, self->rbuf, sizeof (self->rbuf));
+
+    if (!self->mux)
+        ahead = sizeof (self->rbuf);
+    if (!self->is_klive)
+        hev_fsh_timer_wheel_add (wheel, &self->kalive, timeout / 2);
+
     for (;;) {
         HevFshMessageToken token;
         HevFshMessage msg;
         int res;
 
-        res = hev_task_io_socket_recv (base->fd, &msg, sizeof (msg),
-                                       MSG_WAITALL, io_yielder, self);
+        res = hev_fsh_reader_read (&self->reader, base->fd, &msg, sizeof (msg),
+                                   ahead, hev_fsh_client_forward_yielder,
+                                   self);
         if (res <= 0)
-            return;
+            break;
 
         switch (msg.cmd) {
         case HEV_FSH_CMD_CONNECT:
+            /* the server pushed its deadline, keep-alive in half a timeout */
+            if (!self->is_klive) {
+                self->is_kalive = 0;
+                hev_fsh_timer_wheel_del (wheel, &self->kalive);
+                hev_fsh_timer_wheel_add (wheel, &self->kalive, timeout / 2);
+            }
             break;
         case HEV_FSH_CMD_KEEP_ALIVE:
             continue;
+        case HEV_FSH_CMD_STREAM_OPEN:
+        case HEV_FSH_CMD_STREAM_DATA:
+        case HEV_FSH_CMD_STREAM_WINDOW:
+        case HEV_FSH_CMD_STREAM_CLOSE:
+            if (!self->mux)
+                goto exit;
+            res = hev_fsh_mux_dispatch (self->mux, &msg,
+                                        hev_fsh_client_forward_yielder, self);
+            if (res < 0)
+                goto exit;
+            continue;
         default:
-            return;
+            goto exit;
         }
 
-        res = hev_task_io_socket_recv (base->fd, &token, sizeof (token),
-                                       MSG_WAITALL, io_yielder, self);
+        res = hev_fsh_reader_read (&self->reader, base->fd, &token,
+                                   sizeof (token), ahead,
+                                   hev_fsh_client_forward_yielder, self);
         if (res <= 0)
-            return;
+            break;
 
-        hev_fsh_client_forward_accept (self, token.token);
+        hev_fsh_client_forward_accept (self, token.token, 0);
     }
+
+exit:
+    if (!self->is_klive)
+        hev_fsh_timer_wheel_del (wheel, &self->kalive);
 }
 
 static void
@@ -191,6 +429,8 @@ hev_fsh_client_forward_task_entry (void *data)
     HevFshClientBase *base = data;
 
     for (;;) {
+        unsigned int delay;
+        unsigned short r;
         int res;
 
         res = hev_fsh_client_base_connect (base);
@@ -210,21 +450,56 @@ hev_fsh_client_forward_task_entry (void *data)
         hev_fsh_client_forward_dispatch (self);
 
     restart:
+        if (self->mux) {
+            hev_fsh_mux_stop (self->mux);
+            hev_object_unref (HEV_OBJECT (self->mux));
+            self->mux = NULL;
+        }
+        self->is_pool = 0;
         close (base->fd);
-        hev_task_sleep (1000);
+
+        delay = self->retry_delay ? self->retry_delay : 1000;
+        self->retry_delay = 0;
+
+        /* jitter */
+        hev_random_get_bytes (&r, sizeof (r));
+        delay += (unsigned long long)delay * r / 131072;
+        while (delay)
+            delay = hev_task_sleep (delay);
     }
 }
 
 static void
-hev_fsh_client_forward_kalive_task_entry (void *data)
+hev_fsh_client_forward_pool_task_entry (void *data)
 {
     HevFshClientForward *self = data;
+    HevFshClientBase *base = data;
+    unsigned int size;
+
+    size = hev_fsh_config_get_pool_size (base->config);
 
     for (;;) {
-        HevFshIO *io = data;
+        if (self->pool_fail) {
+            unsigned int delay = 1000;
+
+            self->pool_fail = 0;
+            while (delay)
+                delay = hev_task_sleep (delay);
+        }
 
-        hev_task_sleep (io->timeout / 2);
-        hev_fsh_client_forward_write_keep_alive (self);
+        while (self->is_pool && (self->pool_idle < size)) {
+            int res;
+
+            res = hev_fsh_client_forward_accept (self, self->token, 1);
+            if (res < 0) {
+                self->pool_fail = 1;
+                break;
+            }
+            self->pool_idle++;
+        }
+
+        if (!self->pool_fail)
+            hev_task_yield (HEV_TASK_WAITIO);
     }
 }
 
@@ -235,8 +510,9 @@ hev_fsh_client_forward_run (HevFshIO *base)
 
     LOG_D ("%p fsh client forward run", self);
 
-    hev_task_run (base->task, hev_fsh_client_forward_task_entry, self);
-    hev_task_run (self->task, hev_fsh_client_forward_kalive_task_entry, self);
+    hev_fsh_io_task_run (base, hev_fsh_client_forward_task_entry);
+    hev_fsh_task_run (self->pool_task, base->role,
+                      hev_fsh_client_forward_pool_task_entry, self);
 }
 
 HevFshClientBase *
@@ -245,13 +521,14 @@ hev_fsh_client_forward_new (HevFshConfig *config)
     HevFshClientForward *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientForward));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientForward),
+                             HEV_FSH_TASK_FORWARD);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_forward_construct (self, config);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -266,7 +543,8 @@ hev_fsh_client_forward_construct (HevFshClientForward *self,
 {
     int res;
 
-    res = hev_fsh_client_base_construct (&self->base, config);
+    res = hev_fsh_client_base_construct (&self->base, config,
+                                         HEV_FSH_TASK_FORWARD);
     if (res < 0)
         return res;
 
@@ -274,10 +552,14 @@ hev_fsh_client_forward_construct (HevFshClientForward *self,
 
     HEV_OBJECT (self)->klass = HEV_FSH_CLIENT_FORWARD_TYPE;
 
-    self->task = hev_task_new (HEV_FSH_CONFIG_TASK_STACK_SIZE);
-    if (!self->task)
+    self->pool_task = hev_fsh_task_new (HEV_FSH_TASK_FORWARD);
+    if (!self->pool_task)
         return -1;
 
+    hev_random_get_bytes (self->pool_key, sizeof (HevFshToken));
+    self->kalive.handler = hev_fsh_client_forward_kalive_handler;
+    self->kalive.data = self;
+
     return 0;
 }
 
@@ -13,7 +13,9 @@
 #include <hev-task.h>
 #include <hev-task-mutex.h>
 
+#include "hev-fsh-mux.h"
 #include "hev-fsh-config.h"
+#include "hev-fsh-reader.h"
 #include "hev-fsh-protocol.h"
 #include "hev-fsh-client-base.h"
 
@@ -32,9 +34,21 @@ struct _HevFshClientForward
 {
     HevFshClientBase base;
 
-    HevTask *task;
+    HevTask *pool_task;
+    HevFshMux *mux;
     HevFshToken token;
+    HevFshToken pool_key;
+    HevFshTimer kalive;
+    HevFshReader reader;
     HevTaskMutex wlock;
+
+    unsigned char rbuf[512];
+    unsigned int pool_idle;
+    unsigned int retry_delay;
+    unsigned char is_pool : 1;
+    unsigned char pool_fail : 1;
+    unsigned char is_kalive : 1;
+    unsigned char is_klive : 1;
 };
 
 struct _HevFshClientForwardClass
@@ -49,6 +63,8 @@ int hev_fsh_client_forward_construct (HevFshClientForward *self,
 
 HevFshClientBase *hev_fsh_client_forward_new (HevFshConfig *config);
 
+void hev_fsh_client_forward_pool_put (HevFshClientForward *self, int res);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,6 +16,7 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
+#include "hev-fsh-client-mux-connect.h"
 
 #include "hev-fsh-client-listen.h"
 
@@ -47,12 +48,47 @@ exit:
     hev_object_unref (HEV_OBJECT (base));
 }
 
+HevFshMux *
+hev_fsh_client_listen_get_mux (HevFshClientListen *self)
+{
+    HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    HevFshClientBase *tunnel;
+
+    if (self->mux || self->is_mux_pending || self->is_mux_refused)
+        return self->mux;
+
+    tunnel = hev_fsh_client_mux_connect_new (base->config, self);
+    if (tunnel) {
+        self->is_mux_pending = 1;
+        hev_fsh_io_run (HEV_FSH_IO (tunnel));
+    }
+
+    return NULL;
+}
+
+void
+hev_fsh_client_listen_set_mux (HevFshClientListen *self, HevFshMux *mux,
+                               int refused)
+{
+    LOG_D ("%p fsh client listen set mux %p", self, mux);
+
+    if (self->mux)
+        hev_object_unref (HEV_OBJECT (self->mux));
+    if (mux)
+        hev_object_ref (HEV_OBJECT (mux));
+
+    self->mux = mux;
+    self->is_mux_pending = 0;
+    if (refused)
+        self->is_mux_refused = 1;
+}
+
 static void
 hev_fsh_client_listen_run (HevFshIO *base)
 {
     LOG_D ("%p fsh client listen run", base);
 
-    hev_task_run (base->task, hev_fsh_client_listen_task_entry, base);
+    hev_fsh_io_task_run (base, hev_fsh_client_listen_task_entry);
 }
 
 HevFshClientBase *
@@ -61,13 +97,14 @@ hev_fsh_client_listen_new (HevFshConfig *config)
     HevFshClientListen *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientListen));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientListen),
+                             HEV_FSH_TASK_LISTEN);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_listen_construct (self, config);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -81,7 +118,8 @@ hev_fsh_client_listen_construct (HevFshClientListen *self, HevFshConfig *config)
 {
     int res;
 
-    res = hev_fsh_client_base_construct (&self->base, config);
+    res = hev_fsh_client_base_construct (&self->base, config,
+                                         HEV_FSH_TASK_LISTEN);
     if (res < 0)
         return res;
 
@@ -99,6 +137,9 @@ hev_fsh_client_listen_destruct (HevObject *base)
 
     LOG_D ("%p fsh client listen destruct", self);
 
+    if (self->mux)
+        hev_object_unref (HEV_OBJECT (self->mux));
+
     HEV_FSH_CLIENT_BASE_TYPE->finalizer (base);
 }
 
@@ -10,6 +10,7 @@
 #ifndef __HEV_FSH_CLIENT_LISTEN_H__
 #define __HEV_FSH_CLIENT_LISTEN_H__
 
+#include "hev-fsh-mux.h"
 #include "hev-fsh-config.h"
 #include "hev-fsh-client-base.h"
 
@@ -27,6 +28,10 @@ typedef struct _HevFshClientListenClass HevFshClientListenClass;
 struct _HevFshClientListen
 {
     HevFshClientBase base;
+
+    HevFshMux *mux;
+    unsigned char is_mux_pending;
+    unsigned char is_mux_refused;
 };
 
 struct _HevFshClientListenClass
@@ -41,6 +46,10 @@ HevObjectClass *hev_fsh_client_listen_class (void);
 int hev_fsh_client_listen_construct (HevFshClientListen *self,
                                      HevFshConfig *config);
 
+HevFshMux *hev_fsh_client_listen_get_mux (HevFshClientListen *self);
+void hev_fsh_client_listen_set_mux (HevFshClientListen *self, HevFshMux *mux,
+                                    int refused);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,187 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-client-mux-connect.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh client mux connect
+ ============================================================================
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-protocol.h"
+
+#include "hev-fsh-client-mux-connect.h"
+
+static int
+hev_fsh_client_mux_connect_write_mux (HevFshClientMuxConnect *self)
+{
+    HevFshClientBase *base = HEV_FSH_CLIENT_BASE (self);
+    HevFshMessagePortInfo mpinfo;
+    HevFshMessage msg;
+    void *hello;
+    size_t size;
+    int res;
+
+    LOG_D ("%p fsh client mux connect write mux", self);
+
+    switch (hev_fsh_config_get_mode (base->config)) {
+    case HEV_FSH_CONFIG_MODE_CONNECTOR_PORT:
+        __builtin_bzero (&mpinfo, sizeof (mpinfo));
+        hello = &mpinfo;
+        size = sizeof (mpinfo);
+        break;
+    default:
+        msg.ver = 1;
+        msg.cmd = HEV_FSH_CMD_MUX;
+        hello = &msg;
+        size = sizeof (msg);
+        break;
+    }
+
+    res = hev_task_io_socket_send (base->fd, hello, size, MSG_WAITALL,
+                                   io_yielder, self);
+    if (res <= 0)
+        return -1;
+
+    res = hev_task_io_socket_recv (base->fd, &msg, sizeof (msg), MSG_WAITALL,
+                                   io_yielder, self);
+    if ((res <= 0) || (msg.cmd != HEV_FSH_CMD_MUX))
+        return -1;
+
+    return 0;
+}
+
+static void
+hev_fsh_client_mux_connect_task_entry (void *data)
+{
+    HevFshClientMuxConnect *self = data;
+    HevFshClientBase *base = data;
+    unsigned int timeout = HEV_FSH_IO (self)->timeout;
+    HevFshMux *mux;
+    int res;
+
+    res = hev_fsh_client_connect_send_connect (&self->base);
+    if (res < 0) {
+        hev_fsh_client_listen_set_mux (self->listen, NULL, 0);
+        goto exit;
+    }
+
+    res = hev_fsh_client_mux_connect_write_mux (self);
+    if (res < 0) {
+        LOG_I ("%p fsh client mux connect refused", self);
+        hev_fsh_client_listen_set_mux (self->listen, NULL, 1);
+        goto exit;
+    }
+
+    mux = hev_fsh_mux_new (base->fd, timeout, NULL, NULL);
+    if (!mux) {
+        hev_fsh_client_listen_set_mux (self->listen, NULL, 0);
+        goto exit;
+    }
+
+    hev_fsh_client_listen_set_mux (self->listen, mux, 0);
+    hev_fsh_mux_serve (mux);
+    hev_fsh_client_listen_set_mux (self->listen, NULL, 0);
+
+    hev_fsh_mux_stop (mux);
+    hev_object_unref (HEV_OBJECT (mux));
+
+exit:
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+static void
+hev_fsh_client_mux_connect_run (HevFshIO *base)
+{
+    LOG_D ("%p fsh client mux connect run", base);
+
+    hev_fsh_io_task_run (base, hev_fsh_client_mux_connect_task_entry);
+}
+
+HevFshClientBase *
+hev_fsh_client_mux_connect_new (HevFshConfig *config,
+                                HevFshClientListen *listen)
+{
+    HevFshClientMuxConnect *self;
+    int res;
+
+    self = hev_fsh_io_alloc (sizeof (HevFshClientMuxConnect),
+                             HEV_FSH_TASK_CONNECT);
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_client_mux_connect_construct (self, config, listen);
+    if (res < 0) {
+        hev_fsh_io_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh client mux connect new", self);
+
+    return HEV_FSH_CLIENT_BASE (self);
+}
+
+int
+hev_fsh_client_mux_connect_construct (HevFshClientMuxConnect *self,
+                                      HevFshConfig *config,
+                                      HevFshClientListen *listen)
+{
+    int res;
+
+    res = hev_fsh_client_connect_construct (&self->base, config);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh client mux connect construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_CLIENT_MUX_CONNECT_TYPE;
+
+    self->listen = listen;
+    hev_object_ref (HEV_OBJECT (listen));
+
+    return 0;
+}
+
+static void
+hev_fsh_client_mux_connect_destruct (HevObject *base)
+{
+    HevFshClientMuxConnect *self = HEV_FSH_CLIENT_MUX_CONNECT (base);
+
+    LOG_D ("%p fsh client mux connect destruct", self);
+
+    hev_object_unref (HEV_OBJECT (self->listen));
+
+    HEV_FSH_CLIENT_CONNECT_TYPE->finalizer (base);
+}
+
+HevObjectClass *
+hev_fsh_client_mux_connect_class (void)
+{
+    static HevFshClientMuxConnectClass klass;
+    HevFshClientMuxConnectClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        HevFshIOClass *ikptr;
+        void *ptr;
+
+        ptr = HEV_FSH_CLIENT_CONNECT_TYPE;
+        memcpy (kptr, ptr, sizeof (HevFshClientConnectClass));
+
+        okptr->name = "HevFshClientMuxConnect";
+        okptr->finalizer = hev_fsh_client_mux_connect_destruct;
+
+        ikptr = HEV_FSH_IO_CLASS (kptr);
+        ikptr->run = hev_fsh_client_mux_connect_run;
+    }
+
+    return okptr;
+}
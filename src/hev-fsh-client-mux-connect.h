@@ -0,0 +1,52 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-client-mux-connect.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh client mux connect
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_CLIENT_MUX_CONNECT_H__
+#define __HEV_FSH_CLIENT_MUX_CONNECT_H__
+
+#include "hev-fsh-client-listen.h"
+#include "hev-fsh-client-connect.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_CLIENT_MUX_CONNECT(p) ((HevFshClientMuxConnect *)p)
+#define HEV_FSH_CLIENT_MUX_CONNECT_CLASS(p) ((HevFshClientMuxConnectClass *)p)
+#define HEV_FSH_CLIENT_MUX_CONNECT_TYPE (hev_fsh_client_mux_connect_class ())
+
+typedef struct _HevFshClientMuxConnect HevFshClientMuxConnect;
+typedef struct _HevFshClientMuxConnectClass HevFshClientMuxConnectClass;
+
+struct _HevFshClientMuxConnect
+{
+    HevFshClientConnect base;
+
+    HevFshClientListen *listen;
+};
+
+struct _HevFshClientMuxConnectClass
+{
+    HevFshClientConnectClass base;
+};
+
+HevObjectClass *hev_fsh_client_mux_connect_class (void);
+
+int hev_fsh_client_mux_connect_construct (HevFshClientMuxConnect *self,
+                                          HevFshConfig *config,
+                                          HevFshClientListen *listen);
+
+HevFshClientBase *hev_fsh_client_mux_connect_new (HevFshConfig *config,
+                                                  HevFshClientListen *listen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_CLIENT_MUX_CONNECT_H__ */
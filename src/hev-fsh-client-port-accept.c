@@ -16,7 +16,6 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
-#include "hev-task-io-us.h"
 
 #include "hev-fsh-client-port-accept.h"
 
@@ -43,6 +42,11 @@ hev_fsh_client_port_accept_task_entry (void *data)
     if (res <= 0)
         goto quit;
 
+    if (!mpinfo.type) {
+        hev_fsh_client_accept_serve_mux (&self->base);
+        goto quit;
+    }
+
     res = hev_fsh_config_addr_list_contains (base->config, mpinfo.type,
                                              mpinfo.addr, mpinfo.port);
     if (res == 0)
@@ -82,10 +86,7 @@ hev_fsh_client_port_accept_task_entry (void *data)
     if (res < 0)
         goto quit_close;
 
-    if (hev_fsh_config_is_ugly_ktls (base->config))
-        hev_task_io_us_splice (rfd, rfd, lfd, lfd, 8192, io_yielder, self);
-    else
-        hev_task_io_splice (rfd, rfd, lfd, lfd, 8192, io_yielder, self);
+    hev_fsh_client_base_splice (base, rfd, rfd, lfd, lfd, HEV_FSH_SPLICE_BULK);
 
 quit_close:
     close (lfd);
@@ -93,12 +94,21 @@ quit:
     hev_object_unref (HEV_OBJECT (self));
 }
 
+static HevFshClientBase *
+hev_fsh_client_port_accept_new_stream (HevFshClientAccept *base,
+                                       HevFshToken token)
+{
+    HevFshConfig *config = HEV_FSH_CLIENT_BASE (base)->config;
+
+    return hev_fsh_client_port_accept_new (config, token);
+}
+
 static void
 hev_fsh_client_port_accept_run (HevFshIO *base)
 {
     LOG_D ("%p fsh client port accept run", base);
 
-    hev_task_run (base->task, hev_fsh_client_port_accept_task_entry, base);
+    hev_fsh_io_task_run (base, hev_fsh_client_port_accept_task_entry);
 }
 
 HevFshClientBase *
@@ -107,13 +117,14 @@ hev_fsh_client_port_accept_new (HevFshConfig *config, HevFshToken token)
     HevFshClientPortAccept *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientPortAccept));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientPortAccept),
+                             HEV_FSH_TASK_PORT);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_port_accept_construct (self, config, token);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -128,7 +139,8 @@ hev_fsh_client_port_accept_construct (HevFshClientPortAccept *self,
 {
     int res;
 
-    res = hev_fsh_client_accept_construct (&self->base, config, token);
+    res = hev_fsh_client_accept_construct (&self->base, config, token,
+                                           HEV_FSH_TASK_PORT);
     if (res < 0)
         return res;
 
@@ -157,6 +169,7 @@ hev_fsh_client_port_accept_class (void)
     HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
 
     if (!okptr->name) {
+        HevFshClientAcceptClass *akptr;
         HevFshIOClass *ikptr;
         void *ptr;
 
@@ -168,6 +181,9 @@ hev_fsh_client_port_accept_class (void)
 
         ikptr = HEV_FSH_IO_CLASS (kptr);
         ikptr->run = hev_fsh_client_port_accept_run;
+
+        akptr = HEV_FSH_CLIENT_ACCEPT_CLASS (kptr);
+        akptr->new_stream = hev_fsh_client_port_accept_new_stream;
     }
 
     return okptr;
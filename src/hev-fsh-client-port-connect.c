@@ -18,7 +18,6 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
-#include "hev-task-io-us.h"
 #include "hev-fsh-protocol.h"
 
 #include "hev-fsh-client-port-connect.h"
@@ -37,16 +36,11 @@ hev_fsh_client_port_connect_task_entry (void *data)
     int bfd;
     int res;
 
-    res = hev_fsh_client_connect_send_connect (&self->base);
-    if (res < 0)
-        goto exit;
-
     addr = hev_fsh_config_get_remote_address (base->config);
     port = hev_fsh_config_get_remote_port (base->config);
 
     __builtin_bzero (mpinfo.addr, sizeof (mpinfo.addr));
     mpinfo.port = htons (port);
-    bfd = base->fd;
 
     if (inet_pton (AF_INET, addr, mpinfo.addr) == 1) {
         mpinfo.type = 4;
@@ -55,6 +49,19 @@ hev_fsh_client_port_connect_task_entry (void *data)
         inet_pton (AF_INET6, addr, mpinfo.addr);
     }
 
+    if (self->base.mux) {
+        res = hev_fsh_client_connect_splice_mux (&self->base, self->fd,
+                                                 &mpinfo, sizeof (mpinfo));
+        if (res == 0)
+            goto exit;
+    }
+
+    res = hev_fsh_client_connect_send_connect (&self->base);
+    if (res < 0)
+        goto exit;
+
+    bfd = base->fd;
+
     /* send message port info */
     res = hev_task_io_socket_send (bfd, &mpinfo, sizeof (mpinfo), MSG_WAITALL,
                                    io_yielder, self);
@@ -84,10 +91,7 @@ hev_fsh_client_port_connect_task_entry (void *data)
         hev_task_add_fd (task, ifd, POLLIN | POLLOUT);
     }
 
-    if (hev_fsh_config_is_ugly_ktls (base->config))
-        hev_task_io_us_splice (bfd, bfd, ifd, ofd, 8192, io_yielder, self);
-    else
-        hev_task_io_splice (bfd, bfd, ifd, ofd, 8192, io_yielder, self);
+    hev_fsh_client_base_splice (base, bfd, bfd, ifd, ofd, HEV_FSH_SPLICE_BULK);
 
 exit:
     hev_object_unref (HEV_OBJECT (self));
@@ -98,7 +102,7 @@ hev_fsh_client_port_connect_run (HevFshIO *base)
 {
     LOG_D ("%p fsh client port connect run", base);
 
-    hev_task_run (base->task, hev_fsh_client_port_connect_task_entry, base);
+    hev_fsh_io_task_run (base, hev_fsh_client_port_connect_task_entry);
 }
 
 HevFshClientBase *
@@ -107,13 +111,14 @@ hev_fsh_client_port_connect_new (HevFshConfig *config, int fd)
     HevFshClientPortConnect *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientPortConnect));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientPortConnect),
+                             HEV_FSH_TASK_CONNECT);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_port_connect_construct (self, config, fd);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -27,12 +27,29 @@ hev_fsh_client_sock_accept_task_entry (void *data)
     HevFshClientSockAccept *self = data;
     HevFshClientBase *base = data;
     HevSocks5Server *socks;
+    unsigned char ver;
     int res;
 
     res = hev_fsh_client_accept_send_accept (&self->base);
     if (res < 0)
         goto quit;
 
+    res = hev_task_io_socket_recv (base->fd, &ver, sizeof (ver), MSG_PEEK,
+                                   io_yielder, self);
+    if (res <= 0)
+        goto quit;
+
+    /* not a socks5 greeting, the connector asks for multiplexing */
+    if (ver != 5) {
+        HevFshMessage msg;
+
+        res = hev_task_io_socket_recv (base->fd, &msg, sizeof (msg),
+                                       MSG_WAITALL, io_yielder, self);
+        if ((res > 0) && (msg.cmd == HEV_FSH_CMD_MUX))
+            hev_fsh_client_accept_serve_mux (&self->base);
+        goto quit;
+    }
+
     if (hev_fsh_config_is_ugly_ktls (base->config))
         socks = hev_socks5_server_us_new (base->fd);
     else
@@ -47,12 +64,21 @@ quit:
     hev_object_unref (HEV_OBJECT (self));
 }
 
+static HevFshClientBase *
+hev_fsh_client_sock_accept_new_stream (HevFshClientAccept *base,
+                                       HevFshToken token)
+{
+    HevFshConfig *config = HEV_FSH_CLIENT_BASE (base)->config;
+
+    return hev_fsh_client_sock_accept_new (config, token);
+}
+
 static void
 hev_fsh_client_sock_accept_run (HevFshIO *base)
 {
     LOG_D ("%p fsh client sock accept run", base);
 
-    hev_task_run (base->task, hev_fsh_client_sock_accept_task_entry, base);
+    hev_fsh_io_task_run (base, hev_fsh_client_sock_accept_task_entry);
 }
 
 HevFshClientBase *
@@ -61,13 +87,14 @@ hev_fsh_client_sock_accept_new (HevFshConfig *config, HevFshToken token)
     HevFshClientSockAccept *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientSockAccept));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientSockAccept),
+                             HEV_FSH_TASK_SOCK);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_sock_accept_construct (self, config, token);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -82,7 +109,8 @@ hev_fsh_client_sock_accept_construct (HevFshClientSockAccept *self,
 {
     int res;
 
-    res = hev_fsh_client_accept_construct (&self->base, config, token);
+    res = hev_fsh_client_accept_construct (&self->base, config, token,
+                                           HEV_FSH_TASK_SOCK);
     if (res < 0)
         return res;
 
@@ -111,6 +139,7 @@ hev_fsh_client_sock_accept_class (void)
     HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
 
     if (!okptr->name) {
+        HevFshClientAcceptClass *akptr;
         HevFshIOClass *ikptr;
         void *ptr;
 
@@ -122,6 +151,9 @@ hev_fsh_client_sock_accept_class (void)
 
         ikptr = HEV_FSH_IO_CLASS (kptr);
         ikptr->run = hev_fsh_client_sock_accept_run;
+
+        akptr = HEV_FSH_CLIENT_ACCEPT_CLASS (kptr);
+        akptr->new_stream = hev_fsh_client_sock_accept_new_stream;
     }
 
     return okptr;
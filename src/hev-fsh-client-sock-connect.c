@@ -16,7 +16,6 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
-#include "hev-task-io-us.h"
 #include "hev-fsh-protocol.h"
 
 #include "hev-fsh-client-sock-connect.h"
@@ -30,6 +29,13 @@ hev_fsh_client_sock_connect_task_entry (void *data)
     int bfd;
     int res;
 
+    if (self->base.mux) {
+        res = hev_fsh_client_connect_splice_mux (&self->base, self->fd, NULL,
+                                                 0);
+        if (res == 0)
+            goto exit;
+    }
+
     res = hev_fsh_client_connect_send_connect (&self->base);
     if (res < 0)
         goto exit;
@@ -38,10 +44,7 @@ hev_fsh_client_sock_connect_task_entry (void *data)
     bfd = base->fd;
     hev_task_add_fd (hev_task_self (), sfd, POLLIN | POLLOUT);
 
-    if (hev_fsh_config_is_ugly_ktls (base->config))
-        hev_task_io_us_splice (bfd, bfd, sfd, sfd, 8192, io_yielder, self);
-    else
-        hev_task_io_splice (bfd, bfd, sfd, sfd, 8192, io_yielder, self);
+    hev_fsh_client_base_splice (base, bfd, bfd, sfd, sfd, HEV_FSH_SPLICE_BULK);
 
 exit:
     hev_object_unref (HEV_OBJECT (self));
@@ -52,7 +55,7 @@ hev_fsh_client_sock_connect_run (HevFshIO *base)
 {
     LOG_D ("%p fsh client sock connect run", base);
 
-    hev_task_run (base->task, hev_fsh_client_sock_connect_task_entry, base);
+    hev_fsh_io_task_run (base, hev_fsh_client_sock_connect_task_entry);
 }
 
 HevFshClientBase *
@@ -61,13 +64,14 @@ hev_fsh_client_sock_connect_new (HevFshConfig *config, int fd)
     HevFshClientSockConnect *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientSockConnect));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientSockConnect),
+                             HEV_FSH_TASK_CONNECT);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_sock_connect_construct (self, config, fd);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -27,10 +27,14 @@ hev_fsh_client_sock_listen_dispatch (HevFshClientListen *base, int fd)
     HevFshClientBase *client;
 
     client = hev_fsh_client_sock_connect_new (b->config, fd);
-    if (client)
+    if (client) {
+        HevFshMux *mux = hev_fsh_client_listen_get_mux (base);
+
+        hev_fsh_client_connect_set_mux (HEV_FSH_CLIENT_CONNECT (client), mux);
         hev_fsh_io_run (HEV_FSH_IO (client));
-    else
+    } else {
         close (fd);
+    }
 }
 
 HevFshClientBase *
@@ -39,13 +43,14 @@ hev_fsh_client_sock_listen_new (HevFshConfig *config)
     HevFshClientSockListen *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientSockListen));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientSockListen),
+                             HEV_FSH_TASK_LISTEN);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_sock_listen_construct (self, config);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
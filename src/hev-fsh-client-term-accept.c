@@ -29,7 +29,6 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
-#include "hev-task-io-us.h"
 #include "hev-fsh-protocol.h"
 
 #include "hev-fsh-client-term-accept.h"
@@ -152,10 +151,7 @@ hev_fsh_client_term_accept_task_entry (void *data)
 
     hev_task_add_fd (hev_task_self (), pfd, POLLIN | POLLOUT);
 
-    if (hev_fsh_config_is_ugly_ktls (base->config))
-        hev_task_io_us_splice (sfd, sfd, pfd, pfd, 8192, io_yielder, self);
-    else
-        hev_task_io_splice (sfd, sfd, pfd, pfd, 8192, io_yielder, self);
+    hev_fsh_client_base_splice (base, sfd, sfd, pfd, pfd, HEV_FSH_SPLICE_TERM);
 
 quit_close:
     close (pfd);
@@ -168,7 +164,7 @@ hev_fsh_client_term_accept_run (HevFshIO *base)
 {
     LOG_D ("%p fsh client term accept run", base);
 
-    hev_task_run (base->task, hev_fsh_client_term_accept_task_entry, base);
+    hev_fsh_io_task_run (base, hev_fsh_client_term_accept_task_entry);
 }
 
 HevFshClientBase *
@@ -177,13 +173,14 @@ hev_fsh_client_term_accept_new (HevFshConfig *config, HevFshToken token)
     HevFshClientTermAccept *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientTermAccept));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientTermAccept),
+                             HEV_FSH_TASK_TERM);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_term_accept_construct (self, config, token);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -198,7 +195,8 @@ hev_fsh_client_term_accept_construct (HevFshClientTermAccept *self,
 {
     int res;
 
-    res = hev_fsh_client_accept_construct (&self->base, config, token);
+    res = hev_fsh_client_accept_construct (&self->base, config, token,
+                                           HEV_FSH_TASK_TERM);
     if (res < 0)
         return res;
 
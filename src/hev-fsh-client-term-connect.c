@@ -19,7 +19,6 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
-#include "hev-task-io-us.h"
 #include "hev-fsh-protocol.h"
 
 #include "hev-fsh-client-term-connect.h"
@@ -75,10 +74,7 @@ hev_fsh_client_term_connect_task_entry (void *data)
     if (res < 0)
         goto exit;
 
-    if (hev_fsh_config_is_ugly_ktls (base->config))
-        hev_task_io_us_splice (fd, fd, 0, 1, 8192, io_yielder, self);
-    else
-        hev_task_io_splice (fd, fd, 0, 1, 8192, io_yielder, self);
+    hev_fsh_client_base_splice (base, fd, fd, 0, 1, HEV_FSH_SPLICE_TERM);
 
     tcsetattr (0, TCSADRAIN, &term);
 
@@ -91,7 +87,7 @@ hev_fsh_client_term_connect_run (HevFshIO *base)
 {
     LOG_D ("%p fsh client term connect run", base);
 
-    hev_task_run (base->task, hev_fsh_client_term_connect_task_entry, base);
+    hev_fsh_io_task_run (base, hev_fsh_client_term_connect_task_entry);
 }
 
 HevFshClientBase *
@@ -100,13 +96,14 @@ hev_fsh_client_term_connect_new (HevFshConfig *config)
     HevFshClientTermConnect *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshClientTermConnect));
+    self = hev_fsh_io_alloc (sizeof (HevFshClientTermConnect),
+                             HEV_FSH_TASK_CONNECT);
     if (!self)
         return NULL;
 
     res = hev_fsh_client_term_connect_construct (self, config);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
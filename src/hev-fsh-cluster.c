@@ -0,0 +1,657 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-cluster.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh server cluster
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-task.h"
+#include "hev-fsh-session.h"
+#include "hev-fsh-server-worker.h"
+
+#include "hev-fsh-cluster.h"
+
+#define HEV_FSH_CLUSTER_SLOTS (4096)
+#define HEV_FSH_CLUSTER_RETRY (1000)
+#define HEV_FSH_CLUSTER_SILENTS (2)
+
+struct _HevFshClusterEntry
+{
+    HevFshClusterEntry *next;
+
+    void *link;
+    HevFshToken node;
+    HevFshToken token;
+};
+
+struct _HevFshClusterLink
+{
+    HevFshCluster *cluster;
+    HevFshServerWorker *worker;
+    unsigned int peer;
+    unsigned int silents;
+
+    HevFshToken node;
+    HevFshMux *mux;
+    HevTask *task;
+};
+
+static unsigned int
+hev_fsh_cluster_hash (HevFshToken token)
+{
+    unsigned int hash;
+
+    hash = (unsigned int)token[8] << 24;
+    hash |= (unsigned int)token[9] << 16;
+    hash |= (unsigned int)token[10] << 8;
+    hash |= (unsigned int)token[11];
+
+    return hash & (HEV_FSH_CLUSTER_SLOTS - 1);
+}
+
+static HevFshClusterEntry **
+hev_fsh_cluster_find (HevFshCluster *self, HevFshToken token)
+{
+    HevFshClusterEntry **pe = &self->slots[hev_fsh_cluster_hash (token)];
+
+    for (; *pe; pe = &(*pe)->next) {
+        if (memcmp ((*pe)->token, token, sizeof (HevFshToken)) == 0)
+            break;
+    }
+
+    return pe;
+}
+
+static void
+hev_fsh_cluster_sipround (uint64_t v[4])
+{
+    v[0] += v[1];
+    v[1] = (v[1] << 13) | (v[1] >> 51);
+    v[1] ^= v[0];
+    v[0] = (v[0] << 32) | (v[0] >> 32);
+    v[2] += v[3];
+    v[3] = (v[3] << 16) | (v[3] >> 48);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = (v[3] << 21) | (v[3] >> 43);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = (v[1] << 17) | (v[1] >> 47);
+    v[1] ^= v[2];
+    v[2] = (v[2] << 32) | (v[2] >> 32);
+}
+
+static uint64_t
+hev_fsh_cluster_siphash (const unsigned char *key, const unsigned char *data,
+                         size_t len)
+{
+    uint64_t k0, k1, v[4], m, b;
+    size_t i;
+
+    /* SipHash-2-4 */
+    memcpy (&k0, &key[0], sizeof (k0));
+    memcpy (&k1, &key[8], sizeof (k1));
+    v[0] = k0 ^ 0x736f6d6570736575ULL;
+    v[1] = k1 ^ 0x646f72616e646f6dULL;
+    v[2] = k0 ^ 0x6c7967656e657261ULL;
+    v[3] = k1 ^ 0x7465646279746573ULL;
+
+    for (i = 0; i < len; i += sizeof (m)) {
+        memcpy (&m, &data[i], sizeof (m));
+        v[3] ^= m;
+        hev_fsh_cluster_sipround (v);
+        hev_fsh_cluster_sipround (v);
+        v[0] ^= m;
+    }
+
+    b = (uint64_t)len << 56;
+    v[3] ^= b;
+    hev_fsh_cluster_sipround (v);
+    hev_fsh_cluster_sipround (v);
+    v[0] ^= b;
+
+    v[2] ^= 0xff;
+    for (i = 0; i < 4; i++)
+        hev_fsh_cluster_sipround (v);
+
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+void
+hev_fsh_cluster_prove (HevFshCluster *self, HevFshToken nonce,
+                       HevFshToken from, HevFshToken to, HevFshToken proof)
+{
+    HevFshConfigKey *key = hev_fsh_config_get_key (self->config);
+    unsigned char data[sizeof (HevFshToken) * 3];
+    uint64_t mac;
+
+    memcpy (&data[0], nonce, sizeof (HevFshToken));
+    memcpy (&data[16], from, sizeof (HevFshToken));
+    memcpy (&data[32], to, sizeof (HevFshToken));
+
+    __builtin_bzero (proof, sizeof (HevFshToken));
+    mac = hev_fsh_cluster_siphash (key->key, data, sizeof (data));
+    memcpy (proof, &mac, sizeof (mac));
+}
+
+int
+hev_fsh_cluster_find_peer (HevFshCluster *self, struct sockaddr *addr)
+{
+    struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)addr;
+    struct sockaddr_in *a4 = (struct sockaddr_in *)addr;
+    unsigned int i;
+
+    for (i = 0; i < self->nr_peers; i++) {
+        struct sockaddr_in6 *p6;
+        struct sockaddr_in *p4;
+        struct sockaddr *p;
+        socklen_t len;
+
+        p = hev_fsh_config_get_peer_sockaddr (self->config, i, &len);
+        p4 = (struct sockaddr_in *)p;
+        p6 = (struct sockaddr_in6 *)p;
+
+        /* any port, the links dial out from ephemeral ones */
+        if (p->sa_family == AF_INET) {
+            if (addr->sa_family == AF_INET) {
+                if (a4->sin_addr.s_addr == p4->sin_addr.s_addr)
+                    return i;
+            } else if ((addr->sa_family == AF_INET6) &&
+                       IN6_IS_ADDR_V4MAPPED (&a6->sin6_addr)) {
+                if (memcmp (&a6->sin6_addr.s6_addr[12], &p4->sin_addr, 4) == 0)
+                    return i;
+            }
+        } else if ((p->sa_family == AF_INET6) &&
+                   (addr->sa_family == AF_INET6)) {
+            if (memcmp (&a6->sin6_addr, &p6->sin6_addr, 16) == 0)
+                return i;
+        }
+    }
+
+    return -1;
+}
+
+void
+hev_fsh_cluster_learn (HevFshCluster *self, void *link, HevFshToken node,
+                       HevFshToken token, int is_held)
+{
+    HevFshClusterEntry **pe;
+    HevFshClusterEntry *e;
+
+    pthread_mutex_lock (&self->lock);
+
+    pe = hev_fsh_cluster_find (self, token);
+    e = *pe;
+
+    if (!is_held) {
+        if (e && (memcmp (e->node, node, sizeof (HevFshToken)) == 0)) {
+            *pe = e->next;
+            hev_free (e);
+        }
+        goto exit;
+    }
+
+    if (!e) {
+        e = hev_malloc (sizeof (HevFshClusterEntry));
+        if (!e)
+            goto exit;
+        memcpy (e->token, token, sizeof (HevFshToken));
+        e->next = NULL;
+        *pe = e;
+    }
+
+    /* last login wins */
+    e->link = link;
+    memcpy (e->node, node, sizeof (HevFshToken));
+
+exit:
+    pthread_mutex_unlock (&self->lock);
+}
+
+void
+hev_fsh_cluster_forget (HevFshCluster *self, void *link)
+{
+    unsigned int i, n = 0;
+
+    pthread_mutex_lock (&self->lock);
+
+    for (i = 0; i < HEV_FSH_CLUSTER_SLOTS; i++) {
+        HevFshClusterEntry **pe = &self->slots[i];
+
+        while (*pe) {
+            HevFshClusterEntry *e = *pe;
+
+            if (e->link != link) {
+                pe = &e->next;
+                continue;
+            }
+
+            *pe = e->next;
+            hev_free (e);
+            n++;
+        }
+    }
+
+    pthread_mutex_unlock (&self->lock);
+
+    LOG_D ("%p fsh cluster forget %p %u", self, link, n);
+}
+
+HevFshMux *
+hev_fsh_cluster_route (HevFshCluster *self, HevFshServerWorker *worker,
+                       HevFshToken token)
+{
+    HevFshClusterLink *links;
+    HevFshClusterEntry *e;
+    HevFshToken node;
+    unsigned int i;
+
+    pthread_mutex_lock (&self->lock);
+    e = *hev_fsh_cluster_find (self, token);
+    if (e)
+        memcpy (node, e->node, sizeof (HevFshToken));
+    pthread_mutex_unlock (&self->lock);
+
+    if (!e)
+        return NULL;
+
+    links = &self->links[worker->id * self->nr_peers];
+    for (i = 0; i < self->nr_peers; i++) {
+        HevFshClusterLink *l = &links[i];
+
+        if (!l->mux || memcmp (l->node, node, sizeof (HevFshToken)) != 0)
+            continue;
+
+        hev_object_ref (HEV_OBJECT (l->mux));
+        return l->mux;
+    }
+
+    return NULL;
+}
+
+void
+hev_fsh_cluster_announce (HevFshCluster *self, HevFshServerWorker *worker,
+                          HevFshToken token, int is_held)
+{
+    HevFshClusterLink *links;
+    unsigned int i;
+    int ver;
+
+    ver = is_held ? 1 : 2;
+    links = &self->links[worker->id * self->nr_peers];
+
+    for (i = 0; i < self->nr_peers; i++) {
+        HevFshMux *mux = links[i].mux;
+
+        if (!mux)
+            continue;
+
+        hev_object_ref (HEV_OBJECT (mux));
+        hev_fsh_mux_write_message (mux, ver, HEV_FSH_CMD_NODE_TOKEN, token,
+                                   sizeof (HevFshToken));
+        hev_object_unref (HEV_OBJECT (mux));
+    }
+}
+
+static int
+hev_fsh_cluster_link_yielder (HevTaskYieldType type, void *data)
+{
+    HevFshClusterLink *self = data;
+    unsigned int interval;
+
+    if (self->worker->is_draining)
+        return -1;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+        return 0;
+    }
+
+    interval = hev_fsh_config_get_timeout (self->cluster->config) * 500;
+    if (hev_task_sleep (interval)) {
+        self->silents = 0;
+        return self->worker->is_draining;
+    }
+
+    if (!self->mux || (++self->silents > HEV_FSH_CLUSTER_SILENTS))
+        return -1;
+
+    hev_fsh_mux_write_message (self->mux, 2, HEV_FSH_CMD_KEEP_ALIVE, NULL, 0);
+
+    return 0;
+}
+
+static int
+hev_fsh_cluster_link_connect (HevFshClusterLink *self)
+{
+    HevFshCluster *cluster = self->cluster;
+    struct msghdr mh = { 0 };
+    struct sockaddr *addr;
+    HevFshMessageToken mt[2];
+    HevFshMessage msg;
+    struct iovec iov[2];
+    socklen_t len;
+    int fd, res;
+
+    addr = hev_fsh_config_get_peer_sockaddr (cluster->config, self->peer,
+                                             &len);
+    if (!addr)
+        return -1;
+
+    fd = hev_task_io_socket_socket (addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+        return -1;
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+
+    res = hev_task_io_socket_connect (fd, addr, len,
+                                      hev_fsh_cluster_link_yielder, self);
+    if (res < 0)
+        goto close;
+
+    msg.ver = 1;
+    msg.cmd = HEV_FSH_CMD_NODE;
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof (msg);
+    iov[1].iov_base = cluster->node;
+    iov[1].iov_len = sizeof (HevFshToken);
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+
+    res = hev_task_io_socket_sendmsg (fd, &mh, MSG_WAITALL,
+                                      hev_fsh_cluster_link_yielder, self);
+    if (res <= 0)
+        goto close;
+
+    res = hev_task_io_socket_recv (fd, &msg, sizeof (msg), MSG_WAITALL,
+                                   hev_fsh_cluster_link_yielder, self);
+    if ((res <= 0) || (msg.cmd != HEV_FSH_CMD_NODE) || (msg.ver != 2))
+        goto close;
+
+    res = hev_task_io_socket_recv (fd, mt, sizeof (mt), MSG_WAITALL,
+                                   hev_fsh_cluster_link_yielder, self);
+    if (res <= 0)
+        goto close;
+
+    if (memcmp (mt[0].token, cluster->node, sizeof (HevFshToken)) == 0)
+        goto close;
+
+    memcpy (self->node, mt[0].token, sizeof (HevFshToken));
+
+    msg.ver = 3;
+    hev_fsh_cluster_prove (cluster, mt[1].token, cluster->node, self->node,
+                           mt[1].token);
+    iov[1].iov_base = mt[1].token;
+    mh.msg_iovlen = 2;
+
+    res = hev_task_io_socket_sendmsg (fd, &mh, MSG_WAITALL,
+                                      hev_fsh_cluster_link_yielder, self);
+    if (res <= 0)
+        goto close;
+
+    return fd;
+
+close:
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+    return -1;
+}
+
+static int
+hev_fsh_cluster_link_sync (HevFshClusterLink *self)
+{
+    HevFshSessionManager *manager = self->worker->manager;
+    unsigned int iter = 0;
+    HevFshSession *s;
+
+    while ((s = hev_fsh_session_manager_next (manager, &iter))) {
+        HevFshToken token;
+        int res;
+
+        iter++;
+        if (!hev_fsh_session_is_forwarder (s))
+            continue;
+
+        memcpy (token, s->token, sizeof (HevFshToken));
+        res = hev_fsh_mux_write_message (self->mux, 1, HEV_FSH_CMD_NODE_TOKEN,
+                                         token, sizeof (HevFshToken));
+        if (res <= 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void
+hev_fsh_cluster_link_serve (HevFshClusterLink *self, int fd)
+{
+    for (;;) {
+        HevFshMessage msg;
+        int res;
+
+        res = hev_task_io_socket_recv (fd, &msg, sizeof (msg), MSG_WAITALL,
+                                       hev_fsh_cluster_link_yielder, self);
+        if (res <= 0)
+            break;
+
+        switch (msg.cmd) {
+        case HEV_FSH_CMD_KEEP_ALIVE:
+            continue;
+        case HEV_FSH_CMD_STREAM_OPEN:
+        case HEV_FSH_CMD_STREAM_DATA:
+        case HEV_FSH_CMD_STREAM_WINDOW:
+        case HEV_FSH_CMD_STREAM_CLOSE:
+            res = hev_fsh_mux_dispatch (self->mux, &msg,
+                                        hev_fsh_cluster_link_yielder, self);
+            break;
+        default:
+            res = -1;
+        }
+
+        if (res < 0)
+            break;
+    }
+}
+
+static void
+hev_fsh_cluster_link_task_entry (void *data)
+{
+    HevFshClusterLink *self = data;
+    unsigned int timeout;
+
+    timeout = hev_fsh_config_get_timeout (self->cluster->config) * 1000;
+
+    while (!self->worker->is_draining) {
+        int fd;
+
+        fd = hev_fsh_cluster_link_connect (self);
+        if (fd < 0)
+            goto retry;
+
+        self->mux = hev_fsh_mux_new (fd, timeout, NULL, NULL);
+        if (self->mux) {
+            LOG_I ("%p fsh cluster link %u up", self, self->peer);
+
+            self->silents = 0;
+            if (hev_fsh_cluster_link_sync (self) == 0)
+                hev_fsh_cluster_link_serve (self, fd);
+
+            hev_fsh_mux_stop (self->mux);
+            hev_object_unref (HEV_OBJECT (self->mux));
+            self->mux = NULL;
+
+            LOG_I ("%p fsh cluster link %u down", self, self->peer);
+        }
+
+        hev_task_del_fd (hev_task_self (), fd);
+        close (fd);
+
+    retry:
+        if (!self->worker->is_draining)
+            hev_task_sleep (HEV_FSH_CLUSTER_RETRY);
+    }
+}
+
+int
+hev_fsh_cluster_run (HevFshCluster *self, HevFshServerWorker *worker)
+{
+    HevFshClusterLink *links;
+    unsigned int i;
+
+    LOG_D ("%p fsh cluster run %d", self, worker->id);
+
+    links = &self->links[worker->id * self->nr_peers];
+    for (i = 0; i < self->nr_peers; i++) {
+        HevFshClusterLink *l = &links[i];
+
+        l->cluster = self;
+        l->worker = worker;
+        l->peer = i;
+
+        l->task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+        if (!l->task)
+            return -1;
+
+        hev_task_ref (l->task);
+        hev_fsh_task_run (l->task, HEV_FSH_TASK_SERVICE,
+                          hev_fsh_cluster_link_task_entry, l);
+    }
+
+    return 0;
+}
+
+void
+hev_fsh_cluster_drain (HevFshCluster *self, HevFshServerWorker *worker)
+{
+    HevFshClusterLink *links;
+    unsigned int i;
+
+    links = &self->links[worker->id * self->nr_peers];
+    for (i = 0; i < self->nr_peers; i++) {
+        if (links[i].task)
+            hev_task_wakeup (links[i].task);
+    }
+}
+
+HevFshCluster *
+hev_fsh_cluster_new (HevFshConfig *config, unsigned int nr_workers)
+{
+    HevFshCluster *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevFshCluster));
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_cluster_construct (self, config, nr_workers);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh cluster new", self);
+
+    return self;
+}
+
+int
+hev_fsh_cluster_construct (HevFshCluster *self, HevFshConfig *config,
+                           unsigned int nr_workers)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh cluster construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_CLUSTER_TYPE;
+
+    if (!hev_fsh_config_get_key (config)) {
+        LOG_E ("%p fsh cluster key", self);
+        return -1;
+    }
+
+    self->config = config;
+    self->nr_peers = hev_fsh_config_get_nr_peers (config);
+    self->nr_links = nr_workers * self->nr_peers;
+
+    hev_fsh_protocol_token_generate (self->node);
+
+    self->slots = hev_calloc (HEV_FSH_CLUSTER_SLOTS,
+                              sizeof (HevFshClusterEntry *));
+    if (!self->slots)
+        return -1;
+
+    self->links = hev_calloc (self->nr_links, sizeof (HevFshClusterLink));
+    if (!self->links) {
+        hev_free (self->slots);
+        return -1;
+    }
+
+    pthread_mutex_init (&self->lock, NULL);
+
+    return 0;
+}
+
+static void
+hev_fsh_cluster_destruct (HevObject *base)
+{
+    HevFshCluster *self = HEV_FSH_CLUSTER (base);
+    unsigned int i;
+
+    LOG_D ("%p fsh cluster destruct", self);
+
+    for (i = 0; i < HEV_FSH_CLUSTER_SLOTS; i++) {
+        while (self->slots[i]) {
+            HevFshClusterEntry *e = self->slots[i];
+
+            self->slots[i] = e->next;
+            hev_free (e);
+        }
+    }
+
+    for (i = 0; i < self->nr_links; i++) {
+        if (self->links[i].task)
+            hev_task_unref (self->links[i].task);
+    }
+
+    pthread_mutex_destroy (&self->lock);
+    hev_free (self->links);
+    hev_free (self->slots);
+
+    HEV_OBJECT_TYPE->finalizer (base);
+    hev_free (self);
+}
+
+HevObjectClass *
+hev_fsh_cluster_class (void)
+{
+    static HevFshClusterClass klass;
+    HevFshClusterClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevFshCluster";
+        okptr->finalizer = hev_fsh_cluster_destruct;
+    }
+
+    return okptr;
+}
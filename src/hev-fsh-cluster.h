@@ -0,0 +1,91 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-cluster.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh server cluster
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_CLUSTER_H__
+#define __HEV_FSH_CLUSTER_H__
+
+#include <pthread.h>
+
+#include "hev-object.h"
+#include "hev-fsh-mux.h"
+#include "hev-fsh-config.h"
+#include "hev-fsh-protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_CLUSTER(p) ((HevFshCluster *)p)
+#define HEV_FSH_CLUSTER_CLASS(p) ((HevFshClusterClass *)p)
+#define HEV_FSH_CLUSTER_TYPE (hev_fsh_cluster_class ())
+
+typedef struct _HevFshServerWorker HevFshServerWorker;
+typedef struct _HevFshCluster HevFshCluster;
+typedef struct _HevFshClusterClass HevFshClusterClass;
+typedef struct _HevFshClusterLink HevFshClusterLink;
+typedef struct _HevFshClusterEntry HevFshClusterEntry;
+
+/*
+ * Nodes know each other by random ids. Every worker links to every peer
+ * and announces the forwarders it holds there; what peers announce goes
+ * into the directory, shared by the workers, and connectors for those
+ * tokens are relayed as streams over the link of their worker.
+ */
+struct _HevFshCluster
+{
+    HevObject base;
+
+    HevFshToken node;
+    unsigned int nr_peers;
+    unsigned int nr_links;
+
+    pthread_mutex_t lock;
+    HevFshClusterEntry **slots;
+    HevFshClusterLink *links;
+    HevFshConfig *config;
+};
+
+struct _HevFshClusterClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_fsh_cluster_class (void);
+
+int hev_fsh_cluster_construct (HevFshCluster *self, HevFshConfig *config,
+                               unsigned int nr_workers);
+
+HevFshCluster *hev_fsh_cluster_new (HevFshConfig *config,
+                                    unsigned int nr_workers);
+
+int hev_fsh_cluster_run (HevFshCluster *self, HevFshServerWorker *worker);
+void hev_fsh_cluster_drain (HevFshCluster *self, HevFshServerWorker *worker);
+
+void hev_fsh_cluster_announce (HevFshCluster *self,
+                               HevFshServerWorker *worker, HevFshToken token,
+                               int is_held);
+
+HevFshMux *hev_fsh_cluster_route (HevFshCluster *self,
+                                  HevFshServerWorker *worker,
+                                  HevFshToken token);
+
+int hev_fsh_cluster_find_peer (HevFshCluster *self, struct sockaddr *addr);
+void hev_fsh_cluster_prove (HevFshCluster *self, HevFshToken nonce,
+                            HevFshToken from, HevFshToken to,
+                            HevFshToken proof);
+
+void hev_fsh_cluster_learn (HevFshCluster *self, void *link, HevFshToken node,
+                            HevFshToken token, int is_held);
+void hev_fsh_cluster_forget (HevFshCluster *self, void *link);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_CLUSTER_H__ */
@@ -7,23 +7,21 @@
  ============================================================================
  */
 
-#include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/utsname.h>
 
-#include <hev-task-dns.h>
-#include <hev-task-call.h>
-
 #include "hev-fsh-config.h"
 #include "hev-memory-allocator.h"
 
-typedef struct _HevTaskCallResolv HevTaskCallResolv;
 typedef struct _HevFshAddrListNode HevFshAddrListNode;
+typedef struct _HevFshPeerListNode HevFshPeerListNode;
 
 struct _HevFshConfig
 {
@@ -32,16 +30,26 @@ struct _HevFshConfig
     int ip_type;
     int log_level;
     int ugly_ktls;
+    int mux;
 
     const char *server_address;
     const char *server_port;
     unsigned int timeout;
+    unsigned int threads;
+    unsigned int pool_size;
+    unsigned int drain_timeout;
+    unsigned int login_rate;
+    unsigned int nr_peers;
 
     const char *user;
     const char *token;
     const char *log_path;
+    const char *handover_path;
+    const char *snapshot_path;
 
     HevFshAddrListNode *addr_list;
+    HevFshPeerListNode *peer_list;
+    HevFshResolver *resolver;
 
     const char *local_address;
     unsigned int local_port;
@@ -52,14 +60,6 @@ struct _HevFshConfig
     HevFshConfigKey key;
 };
 
-struct _HevTaskCallResolv
-{
-    HevTaskCall base;
-
-    HevFshConfig *config;
-    socklen_t *len;
-};
-
 struct _HevFshAddrListNode
 {
     HevFshAddrListNode *next;
@@ -71,6 +71,14 @@ struct _HevFshAddrListNode
     unsigned int port;
 };
 
+struct _HevFshPeerListNode
+{
+    HevFshPeerListNode *next;
+
+    socklen_t len;
+    struct sockaddr_storage addr;
+};
+
 HevFshConfig *
 hev_fsh_config_new (void)
 {
@@ -83,6 +91,8 @@ hev_fsh_config_new (void)
     }
 
     self->timeout = 120;
+    self->threads = 1;
+    self->drain_timeout = 60;
     self->server_port = "6339";
     self->local_address = "127.0.0.1";
 
@@ -101,6 +111,16 @@ hev_fsh_config_destroy (HevFshConfig *self)
         hev_free (node);
     }
 
+    while (self->peer_list) {
+        HevFshPeerListNode *node = self->peer_list;
+
+        self->peer_list = node->next;
+        hev_free (node);
+    }
+
+    if (self->resolver)
+        hev_object_unref (HEV_OBJECT (self->resolver));
+
     hev_free (self);
 }
 
@@ -253,6 +273,140 @@ hev_fsh_config_set_key (HevFshConfig *self, HevFshConfigKey *val)
     }
 }
 
+unsigned int
+hev_fsh_config_get_threads (HevFshConfig *self)
+{
+    return self->threads;
+}
+
+void
+hev_fsh_config_set_threads (HevFshConfig *self, unsigned int val)
+{
+    /* zero means one worker per online processor */
+    if (!val) {
+        long n = sysconf (_SC_NPROCESSORS_ONLN);
+        val = (n > 0) ? n : 1;
+    }
+
+    self->threads = val;
+}
+
+unsigned int
+hev_fsh_config_get_drain_timeout (HevFshConfig *self)
+{
+    return self->drain_timeout;
+}
+
+void
+hev_fsh_config_set_drain_timeout (HevFshConfig *self, unsigned int val)
+{
+    self->drain_timeout = val;
+}
+
+unsigned int
+hev_fsh_config_get_login_rate (HevFshConfig *self)
+{
+    return self->login_rate;
+}
+
+void
+hev_fsh_config_set_login_rate (HevFshConfig *self, unsigned int val)
+{
+    self->login_rate = val;
+}
+
+const char *
+hev_fsh_config_get_handover_path (HevFshConfig *self)
+{
+    return self->handover_path;
+}
+
+void
+hev_fsh_config_set_handover_path (HevFshConfig *self, const char *val)
+{
+    self->handover_path = val;
+}
+
+const char *
+hev_fsh_config_get_snapshot_path (HevFshConfig *self)
+{
+    return self->snapshot_path;
+}
+
+void
+hev_fsh_config_set_snapshot_path (HevFshConfig *self, const char *val)
+{
+    self->snapshot_path = val;
+}
+
+unsigned int
+hev_fsh_config_get_nr_peers (HevFshConfig *self)
+{
+    return self->nr_peers;
+}
+
+struct sockaddr *
+hev_fsh_config_get_peer_sockaddr (HevFshConfig *self, unsigned int index,
+                                  socklen_t *len)
+{
+    HevFshPeerListNode *iter = self->peer_list;
+
+    for (; iter && index; index--)
+        iter = iter->next;
+    if (!iter)
+        return NULL;
+
+    *len = iter->len;
+    return (struct sockaddr *)&iter->addr;
+}
+
+void
+hev_fsh_config_peer_list_add (HevFshConfig *self, struct sockaddr *addr,
+                              socklen_t len)
+{
+    HevFshPeerListNode **tail = &self->peer_list;
+    HevFshPeerListNode *node;
+
+    if (len > sizeof (node->addr))
+        return;
+
+    node = hev_malloc0 (sizeof (HevFshPeerListNode));
+    if (!node)
+        return;
+
+    node->len = len;
+    memcpy (&node->addr, addr, len);
+
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = node;
+    self->nr_peers++;
+}
+
+unsigned int
+hev_fsh_config_get_pool_size (HevFshConfig *self)
+{
+    return self->pool_size;
+}
+
+void
+hev_fsh_config_set_pool_size (HevFshConfig *self, unsigned int val)
+{
+    self->pool_size = val;
+}
+
+int
+hev_fsh_config_get_mux (HevFshConfig *self)
+{
+    return self->mux;
+}
+
+void
+hev_fsh_config_set_mux (HevFshConfig *self, int val)
+{
+    self->mux = val;
+}
+
 const char *
 hev_fsh_config_get_user (HevFshConfig *self)
 {
@@ -394,67 +548,65 @@ parse_sockaddr (socklen_t *len, const char *address, int port)
     return NULL;
 }
 
-static void
-resolv_entry (HevTaskCall *call)
+static HevFshResolver *
+hev_fsh_config_get_resolver (HevFshConfig *self)
 {
-    HevTaskCallResolv *resolv = (HevTaskCallResolv *)call;
-    const char *address = resolv->config->server_address;
-    const char *port = resolv->config->server_port;
-    static struct sockaddr_storage addr;
-    struct addrinfo *res = NULL;
-    struct addrinfo hints;
-    int s;
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    int family;
 
-    __builtin_bzero (&hints, sizeof (hints));
-    switch (resolv->config->ip_type) {
+    switch (self->ip_type) {
     case 4:
-        hints.ai_family = AF_INET;
+        family = AF_INET;
         break;
     case 6:
-        hints.ai_family = AF_INET6;
+        family = AF_INET6;
         break;
     default:
-        hints.ai_family = AF_UNSPEC;
+        family = AF_UNSPEC;
         break;
     }
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
 
-    s = hev_task_dns_getaddrinfo (address, port, &hints, &res);
-    if ((s != 0) || !res) {
-        hev_task_call_set_retval (call, NULL);
-        return;
-    }
+    /* called from worker threads */
+    pthread_mutex_lock (&lock);
+    if (!self->resolver)
+        self->resolver = hev_fsh_resolver_new (self->server_address,
+                                               self->server_port, family);
+    pthread_mutex_unlock (&lock);
 
-    *resolv->len = res->ai_addrlen;
-    memcpy (&addr, res->ai_addr, res->ai_addrlen);
-    hev_task_call_set_retval (call, &addr);
-    freeaddrinfo (res);
+    return self->resolver;
 }
 
-struct sockaddr *
-hev_fsh_config_get_server_sockaddr (HevFshConfig *self, socklen_t *len)
+int
+hev_fsh_config_get_server_addrs (HevFshConfig *self, HevFshResolverAddr *addrs,
+                                 unsigned int max)
 {
+    HevFshResolver *resolver;
     struct sockaddr *addr;
+    socklen_t len;
 
-    addr = parse_sockaddr (len, self->server_address, atoi (self->server_port));
-    if (!addr) {
-        HevTaskCall *call;
-        HevTaskCallResolv *resolv;
+    if (!max)
+        return 0;
 
-        call = hev_task_call_new (sizeof (HevTaskCallResolv), 16384);
-        if (!call)
-            return NULL;
+    addr = parse_sockaddr (&len, self->server_address,
+                           atoi (self->server_port));
+    if (addr) {
+        addrs[0].len = len;
+        memcpy (&addrs[0].addr, addr, len);
+        return 1;
+    }
 
-        resolv = (HevTaskCallResolv *)call;
-        resolv->config = self;
-        resolv->len = len;
+    resolver = hev_fsh_config_get_resolver (self);
+    if (!resolver)
+        return -1;
 
-        addr = hev_task_call_jump (call, resolv_entry);
-        hev_task_call_destroy (call);
-    }
+    return hev_fsh_resolver_get (resolver, addrs, max);
+}
 
-    return addr;
+void
+hev_fsh_config_set_server_family (HevFshConfig *self, int family)
+{
+    if (self->resolver)
+        hev_fsh_resolver_set_preferred (self->resolver, family);
 }
 
 struct sockaddr *
@@ -12,6 +12,8 @@
 
 #include <netinet/in.h>
 
+#include "hev-fsh-resolver.h"
+
 #define HEV_FSH_CONFIG_TASK_STACK_SIZE (16384)
 
 typedef struct _HevFshConfig HevFshConfig;
@@ -69,6 +71,36 @@ void hev_fsh_config_set_timeout (HevFshConfig *self, unsigned int val);
 HevFshConfigKey *hev_fsh_config_get_key (HevFshConfig *self);
 void hev_fsh_config_set_key (HevFshConfig *self, HevFshConfigKey *val);
 
+/* Server */
+unsigned int hev_fsh_config_get_threads (HevFshConfig *self);
+void hev_fsh_config_set_threads (HevFshConfig *self, unsigned int val);
+
+unsigned int hev_fsh_config_get_drain_timeout (HevFshConfig *self);
+void hev_fsh_config_set_drain_timeout (HevFshConfig *self, unsigned int val);
+
+unsigned int hev_fsh_config_get_login_rate (HevFshConfig *self);
+void hev_fsh_config_set_login_rate (HevFshConfig *self, unsigned int val);
+
+const char *hev_fsh_config_get_handover_path (HevFshConfig *self);
+void hev_fsh_config_set_handover_path (HevFshConfig *self, const char *val);
+
+const char *hev_fsh_config_get_snapshot_path (HevFshConfig *self);
+void hev_fsh_config_set_snapshot_path (HevFshConfig *self, const char *val);
+
+unsigned int hev_fsh_config_get_nr_peers (HevFshConfig *self);
+struct sockaddr *hev_fsh_config_get_peer_sockaddr (HevFshConfig *self,
+                                                   unsigned int index,
+                                                   socklen_t *len);
+void hev_fsh_config_peer_list_add (HevFshConfig *self, struct sockaddr *addr,
+                                   socklen_t len);
+
+/* Forwarder */
+unsigned int hev_fsh_config_get_pool_size (HevFshConfig *self);
+void hev_fsh_config_set_pool_size (HevFshConfig *self, unsigned int val);
+
+int hev_fsh_config_get_mux (HevFshConfig *self);
+void hev_fsh_config_set_mux (HevFshConfig *self, int val);
+
 /* Forwarder terminal */
 const char *hev_fsh_config_get_user (HevFshConfig *self);
 void hev_fsh_config_set_user (HevFshConfig *self, const char *val);
@@ -93,8 +125,10 @@ unsigned int hev_fsh_config_get_remote_port (HevFshConfig *self);
 void hev_fsh_config_set_remote_port (HevFshConfig *self, unsigned int val);
 
 /* Helper */
-struct sockaddr *hev_fsh_config_get_server_sockaddr (HevFshConfig *self,
-                                                     socklen_t *len);
+int hev_fsh_config_get_server_addrs (HevFshConfig *self,
+                                     HevFshResolverAddr *addrs,
+                                     unsigned int max);
+void hev_fsh_config_set_server_family (HevFshConfig *self, int family);
 struct sockaddr *hev_fsh_config_get_local_sockaddr (HevFshConfig *self,
                                                     socklen_t *len);
 
@@ -0,0 +1,303 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-handover.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh listener handover
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+
+#include "hev-logger.h"
+
+#include "hev-fsh-handover.h"
+
+#define HEV_FSH_HANDOVER_REQUEST 'H'
+#define HEV_FSH_HANDOVER_ACK 'A'
+#define HEV_FSH_HANDOVER_PUT_TRIES (500)
+#define HEV_FSH_HANDOVER_PUT_WAIT (10)
+
+static int
+hev_fsh_handover_addr (struct sockaddr_un *addr, const char *path)
+{
+    if (strlen (path) >= sizeof (addr->sun_path))
+        return -1;
+
+    memset (addr, 0, sizeof (struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy (addr->sun_path, path);
+
+    return 0;
+}
+
+static unsigned int
+hev_fsh_handover_nr_fds (unsigned char type)
+{
+    switch (type) {
+    case HEV_FSH_HANDOVER_FORWARD:
+    case HEV_FSH_HANDOVER_PARK:
+        return 1;
+    case HEV_FSH_HANDOVER_SPLICE:
+        return 2;
+    }
+
+    return 0;
+}
+
+int
+hev_fsh_handover_fetch (const char *path, int *fds, unsigned int *count)
+{
+    char control[CMSG_SPACE (sizeof (int) * HEV_FSH_HANDOVER_MAX_FDS)];
+    struct sockaddr_un addr;
+    struct msghdr mh = { 0 };
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    unsigned int n;
+    char req = HEV_FSH_HANDOVER_REQUEST;
+    int fd;
+
+    *count = 0;
+
+    if (hev_fsh_handover_addr (&addr, path) < 0) {
+        LOG_E ("fsh handover path too long");
+        return -1;
+    }
+
+    /* blocking, the task system is not running yet */
+    fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    if (write (fd, &req, 1) != 1)
+        goto close;
+
+    iov.iov_base = &n;
+    iov.iov_len = sizeof (n);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof (control);
+
+    if (recvmsg (fd, &mh, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof (n))
+        goto close;
+
+    cmsg = CMSG_FIRSTHDR (&mh);
+    if (!cmsg || (cmsg->cmsg_level != SOL_SOCKET) ||
+        (cmsg->cmsg_type != SCM_RIGHTS) ||
+        (cmsg->cmsg_len != CMSG_LEN (sizeof (int) * n)) ||
+        (n > HEV_FSH_HANDOVER_MAX_FDS)) {
+        LOG_E ("fsh handover message");
+        goto close;
+    }
+
+    memcpy (fds, CMSG_DATA (cmsg), sizeof (int) * n);
+    *count = n;
+
+    LOG_I ("fsh handover took %u listeners", n);
+
+    return fd;
+
+close:
+    close (fd);
+    return -1;
+}
+
+int
+hev_fsh_handover_ack (int fd)
+{
+    char ack = HEV_FSH_HANDOVER_ACK;
+
+    if (write (fd, &ack, 1) != 1) {
+        LOG_W ("fsh handover ack");
+        return -1;
+    }
+
+    if (fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK) < 0)
+        return -1;
+
+    return 0;
+}
+
+int
+hev_fsh_handover_get_session (int fd, HevFshHandoverSession *hs, int *fds,
+                              HevTaskIOYielder yielder, void *yielder_data)
+{
+    for (;;) {
+        char control[CMSG_SPACE (sizeof (int) * 2)];
+        struct msghdr mh = { 0 };
+        struct cmsghdr *cmsg;
+        struct iovec iov;
+        unsigned int n = 0;
+        ssize_t s;
+
+        iov.iov_base = hs;
+        iov.iov_len = sizeof (HevFshHandoverSession);
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof (control);
+
+        /* one record a message, zero once the predecessor is done */
+        s = hev_task_io_socket_recvmsg (fd, &mh, MSG_CMSG_CLOEXEC, yielder,
+                                        yielder_data);
+        if (s <= 0)
+            return s;
+
+        cmsg = CMSG_FIRSTHDR (&mh);
+        if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) &&
+            (cmsg->cmsg_type == SCM_RIGHTS)) {
+            n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+            memcpy (fds, CMSG_DATA (cmsg), sizeof (int) * n);
+        }
+
+        if ((s == sizeof (HevFshHandoverSession)) &&
+            !(mh.msg_flags & MSG_CTRUNC) &&
+            (n == hev_fsh_handover_nr_fds (hs->type)))
+            return 1;
+
+        LOG_W ("fsh handover session message");
+        while (n-- > 0)
+            close (fds[n]);
+    }
+}
+
+int
+hev_fsh_handover_listen (const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (hev_fsh_handover_addr (&addr, path) < 0) {
+        LOG_E ("fsh handover path too long");
+        return -1;
+    }
+
+    fd = hev_task_io_socket_socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0) {
+        LOG_E ("fsh handover socket");
+        return -1;
+    }
+
+    unlink (path);
+    if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+        LOG_E ("fsh handover bind");
+        close (fd);
+        return -1;
+    }
+
+    chmod (path, S_IRUSR | S_IWUSR);
+
+    if (listen (fd, 1) < 0) {
+        LOG_E ("fsh handover listen");
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int
+hev_fsh_handover_send (int fd, int *fds, unsigned int count,
+                       HevTaskIOYielder yielder, void *yielder_data)
+{
+    char control[CMSG_SPACE (sizeof (int) * HEV_FSH_HANDOVER_MAX_FDS)];
+    struct msghdr mh = { 0 };
+    struct cmsghdr *cmsg;
+    struct ucred cred;
+    struct iovec iov;
+    socklen_t len = sizeof (cred);
+    char b;
+
+    if (!count || (count > HEV_FSH_HANDOVER_MAX_FDS))
+        return -1;
+
+    /* listeners are only given to our own user */
+    if ((getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) ||
+        (cred.uid != getuid ())) {
+        LOG_W ("fsh handover peer credentials");
+        return -1;
+    }
+
+    if ((hev_task_io_socket_recv (fd, &b, 1, MSG_WAITALL, yielder,
+                                  yielder_data) != 1) ||
+        (b != HEV_FSH_HANDOVER_REQUEST))
+        return -1;
+
+    iov.iov_base = &count;
+    iov.iov_len = sizeof (count);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = CMSG_SPACE (sizeof (int) * count);
+
+    cmsg = CMSG_FIRSTHDR (&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int) * count);
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * count);
+
+    if (hev_task_io_socket_sendmsg (fd, &mh, MSG_WAITALL, yielder,
+                                    yielder_data) != sizeof (count))
+        return -1;
+
+    /* no ack, the successor died starting up and we keep serving */
+    if ((hev_task_io_socket_recv (fd, &b, 1, MSG_WAITALL, yielder,
+                                  yielder_data) != 1) ||
+        (b != HEV_FSH_HANDOVER_ACK))
+        return -1;
+
+    return 0;
+}
+
+int
+hev_fsh_handover_put_session (int fd, HevFshHandoverSession *hs, int *fds)
+{
+    char control[CMSG_SPACE (sizeof (int) * 2)];
+    unsigned int n = hev_fsh_handover_nr_fds (hs->type);
+    struct msghdr mh = { 0 };
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    int i;
+
+    iov.iov_base = hs;
+    iov.iov_len = sizeof (HevFshHandoverSession);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = CMSG_SPACE (sizeof (int) * n);
+
+    cmsg = CMSG_FIRSTHDR (&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int) * n);
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * n);
+
+    /* not polled by this task, sleep out a full queue */
+    for (i = 0; i < HEV_FSH_HANDOVER_PUT_TRIES; i++) {
+        ssize_t s = sendmsg (fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (s == sizeof (HevFshHandoverSession))
+            return 0;
+        if ((s >= 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+            return -1;
+        hev_task_sleep (HEV_FSH_HANDOVER_PUT_WAIT);
+    }
+
+    return -1;
+}
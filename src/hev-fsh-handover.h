@@ -0,0 +1,70 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-handover.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh listener handover
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_HANDOVER_H__
+#define __HEV_FSH_HANDOVER_H__
+
+#include <hev-task-io.h>
+
+#include "hev-fsh-protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_HANDOVER_MAX_FDS (64)
+
+#define HEV_FSH_HANDOVER_TEMP_TOKEN (1 << 0)
+#define HEV_FSH_HANDOVER_POOL (1 << 1)
+#define HEV_FSH_HANDOVER_KLIVE (1 << 2)
+
+typedef struct _HevFshHandoverSession HevFshHandoverSession;
+
+enum
+{
+    HEV_FSH_HANDOVER_FORWARD = 1,
+    HEV_FSH_HANDOVER_PARK,
+    HEV_FSH_HANDOVER_SPLICE,
+};
+
+struct _HevFshHandoverSession
+{
+    unsigned char type;
+    unsigned char flags;
+    HevFshToken token;
+    HevFshToken key;
+} __attribute__ ((packed));
+
+/*
+ * The successor connects to the handover socket of the running server,
+ * receives its listeners and acks once it serves them; only then does
+ * the predecessor drain. Both sides stay accepting in between.
+ *
+ * After the ack the connection carries live sessions, one record with
+ * its fds per message, until the predecessor closes its end. The token
+ * routes a record to its worker, the key of a parked channel is the
+ * pool key.
+ */
+int hev_fsh_handover_fetch (const char *path, int *fds, unsigned int *count);
+int hev_fsh_handover_ack (int fd);
+int hev_fsh_handover_get_session (int fd, HevFshHandoverSession *hs, int *fds,
+                                  HevTaskIOYielder yielder,
+                                  void *yielder_data);
+
+int hev_fsh_handover_listen (const char *path);
+int hev_fsh_handover_send (int fd, int *fds, unsigned int count,
+                           HevTaskIOYielder yielder, void *yielder_data);
+int hev_fsh_handover_put_session (int fd, HevFshHandoverSession *hs,
+                                  int *fds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_HANDOVER_H__ */
@@ -0,0 +1,199 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-idler.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh idler
+ ============================================================================
+ */
+
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-task.h"
+#include "hev-fsh-session.h"
+
+#include "hev-fsh-idler.h"
+
+#define HEV_FSH_IDLER_EVENTS (256)
+
+#ifdef __linux__
+
+static void
+hev_fsh_idler_task_entry (void *data)
+{
+    HevFshIdler *self = data;
+
+    hev_task_add_fd (hev_task_self (), self->fd, POLLIN);
+
+    for (;;) {
+        struct epoll_event events[HEV_FSH_IDLER_EVENTS];
+        int i, n;
+
+        n = epoll_wait (self->fd, events, HEV_FSH_IDLER_EVENTS, 0);
+        if (n < 0) {
+            LOG_E ("%p fsh idler wait", self);
+            break;
+        }
+
+        /* one shot, a session is handed a task once per wake up */
+        for (i = 0; i < n; i++) {
+            HevFshIO *io = events[i].data.ptr;
+
+            if (!io->task)
+                hev_fsh_io_run (io);
+        }
+
+        if (n < HEV_FSH_IDLER_EVENTS)
+            hev_task_yield (HEV_TASK_WAITIO);
+    }
+
+    hev_task_del_fd (hev_task_self (), self->fd);
+}
+
+int
+hev_fsh_idler_run (HevFshIdler *self)
+{
+    LOG_D ("%p fsh idler run", self);
+
+    self->task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->task)
+        return -1;
+
+    hev_task_ref (self->task);
+    hev_fsh_task_run (self->task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_idler_task_entry, self);
+
+    return 0;
+}
+
+int
+hev_fsh_idler_add (HevFshIdler *self, HevFshSession *s)
+{
+    struct epoll_event event;
+    int res;
+
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = s;
+
+    res = epoll_ctl (self->fd, EPOLL_CTL_ADD, s->client_fd, &event);
+    if (res < 0)
+        return -1;
+
+    self->size++;
+
+    return 0;
+}
+
+void
+hev_fsh_idler_del (HevFshIdler *self, HevFshSession *s)
+{
+    epoll_ctl (self->fd, EPOLL_CTL_DEL, s->client_fd, NULL);
+    self->size--;
+}
+
+#else /* __linux__ */
+
+int
+hev_fsh_idler_run (HevFshIdler *self)
+{
+    return 0;
+}
+
+int
+hev_fsh_idler_add (HevFshIdler *self, HevFshSession *s)
+{
+    return -1;
+}
+
+void
+hev_fsh_idler_del (HevFshIdler *self, HevFshSession *s)
+{
+}
+
+#endif /* !__linux__ */
+
+HevFshIdler *
+hev_fsh_idler_new (void)
+{
+    HevFshIdler *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevFshIdler));
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_idler_construct (self);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh idler new", self);
+
+    return self;
+}
+
+int
+hev_fsh_idler_construct (HevFshIdler *self)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh idler construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_IDLER_TYPE;
+
+#ifdef __linux__
+    self->fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (self->fd < 0)
+        return -1;
+#else
+    self->fd = -1;
+#endif
+
+    return 0;
+}
+
+static void
+hev_fsh_idler_destruct (HevObject *base)
+{
+    HevFshIdler *self = HEV_FSH_IDLER (base);
+
+    LOG_D ("%p fsh idler destruct", self);
+
+    if (self->task)
+        hev_task_unref (self->task);
+    if (self->fd >= 0)
+        close (self->fd);
+
+    HEV_OBJECT_TYPE->finalizer (base);
+    hev_free (self);
+}
+
+HevObjectClass *
+hev_fsh_idler_class (void)
+{
+    static HevFshIdlerClass klass;
+    HevFshIdlerClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevFshIdler";
+        okptr->finalizer = hev_fsh_idler_destruct;
+    }
+
+    return okptr;
+}
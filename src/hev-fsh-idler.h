@@ -0,0 +1,59 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-idler.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh idler
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_IDLER_H__
+#define __HEV_FSH_IDLER_H__
+
+#include <hev-task.h>
+
+#include "hev-object.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_IDLER(p) ((HevFshIdler *)p)
+#define HEV_FSH_IDLER_CLASS(p) ((HevFshIdlerClass *)p)
+#define HEV_FSH_IDLER_TYPE (hev_fsh_idler_class ())
+
+typedef struct _HevFshSession HevFshSession;
+typedef struct _HevFshIdler HevFshIdler;
+typedef struct _HevFshIdlerClass HevFshIdlerClass;
+
+struct _HevFshIdler
+{
+    HevObject base;
+
+    int fd;
+    unsigned int size;
+
+    HevTask *task;
+};
+
+struct _HevFshIdlerClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_fsh_idler_class (void);
+
+int hev_fsh_idler_construct (HevFshIdler *self);
+
+HevFshIdler *hev_fsh_idler_new (void);
+
+int hev_fsh_idler_run (HevFshIdler *self);
+
+int hev_fsh_idler_add (HevFshIdler *self, HevFshSession *s);
+void hev_fsh_idler_del (HevFshIdler *self, HevFshSession *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_IDLER_H__ */
@@ -16,6 +16,155 @@
 
 #include "hev-fsh-io.h"
 
+#define HEV_FSH_IO_POOL_SIZE (128)
+#define HEV_FSH_IO_POOL_TYPES (16)
+
+typedef struct _HevFshIOPool HevFshIOPool;
+typedef struct _HevFshIOStats HevFshIOStats;
+
+struct _HevFshIOPool
+{
+    unsigned int size;
+    unsigned int count;
+    void *list;
+};
+
+struct _HevFshIOStats
+{
+    unsigned long allocs;
+    unsigned long hits;
+    unsigned int lives;
+    unsigned int frees;
+};
+
+static HevFshIOStats stats[HEV_FSH_TASK_ROLE_MAX];
+static __thread HevFshIOPool pools[HEV_FSH_IO_POOL_TYPES];
+
+static HevFshIOPool *
+hev_fsh_io_pool_get (unsigned int size)
+{
+    int i;
+
+    for (i = 0; i < HEV_FSH_IO_POOL_TYPES; i++) {
+        HevFshIOPool *pool = &pools[i];
+
+        if (!pool->size)
+            pool->size = size;
+        if (pool->size == size)
+            return pool;
+    }
+
+    return NULL;
+}
+
+void *
+hev_fsh_io_alloc (unsigned int size, HevFshTaskRole role)
+{
+    HevFshIOStats *st = &stats[role];
+    HevFshIOPool *pool;
+    HevFshIO *self;
+
+    __atomic_fetch_add (&st->allocs, 1, __ATOMIC_RELAXED);
+
+    pool = hev_fsh_io_pool_get (size);
+    if (pool && pool->list) {
+        self = pool->list;
+        pool->list = *(void **)self;
+        pool->count--;
+        memset (self, 0, size);
+        __atomic_fetch_add (&st->hits, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub (&st->frees, 1, __ATOMIC_RELAXED);
+    } else {
+        self = hev_malloc0 (size);
+        if (!self)
+            return NULL;
+    }
+
+    __atomic_fetch_add (&st->lives, 1, __ATOMIC_RELAXED);
+    self->size = size;
+    self->role = role;
+
+    return self;
+}
+
+void
+hev_fsh_io_free (void *data)
+{
+    HevFshIO *self = data;
+    HevFshIOStats *st = &stats[self->role];
+    HevFshIOPool *pool;
+
+    __atomic_fetch_sub (&st->lives, 1, __ATOMIC_RELAXED);
+
+    if (self->task)
+        hev_fsh_task_put (self->task, self->role);
+
+    pool = hev_fsh_io_pool_get (self->size);
+    if (!pool || (pool->count == HEV_FSH_IO_POOL_SIZE)) {
+        hev_free (self);
+        return;
+    }
+
+    *(void **)self = pool->list;
+    pool->list = self;
+    pool->count++;
+    __atomic_fetch_add (&st->frees, 1, __ATOMIC_RELAXED);
+}
+
+void
+hev_fsh_io_report (void)
+{
+    int i;
+
+    for (i = 0; i < HEV_FSH_TASK_ROLE_MAX; i++) {
+        HevFshIOStats *st = &stats[i];
+
+        if (!st->allocs)
+            continue;
+
+        LOG_I ("io %s pool hit %lu/%lu live %u free %u",
+               hev_fsh_task_get_role_name (i), st->hits, st->allocs,
+               st->lives, st->frees);
+    }
+}
+
+static void
+hev_fsh_io_timer_handler (HevFshTimerWheel *wheel, HevFshTimer *timer)
+{
+    HevFshIO *self = timer->data;
+    unsigned long long now = hev_fsh_timer_wheel_get_time (wheel);
+
+    /* pushed back by io since armed, re-arm for the rest only now */
+    if (self->deadline > now) {
+        hev_fsh_timer_wheel_add (wheel, timer, self->deadline - now);
+        return;
+    }
+
+    self->is_expired = 1;
+    if (self->task)
+        hev_task_wakeup (self->task);
+    else
+        hev_fsh_io_run (self);
+}
+
+int
+hev_fsh_io_set_deadline (HevFshIO *self, unsigned int milliseconds)
+{
+    HevFshTimerWheel *wheel = hev_fsh_timer_wheel_get ();
+
+    if (!wheel)
+        return -1;
+
+    /* deadlines only move forward, an armed timer is left in place */
+    if (!hev_fsh_timer_is_armed (&self->timer))
+        hev_fsh_timer_wheel_add (wheel, &self->timer, milliseconds);
+
+    self->deadline = hev_fsh_timer_wheel_get_time (wheel) + milliseconds;
+    self->is_expired = 0;
+
+    return 0;
+}
+
 int
 hev_fsh_io_yielder (HevTaskYieldType type, void *data)
 {
@@ -28,10 +177,18 @@ hev_fsh_io_yielder (HevTaskYieldType type, void *data)
 
     if (self->timeout < 0) {
         hev_task_yield (HEV_TASK_WAITIO);
+    } else if (self->timeout == 0) {
+        LOG_D ("%p fsh io timeout", self);
+        return -1;
     } else {
-        unsigned int timeout = self->timeout;
-        timeout = hev_task_sleep (timeout);
-        if (timeout == 0) {
+        int res;
+
+        res = hev_fsh_io_set_deadline (self, self->timeout);
+        if (res < 0)
+            return -1;
+
+        hev_task_yield (HEV_TASK_WAITIO);
+        if (self->is_expired) {
             LOG_D ("%p fsh io timeout", self);
             return -1;
         }
@@ -40,6 +197,13 @@ hev_fsh_io_yielder (HevTaskYieldType type, void *data)
     return 0;
 }
 
+void
+hev_fsh_io_task_run (HevFshIO *self, HevTaskEntry entry)
+{
+    hev_task_ref (self->task);
+    hev_fsh_task_run (self->task, self->role, entry, self);
+}
+
 void
 hev_fsh_io_run (HevFshIO *self)
 {
@@ -51,7 +215,8 @@ hev_fsh_io_run (HevFshIO *self)
 }
 
 int
-hev_fsh_io_construct (HevFshIO *self, unsigned int timeout)
+hev_fsh_io_construct (HevFshIO *self, unsigned int timeout,
+                     HevFshTaskRole role)
 {
     int res;
 
@@ -63,11 +228,14 @@ hev_fsh_io_construct (HevFshIO *self, unsigned int timeout)
 
     HEV_OBJECT (self)->klass = HEV_FSH_IO_TYPE;
 
-    self->task = hev_task_new (HEV_FSH_CONFIG_TASK_STACK_SIZE);
+    self->task = hev_fsh_task_new (role);
     if (!self->task)
         return -1;
 
+    self->role = role;
     self->timeout = timeout * 1000;
+    self->timer.handler = hev_fsh_io_timer_handler;
+    self->timer.data = self;
 
     return 0;
 }
@@ -79,8 +247,10 @@ hev_fsh_io_destruct (HevObject *base)
 
     LOG_D ("%p fsh io destruct", self);
 
+    if (hev_fsh_timer_is_armed (&self->timer))
+        hev_fsh_timer_wheel_del (hev_fsh_timer_wheel_get (), &self->timer);
     HEV_OBJECT_TYPE->finalizer (base);
-    hev_free (self);
+    hev_fsh_io_free (self);
 }
 
 HevObjectClass *
@@ -14,6 +14,8 @@
 #include <hev-task-io.h>
 
 #include "hev-object.h"
+#include "hev-fsh-task.h"
+#include "hev-fsh-timer-wheel.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,7 +34,12 @@ struct _HevFshIO
     HevObject base;
 
     HevTask *task;
+    unsigned int size;
     unsigned int timeout;
+    unsigned char is_expired;
+    unsigned char role;
+    unsigned long long deadline;
+    HevFshTimer timer;
 };
 
 struct _HevFshIOClass
@@ -44,9 +51,18 @@ struct _HevFshIOClass
 
 HevObjectClass *hev_fsh_io_class (void);
 
-int hev_fsh_io_construct (HevFshIO *self, unsigned int timeout);
+void *hev_fsh_io_alloc (unsigned int size, HevFshTaskRole role);
+void hev_fsh_io_free (void *self);
+
+void hev_fsh_io_report (void);
+
+int hev_fsh_io_construct (HevFshIO *self, unsigned int timeout,
+                         HevFshTaskRole role);
 
 void hev_fsh_io_run (HevFshIO *self);
+void hev_fsh_io_task_run (HevFshIO *self, HevTaskEntry entry);
+
+int hev_fsh_io_set_deadline (HevFshIO *self, unsigned int milliseconds);
 
 int hev_fsh_io_yielder (HevTaskYieldType type, void *data);
 
@@ -0,0 +1,907 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-mux.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh stream multiplexer
+ ============================================================================
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-circular-buffer.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-task.h"
+
+#include "hev-fsh-mux.h"
+
+#define HEV_FSH_MUX_WINDOW (65536)
+#define HEV_FSH_MUX_WINDOW_MAX (16 * 1024 * 1024)
+#define HEV_FSH_MUX_FRAME_SIZE (8192)
+#define HEV_FSH_MUX_FRAME_VER (2)
+
+struct _HevFshMuxStream
+{
+    HevFshMuxStream *next;
+
+    int fd;
+    unsigned int id;
+    unsigned int credit;
+    unsigned int consumed;
+    unsigned int window;
+    unsigned long long stamp;
+
+    unsigned char is_lfin : 1;
+    unsigned char is_rfin : 1;
+    unsigned char is_shut : 1;
+
+    HevFshMux *mux;
+    HevTask *task;
+    HevFshTimer timer;
+    HevCircularBuffer *rbuf;
+    void *wbuf;
+};
+
+static unsigned long long
+hev_fsh_mux_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned int
+hev_fsh_mux_get_rtt (HevFshMux *self)
+{
+#ifdef __linux__
+    struct tcp_info ti;
+    socklen_t len = sizeof (ti);
+
+    if (getsockopt (self->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+        return 0;
+
+    return ti.tcpi_rtt;
+#else
+    return 0;
+#endif
+}
+
+static void
+hev_fsh_mux_timer_handler (HevFshTimerWheel *wheel, HevFshTimer *timer)
+{
+    hev_task_wakeup (timer->data);
+}
+
+static unsigned int
+hev_fsh_mux_sleep (HevFshTimer *timer, unsigned int milliseconds)
+{
+    HevFshTimerWheel *wheel = hev_fsh_timer_wheel_get ();
+
+    if (!wheel)
+        return hev_task_sleep (milliseconds);
+
+    /* still armed once woken, it is not the timeout that woke us */
+    timer->handler = hev_fsh_mux_timer_handler;
+    timer->data = hev_task_self ();
+    hev_fsh_timer_wheel_add (wheel, timer, milliseconds);
+    hev_task_yield (HEV_TASK_WAITIO);
+    if (!hev_fsh_timer_is_armed (timer))
+        return 0;
+    hev_fsh_timer_wheel_del (wheel, timer);
+
+    return 1;
+}
+
+static int
+hev_fsh_mux_yielder (HevTaskYieldType type, void *data)
+{
+    HevFshMux *self = data;
+    unsigned int timeout;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+        return 0;
+    }
+
+    if (self->is_dead)
+        return -1;
+
+    self->writer = hev_task_self ();
+    timeout = hev_fsh_mux_sleep (&self->wtimer, self->timeout);
+    self->writer = NULL;
+
+    if (!timeout || self->is_dead)
+        return -1;
+
+    return 0;
+}
+
+static void
+hev_fsh_mux_abort (HevFshMux *self)
+{
+    LOG_D ("%p fsh mux abort", self);
+
+    /* a frame may be cut, the owner sees eof and stops us */
+    self->is_dead = 1;
+    shutdown (self->fd, SHUT_RDWR);
+}
+
+static int
+hev_fsh_mux_writev (HevFshMux *self, struct iovec *iov, int iovc)
+{
+    struct msghdr mh = { 0 };
+    int res = -1;
+
+    mh.msg_iov = iov;
+    mh.msg_iovlen = iovc;
+
+    hev_task_mutex_lock (&self->wlock);
+    if (!self->is_dead) {
+        res = hev_task_io_socket_sendmsg (self->fd, &mh, MSG_WAITALL,
+                                          hev_fsh_mux_yielder, self);
+        if (res <= 0)
+            hev_fsh_mux_abort (self);
+    }
+    hev_task_mutex_unlock (&self->wlock);
+
+    return res;
+}
+
+static int
+hev_fsh_mux_write_frame (HevFshMux *self, int cmd, unsigned int id,
+                         unsigned int size, void *data)
+{
+    HevFshMessageStream ms;
+    HevFshMessage msg;
+    struct iovec iov[3];
+
+    msg.ver = HEV_FSH_MUX_FRAME_VER;
+    msg.cmd = cmd;
+    ms.id = htonl (id);
+    ms.size = htonl (size);
+
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof (msg);
+    iov[1].iov_base = &ms;
+    iov[1].iov_len = sizeof (ms);
+    iov[2].iov_base = data;
+    iov[2].iov_len = size;
+
+    return hev_fsh_mux_writev (self, iov, data ? 3 : 2);
+}
+
+int
+hev_fsh_mux_write_message (HevFshMux *self, int ver, int cmd, void *data,
+                           size_t size)
+{
+    HevFshMessage msg;
+    struct iovec iov[2];
+
+    msg.ver = ver;
+    msg.cmd = cmd;
+
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof (msg);
+    iov[1].iov_base = data;
+    iov[1].iov_len = size;
+
+    return hev_fsh_mux_writev (self, iov, data ? 2 : 1);
+}
+
+static HevFshMuxStream *
+hev_fsh_mux_find (HevFshMux *self, unsigned int id)
+{
+    HevFshMuxStream *s;
+
+    s = self->slots[id & (self->nr_slots - 1)];
+    for (; s; s = s->next) {
+        if (s->id == id)
+            return s;
+    }
+
+    return NULL;
+}
+
+static void
+hev_fsh_mux_insert (HevFshMux *self, HevFshMuxStream *s)
+{
+    HevFshMuxStream **slot;
+
+    if (self->nr_streams >= self->nr_slots) {
+        HevFshMuxStream **slots;
+        unsigned int size = self->nr_slots * 2;
+        unsigned int i;
+
+        slots = hev_calloc (size, sizeof (HevFshMuxStream *));
+        if (slots) {
+            for (i = 0; i < self->nr_slots; i++) {
+                while (self->slots[i]) {
+                    HevFshMuxStream *t = self->slots[i];
+
+                    self->slots[i] = t->next;
+                    t->next = slots[t->id & (size - 1)];
+                    slots[t->id & (size - 1)] = t;
+                }
+            }
+            hev_free (self->slots);
+            self->slots = slots;
+            self->nr_slots = size;
+        }
+    }
+
+    slot = &self->slots[s->id & (self->nr_slots - 1)];
+    s->next = *slot;
+    *slot = s;
+    self->nr_streams++;
+}
+
+static void
+hev_fsh_mux_remove (HevFshMux *self, HevFshMuxStream *s)
+{
+    HevFshMuxStream **n = &self->slots[s->id & (self->nr_slots - 1)];
+
+    for (; *n; n = &(*n)->next) {
+        if (*n == s) {
+            *n = s->next;
+            self->nr_streams--;
+            break;
+        }
+    }
+}
+
+static HevFshMuxStream *
+hev_fsh_mux_stream_new (HevFshMux *self, unsigned int id, int fd,
+                        HevTask *task)
+{
+    HevFshMuxStream *s;
+
+    s = hev_malloc0 (sizeof (HevFshMuxStream));
+    if (!s)
+        return NULL;
+
+    s->rbuf = hev_circular_buffer_new (HEV_FSH_MUX_WINDOW);
+    if (!s->rbuf)
+        goto free;
+
+    s->wbuf = hev_malloc (HEV_FSH_MUX_FRAME_SIZE);
+    if (!s->wbuf)
+        goto free_rbuf;
+
+    s->id = id;
+    s->fd = fd;
+    s->mux = self;
+    s->task = task;
+    s->credit = HEV_FSH_MUX_WINDOW;
+    s->window = HEV_FSH_MUX_WINDOW;
+    s->stamp = hev_fsh_mux_now ();
+    hev_fsh_mux_insert (self, s);
+
+    return s;
+
+free_rbuf:
+    hev_circular_buffer_unref (s->rbuf);
+free:
+    hev_free (s);
+    return NULL;
+}
+
+static void
+hev_fsh_mux_stream_destroy (HevFshMux *self, HevFshMuxStream *s)
+{
+    hev_fsh_mux_remove (self, s);
+    hev_circular_buffer_unref (s->rbuf);
+    hev_free (s->wbuf);
+    hev_free (s);
+}
+
+static int
+hev_fsh_mux_stream_read (HevFshMux *self, HevFshMuxStream *s)
+{
+    unsigned int size = HEV_FSH_MUX_FRAME_SIZE;
+    ssize_t res;
+
+    if (s->is_lfin || !s->credit)
+        return 0;
+
+    if (size > s->credit)
+        size = s->credit;
+
+    res = read (s->fd, s->wbuf, size);
+    if (res < 0) {
+        if (errno == EAGAIN)
+            return 0;
+        return -1;
+    }
+
+    if (res == 0) {
+        s->is_lfin = 1;
+        res = hev_fsh_mux_write_frame (self, HEV_FSH_CMD_STREAM_CLOSE, s->id,
+                                       0, NULL);
+        if (res <= 0)
+            return -1;
+        return 1;
+    }
+
+    s->credit -= res;
+    res = hev_fsh_mux_write_frame (self, HEV_FSH_CMD_STREAM_DATA, s->id, res,
+                                   s->wbuf);
+    if (res <= 0)
+        return -1;
+
+    return 1;
+}
+
+/*
+ * The window is what the peer may have in flight, one window per round
+ * trip at most. Consumed at over half of that, the window is what holds
+ * the stream back: it doubles, and the peer is credited the difference.
+ */
+static unsigned int
+hev_fsh_mux_stream_grow (HevFshMux *self, HevFshMuxStream *s)
+{
+    unsigned long long now = hev_fsh_mux_now ();
+    unsigned long long since = now - s->stamp;
+    HevCircularBuffer *rbuf;
+    struct iovec iov[2];
+    unsigned int size = 0;
+    unsigned int rtt;
+    int i, iovc;
+
+    s->stamp = now;
+    if (!self->is_grow || (s->window >= HEV_FSH_MUX_WINDOW_MAX))
+        return 0;
+
+    rtt = hev_fsh_mux_get_rtt (self);
+    if (!rtt || (since >= (2ULL * rtt)) ||
+        ((since * s->window) >= (2ULL * rtt * s->consumed)))
+        return 0;
+
+    rbuf = hev_circular_buffer_new (s->window * 2);
+    if (!rbuf)
+        return 0;
+
+    iovc = hev_circular_buffer_reading (s->rbuf, iov);
+    for (i = 0; i < iovc; i++) {
+        struct iovec dst;
+
+        hev_circular_buffer_writing (rbuf, &dst);
+        memcpy (dst.iov_base, iov[i].iov_base, iov[i].iov_len);
+        hev_circular_buffer_write_finish (rbuf, iov[i].iov_len);
+        size += iov[i].iov_len;
+    }
+    hev_circular_buffer_read_finish (s->rbuf, size);
+    hev_circular_buffer_unref (s->rbuf);
+    s->rbuf = rbuf;
+
+    LOG_D ("%p fsh mux stream %u window %u", self, s->id, s->window * 2);
+
+    size = s->window;
+    s->window *= 2;
+
+    return size;
+}
+
+static int
+hev_fsh_mux_stream_write (HevFshMux *self, HevFshMuxStream *s)
+{
+    struct iovec iov[2];
+    int res = 0;
+    int iovc;
+
+    iovc = hev_circular_buffer_reading (s->rbuf, iov);
+    if (iovc) {
+        ssize_t n = writev (s->fd, iov, iovc);
+        if (n < 0) {
+            if (errno != EAGAIN)
+                return -1;
+        } else {
+            hev_circular_buffer_read_finish (s->rbuf, n);
+            s->consumed += n;
+            res = 1;
+        }
+    }
+
+    if (s->consumed && ((s->consumed >= (s->window / 4)) ||
+                        !hev_circular_buffer_get_use_size (s->rbuf))) {
+        unsigned int size = s->consumed;
+        int r;
+
+        size += hev_fsh_mux_stream_grow (self, s);
+        r = hev_fsh_mux_write_frame (self, HEV_FSH_CMD_STREAM_WINDOW, s->id,
+                                     size, NULL);
+        if (r <= 0)
+            return -1;
+        s->consumed = 0;
+    }
+
+    if (s->is_rfin && !s->is_shut &&
+        !hev_circular_buffer_get_use_size (s->rbuf)) {
+        shutdown (s->fd, SHUT_WR);
+        s->is_shut = 1;
+    }
+
+    return res;
+}
+
+static void
+hev_fsh_mux_stream_splice (HevFshMux *self, HevFshMuxStream *s)
+{
+    LOG_D ("%p fsh mux stream %u splice", self, s->id);
+
+    while (!self->is_dead) {
+        int res_r, res_w;
+
+        res_w = hev_fsh_mux_stream_write (self, s);
+        if (res_w < 0)
+            break;
+
+        res_r = hev_fsh_mux_stream_read (self, s);
+        if (res_r < 0)
+            break;
+
+        if (s->is_lfin && s->is_shut)
+            break;
+
+        if (res_r || res_w) {
+            hev_task_yield (HEV_TASK_YIELD);
+            continue;
+        }
+
+        if (!hev_fsh_mux_sleep (&s->timer, self->timeout)) {
+            LOG_D ("%p fsh mux stream %u timeout", self, s->id);
+            break;
+        }
+    }
+
+    if (!s->is_lfin && !self->is_dead)
+        hev_fsh_mux_write_frame (self, HEV_FSH_CMD_STREAM_CLOSE, s->id, 0,
+                                 NULL);
+}
+
+static void
+hev_fsh_mux_stream_task_entry (void *data)
+{
+    HevFshMuxStream *s = data;
+    HevFshMux *self = s->mux;
+    int fd = s->fd;
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+
+    hev_fsh_mux_stream_splice (self, s);
+
+    hev_task_del_fd (hev_task_self (), fd);
+    hev_fsh_mux_stream_destroy (self, s);
+    close (fd);
+
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+int
+hev_fsh_mux_splice (HevFshMux *self, int fd, HevFshToken token, void *head,
+                    size_t size)
+{
+    HevFshMuxStream *s;
+    int res;
+
+    if (self->is_dead)
+        return -1;
+
+    /* skip ids still in use after wrap around */
+    do {
+        self->id++;
+    } while (hev_fsh_mux_find (self, self->id));
+
+    s = hev_fsh_mux_stream_new (self, self->id, fd, hev_task_self ());
+    if (!s)
+        return -1;
+
+    hev_object_ref (HEV_OBJECT (self));
+
+    res = hev_fsh_mux_write_frame (self, HEV_FSH_CMD_STREAM_OPEN, s->id,
+                                   sizeof (HevFshToken), token);
+    if ((res > 0) && head) {
+        s->credit -= size;
+        res = hev_fsh_mux_write_frame (self, HEV_FSH_CMD_STREAM_DATA, s->id,
+                                       size, head);
+    }
+    if (res > 0)
+        hev_fsh_mux_stream_splice (self, s);
+
+    hev_fsh_mux_stream_destroy (self, s);
+    hev_object_unref (HEV_OBJECT (self));
+
+    return (res > 0) ? 0 : -1;
+}
+
+static ssize_t
+hev_fsh_mux_recv (HevFshMux *self, void *data, size_t len,
+                  HevTaskIOYielder yielder, void *yielder_data)
+{
+    if (self->reader)
+        return hev_fsh_reader_read (self->reader, self->fd, data, len, 0,
+                                    yielder, yielder_data);
+
+    return hev_task_io_socket_recv (self->fd, data, len, MSG_WAITALL, yielder,
+                                    yielder_data);
+}
+
+static ssize_t
+hev_fsh_mux_recv_iov (HevFshMux *self, struct msghdr *mh,
+                      HevTaskIOYielder yielder, void *yielder_data)
+{
+    HevFshReader *reader = self->reader;
+    ssize_t res, n = 0;
+    size_t i;
+
+    if (!reader || (reader->head == reader->tail))
+        return hev_task_io_socket_recvmsg (self->fd, mh, MSG_WAITALL, yielder,
+                                           yielder_data);
+
+    for (i = 0; i < mh->msg_iovlen; i++) {
+        struct iovec *iov = &mh->msg_iov[i];
+
+        res = hev_fsh_mux_recv (self, iov->iov_base, iov->iov_len, yielder,
+                                yielder_data);
+        if (res <= 0)
+            return res;
+        n += res;
+    }
+
+    return n;
+}
+
+static int
+hev_fsh_mux_accept (HevFshMux *self, unsigned int id, HevFshToken token)
+{
+    HevFshMuxStream *s;
+    HevTask *task;
+    int fd;
+
+    LOG_D ("%p fsh mux accept %u", self, id);
+
+    fd = self->accept (self, token, self->accept_data);
+    if (fd < 0)
+        goto close;
+
+    task = hev_fsh_task_new (HEV_FSH_TASK_STREAM);
+    if (!task)
+        goto close_fd;
+
+    s = hev_fsh_mux_stream_new (self, id, fd, task);
+    if (!s) {
+        hev_task_unref (task);
+        goto close_fd;
+    }
+
+    hev_object_ref (HEV_OBJECT (self));
+    hev_fsh_task_run (task, HEV_FSH_TASK_STREAM, hev_fsh_mux_stream_task_entry,
+                      s);
+
+    return 0;
+
+close_fd:
+    close (fd);
+close:
+    return hev_fsh_mux_write_frame (self, HEV_FSH_CMD_STREAM_CLOSE, id, 0,
+                                    NULL);
+}
+
+int
+hev_fsh_mux_dispatch (HevFshMux *self, HevFshMessage *msg,
+                      HevTaskIOYielder yielder, void *yielder_data)
+{
+    HevFshMessageStream ms;
+    HevFshMuxStream *s;
+    unsigned int size;
+    unsigned int id;
+    int res;
+
+    res = hev_fsh_mux_recv (self, &ms, sizeof (ms), yielder, yielder_data);
+    if (res <= 0)
+        return -1;
+
+    id = ntohl (ms.id);
+    size = ntohl (ms.size);
+    s = hev_fsh_mux_find (self, id);
+    if (msg->ver >= HEV_FSH_MUX_FRAME_VER)
+        self->is_grow = 1;
+
+    switch (msg->cmd) {
+    case HEV_FSH_CMD_STREAM_OPEN: {
+        HevFshMessageToken mt;
+
+        if (s || !self->accept || (size != sizeof (mt)))
+            return -1;
+
+        res = hev_fsh_mux_recv (self, &mt, sizeof (mt), yielder,
+                                yielder_data);
+        if (res <= 0)
+            return -1;
+
+        res = hev_fsh_mux_accept (self, id, mt.token);
+        if (res < 0)
+            return -1;
+        break;
+    }
+    case HEV_FSH_CMD_STREAM_DATA: {
+        struct msghdr mh = { 0 };
+        struct iovec iov[2];
+
+        if (size > HEV_FSH_MUX_FRAME_SIZE)
+            return -1;
+
+        if (!s || s->is_rfin) {
+            iov[0].iov_base = self->scratch;
+            iov[0].iov_len = size;
+            mh.msg_iovlen = 1;
+        } else {
+            size_t max = hev_circular_buffer_get_max_size (s->rbuf);
+            size_t use = hev_circular_buffer_get_use_size (s->rbuf);
+
+            if (size > (max - use))
+                return -1;
+
+            mh.msg_iovlen = hev_circular_buffer_writing (s->rbuf, iov);
+            if (iov[0].iov_len >= size) {
+                iov[0].iov_len = size;
+                mh.msg_iovlen = 1;
+            } else {
+                iov[1].iov_len = size - iov[0].iov_len;
+            }
+        }
+        mh.msg_iov = iov;
+
+        res = hev_fsh_mux_recv_iov (self, &mh, yielder, yielder_data);
+        if (res <= 0)
+            return -1;
+
+        if (iov[0].iov_base != self->scratch) {
+            hev_circular_buffer_write_finish (s->rbuf, size);
+            hev_task_wakeup (s->task);
+        }
+        break;
+    }
+    case HEV_FSH_CMD_STREAM_WINDOW:
+        if (s) {
+            if (size > (HEV_FSH_MUX_WINDOW_MAX - s->credit))
+                return -1;
+            s->credit += size;
+            hev_task_wakeup (s->task);
+        }
+        break;
+    case HEV_FSH_CMD_STREAM_CLOSE:
+        if (s) {
+            s->is_rfin = 1;
+            hev_task_wakeup (s->task);
+        }
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+hev_fsh_mux_serve_yielder (HevTaskYieldType type, void *data)
+{
+    HevFshMux *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+        return 0;
+    }
+
+    /* an idle link expires, busy streams have their own timeouts */
+    for (;;) {
+        unsigned int timeout = hev_fsh_mux_sleep (&self->stimer, self->timeout);
+
+        if (self->is_dead)
+            return -1;
+        if (timeout)
+            return 0;
+        if (!self->nr_streams)
+            return -1;
+    }
+}
+
+void
+hev_fsh_mux_serve (HevFshMux *self)
+{
+    LOG_D ("%p fsh mux serve", self);
+
+    while (!self->is_dead) {
+        HevFshMessage msg;
+        int res;
+
+        res = hev_task_io_socket_recv (self->fd, &msg, sizeof (msg),
+                                       MSG_WAITALL, hev_fsh_mux_serve_yielder,
+                                       self);
+        if (res <= 0)
+            break;
+
+        switch (msg.cmd) {
+        case HEV_FSH_CMD_STREAM_OPEN:
+        case HEV_FSH_CMD_STREAM_DATA:
+        case HEV_FSH_CMD_STREAM_WINDOW:
+        case HEV_FSH_CMD_STREAM_CLOSE:
+            res = hev_fsh_mux_dispatch (self, &msg, hev_fsh_mux_serve_yielder,
+                                        self);
+            break;
+        default:
+            res = -1;
+        }
+        if (res < 0)
+            break;
+    }
+}
+
+void
+hev_fsh_mux_stop (HevFshMux *self)
+{
+    unsigned int i;
+
+    LOG_D ("%p fsh mux stop", self);
+
+    self->is_dead = 1;
+    self->reader = NULL;
+    if (self->task)
+        hev_task_wakeup (self->task);
+    if (self->writer)
+        hev_task_wakeup (self->writer);
+
+    for (i = 0; i < self->nr_slots; i++) {
+        HevFshMuxStream *s;
+
+        for (s = self->slots[i]; s; s = s->next)
+            hev_task_wakeup (s->task);
+    }
+}
+
+void
+hev_fsh_mux_set_reader (HevFshMux *self, HevFshReader *reader)
+{
+    self->reader = reader;
+}
+
+static void
+hev_fsh_mux_task_entry (void *data)
+{
+    HevFshMux *self = data;
+
+    hev_task_add_fd (hev_task_self (), self->fd, POLLOUT);
+
+    /* the control channel is shared, only one writer waits for it */
+    while (!self->is_dead) {
+        hev_task_yield (HEV_TASK_WAITIO);
+        if (self->writer)
+            hev_task_wakeup (self->writer);
+    }
+
+    hev_task_del_fd (hev_task_self (), self->fd);
+    self->task = NULL;
+
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+HevFshMux *
+hev_fsh_mux_new (int fd, unsigned int timeout, HevFshMuxAccept accept,
+                 void *data)
+{
+    HevFshMux *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevFshMux));
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_mux_construct (self, fd, timeout, accept, data);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh mux new", self);
+
+    hev_object_ref (HEV_OBJECT (self));
+    hev_fsh_task_run (self->task, HEV_FSH_TASK_SERVICE, hev_fsh_mux_task_entry,
+                      self);
+
+    return self;
+}
+
+int
+hev_fsh_mux_construct (HevFshMux *self, int fd, unsigned int timeout,
+                       HevFshMuxAccept accept, void *data)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh mux construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_MUX_TYPE;
+
+    self->nr_slots = 16;
+    self->slots = hev_calloc (self->nr_slots, sizeof (HevFshMuxStream *));
+    if (!self->slots)
+        return -1;
+
+    self->scratch = hev_malloc (HEV_FSH_MUX_FRAME_SIZE);
+    if (!self->scratch)
+        goto free_slots;
+
+    self->task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->task)
+        goto free_scratch;
+
+    /* outlives the owner's fd while streams drain */
+    self->fd = hev_task_io_dup (fd);
+    if (self->fd < 0)
+        goto free_task;
+
+    self->timeout = timeout;
+    self->accept = accept;
+    self->accept_data = data;
+
+    return 0;
+
+free_task:
+    hev_task_unref (self->task);
+free_scratch:
+    hev_free (self->scratch);
+free_slots:
+    hev_free (self->slots);
+    return -1;
+}
+
+static void
+hev_fsh_mux_destruct (HevObject *base)
+{
+    HevFshMux *self = HEV_FSH_MUX (base);
+
+    LOG_D ("%p fsh mux destruct", self);
+
+    close (self->fd);
+    hev_free (self->scratch);
+    hev_free (self->slots);
+
+    HEV_OBJECT_TYPE->finalizer (base);
+    hev_free (self);
+}
+
+HevObjectClass *
+hev_fsh_mux_class (void)
+{
+    static HevFshMuxClass klass;
+    HevFshMuxClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevFshMux";
+        okptr->finalizer = hev_fsh_mux_destruct;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,93 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-mux.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh stream multiplexer
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_MUX_H__
+#define __HEV_FSH_MUX_H__
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-mutex.h>
+
+#include "hev-object.h"
+#include "hev-fsh-reader.h"
+#include "hev-fsh-protocol.h"
+#include "hev-fsh-timer-wheel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_MUX(p) ((HevFshMux *)p)
+#define HEV_FSH_MUX_CLASS(p) ((HevFshMuxClass *)p)
+#define HEV_FSH_MUX_TYPE (hev_fsh_mux_class ())
+
+typedef struct _HevFshMux HevFshMux;
+typedef struct _HevFshMuxClass HevFshMuxClass;
+typedef struct _HevFshMuxStream HevFshMuxStream;
+typedef int (*HevFshMuxAccept) (HevFshMux *self, HevFshToken token,
+                                void *data);
+
+struct _HevFshMux
+{
+    HevObject base;
+
+    int fd;
+    unsigned int id;
+    unsigned int timeout;
+    unsigned int nr_slots;
+    unsigned int nr_streams;
+    unsigned char is_dead;
+    unsigned char is_grow;
+
+    HevTask *task;
+    HevTask *writer;
+    HevTaskMutex wlock;
+    HevFshTimer wtimer;
+    HevFshTimer stimer;
+    HevFshMuxStream **slots;
+    HevFshReader *reader;
+    void *scratch;
+
+    HevFshMuxAccept accept;
+    void *accept_data;
+};
+
+struct _HevFshMuxClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_fsh_mux_class (void);
+
+int hev_fsh_mux_construct (HevFshMux *self, int fd, unsigned int timeout,
+                           HevFshMuxAccept accept, void *data);
+
+HevFshMux *hev_fsh_mux_new (int fd, unsigned int timeout,
+                            HevFshMuxAccept accept, void *data);
+
+void hev_fsh_mux_stop (HevFshMux *self);
+
+void hev_fsh_mux_set_reader (HevFshMux *self, HevFshReader *reader);
+
+int hev_fsh_mux_dispatch (HevFshMux *self, HevFshMessage *msg,
+                          HevTaskIOYielder yielder, void *yielder_data);
+
+void hev_fsh_mux_serve (HevFshMux *self);
+
+int hev_fsh_mux_splice (HevFshMux *self, int fd, HevFshToken token, void *head,
+                        size_t size);
+
+int hev_fsh_mux_write_message (HevFshMux *self, int ver, int cmd, void *data,
+                               size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_MUX_H__ */
@@ -12,6 +12,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 
 #include "hev-random.h"
 
@@ -140,3 +143,37 @@ hev_fsh_protocol_token_from_string (HevFshToken token, const char *str)
 
     return 0;
 }
+
+int
+hev_fsh_protocol_set_keep_alive (int fd, unsigned int timeout)
+{
+#ifdef __linux__
+    unsigned int user = timeout * 1000;
+    int idle = timeout / 2;
+    int intvl = timeout / 8;
+    int cnt = 4;
+    int one = 1;
+
+    if (idle < 1)
+        idle = 1;
+    if (intvl < 1)
+        intvl = 1;
+
+    if (setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof (one)) < 0)
+        return -1;
+    if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof (idle)) < 0)
+        return -1;
+    if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof (intvl)) <
+        0)
+        return -1;
+    if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof (cnt)) < 0)
+        return -1;
+    if (setsockopt (fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user, sizeof (user)) <
+        0)
+        return -1;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
@@ -15,6 +15,8 @@ typedef struct _HevFshMessage HevFshMessage;
 typedef struct _HevFshMessageToken HevFshMessageToken;
 typedef struct _HevFshMessageTermInfo HevFshMessageTermInfo;
 typedef struct _HevFshMessagePortInfo HevFshMessagePortInfo;
+typedef struct _HevFshMessageStream HevFshMessageStream;
+typedef struct _HevFshMessageRetry HevFshMessageRetry;
 typedef unsigned char HevFshToken[16];
 
 enum _HevFshCommand
@@ -24,8 +26,51 @@ enum _HevFshCommand
     HEV_FSH_CMD_KEEP_ALIVE,
     HEV_FSH_CMD_CONNECT,
     HEV_FSH_CMD_ACCEPT,
+    HEV_FSH_CMD_POOL,
+    HEV_FSH_CMD_PARK,
+    HEV_FSH_CMD_MUX,
+    HEV_FSH_CMD_STREAM_OPEN,
+    HEV_FSH_CMD_STREAM_DATA,
+    HEV_FSH_CMD_STREAM_WINDOW,
+    HEV_FSH_CMD_STREAM_CLOSE,
+    HEV_FSH_CMD_NODE,
+    HEV_FSH_CMD_NODE_TOKEN,
+    HEV_FSH_CMD_RETRY,
 };
 
+/*
+ * Data channel pool, offered by the server with TOKEN ver 2:
+ *   forwarder control: POOL + key
+ *   forwarder data: PARK + token + key, idle until CONNECT + token
+ *
+ * Stream multiplexing (v4), offered by the server with TOKEN ver 4:
+ *   forwarder control: MUX, then STREAM_* + stream [+ payload]
+ *   OPEN carries the token, DATA the bytes, WINDOW the returned credit
+ *   and CLOSE ends one direction of a stream.
+ *
+ * Tunnel multiplexing, asked by the connector at the start of a tunnel:
+ *   port: port info with type 0, sock: MUX, the forwarder answers MUX
+ *   and the same STREAM_* framing follows, each stream a whole tunnel.
+ *
+ * Server clustering, a link from every worker of a node to each peer:
+ *   link: NODE + node id, from a listed address only; the peer answers
+ *   NODE ver 2 + its node id + nonce, the link proves the shared key with
+ *   NODE ver 3 + SipHash-2-4 of nonce, link id and peer id under it
+ *   NODE_TOKEN ver 1 + token: a forwarder logged in to the node, ver 2:
+ *   it left; STREAM_* framing as above, each stream a connector relayed
+ *   to the node holding the forwarder, opened with its token. A relayed
+ *   CONNECT is ver 2 and never relayed again.
+ *
+ * Kernel liveness, offered by the server with TOKEN ver 5:
+ *   forwarder control: KEEP_ALIVE ver 3, then both ends leave dead peer
+ *   detection to TCP keepalive and user timeout, no more KEEP_ALIVE.
+ *
+ * Admission control, a LOGIN the server can not take in yet:
+ *   the server answers RETRY + delay in ms instead of TOKEN and closes,
+ *   the forwarder reconnects after that delay. A CONNECT to a forwarder
+ *   with a full queue is answered the same way.
+ */
+
 struct _HevFshMessage
 {
     unsigned char ver;
@@ -50,9 +95,22 @@ struct _HevFshMessagePortInfo
     unsigned char addr[16];
 } __attribute__ ((packed));
 
+struct _HevFshMessageStream
+{
+    unsigned int id;
+    unsigned int size;
+} __attribute__ ((packed));
+
+struct _HevFshMessageRetry
+{
+    unsigned int delay;
+} __attribute__ ((packed));
+
 void hev_fsh_protocol_token_generate (HevFshToken token);
 void hev_fsh_protocol_token_to_string (HevFshToken token, char *out);
 
 int hev_fsh_protocol_token_from_string (HevFshToken token, const char *str);
 
+int hev_fsh_protocol_set_keep_alive (int fd, unsigned int timeout);
+
 #endif /* __HEV_FSH_PROTOCOL_H__ */
@@ -0,0 +1,70 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-reader.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh message reader
+ ============================================================================
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+
+#include <hev-task-io-socket.h>
+
+#include "hev-fsh-reader.h"
+
+void
+hev_fsh_reader_init (HevFshReader *self, void *buf, size_t size)
+{
+    self->buf = buf;
+    self->size = size;
+    self->head = 0;
+    self->tail = 0;
+}
+
+ssize_t
+hev_fsh_reader_read (HevFshReader *self, int fd, void *data, size_t len,
+                     size_t ahead, HevTaskIOYielder yielder,
+                     void *yielder_data)
+{
+    unsigned char *p = data;
+    size_t n = 0;
+
+    while (n < len) {
+        size_t size = self->tail - self->head;
+        ssize_t res;
+
+        if (size) {
+            if (size > (len - n))
+                size = len - n;
+            memcpy (p + n, self->buf + self->head, size);
+            self->head += size;
+            n += size;
+            if (self->head == self->tail)
+                self->head = self->tail = 0;
+            continue;
+        }
+
+        /* larger than the buffer, straight in without read-ahead */
+        if ((len - n) >= self->size) {
+            res = hev_task_io_socket_recv (fd, p + n, len - n, MSG_WAITALL,
+                                           yielder, yielder_data);
+            if (res <= 0)
+                return res;
+            n += res;
+            continue;
+        }
+
+        size = len - n + ahead;
+        if (size > self->size)
+            size = self->size;
+        res = hev_task_io_socket_recv (fd, self->buf, size, 0, yielder,
+                                       yielder_data);
+        if (res <= 0)
+            return res;
+        self->tail = res;
+    }
+
+    return n;
+}
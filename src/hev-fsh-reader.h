@@ -0,0 +1,47 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-reader.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh message reader
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_READER_H__
+#define __HEV_FSH_READER_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <hev-task-io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevFshReader HevFshReader;
+
+/*
+ * Read-ahead over a socket, in a buffer of the owner. Every read says how
+ * far past it the stream is known to be messages; nothing beyond is ever
+ * taken, so the socket can be handed to a relay or a mux at any message.
+ */
+struct _HevFshReader
+{
+    unsigned char *buf;
+    unsigned short size;
+    unsigned short head;
+    unsigned short tail;
+};
+
+void hev_fsh_reader_init (HevFshReader *self, void *buf, size_t size);
+
+ssize_t hev_fsh_reader_read (HevFshReader *self, int fd, void *data,
+                             size_t len, size_t ahead,
+                             HevTaskIOYielder yielder, void *yielder_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_READER_H__ */
@@ -0,0 +1,313 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-resolver.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh resolver cache
+ ============================================================================
+ */
+
+#include <time.h>
+#include <netdb.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <hev-task.h>
+#include <hev-task-dns.h>
+#include <hev-task-call.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-task.h"
+
+#include "hev-fsh-resolver.h"
+
+#define HEV_FSH_RESOLVER_TTL (60000)
+#define HEV_FSH_RESOLVER_NEGATIVE_TTL (5000)
+
+typedef struct _HevTaskCallResolv HevTaskCallResolv;
+
+struct _HevTaskCallResolv
+{
+    HevTaskCall base;
+
+    HevFshResolver *resolver;
+    unsigned int nr_addrs;
+    HevFshResolverAddr addrs[HEV_FSH_RESOLVER_ADDRS];
+};
+
+static unsigned long long
+hev_fsh_resolver_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void
+resolv_entry (HevTaskCall *call)
+{
+    HevTaskCallResolv *resolv = (HevTaskCallResolv *)call;
+    HevFshResolver *self = resolv->resolver;
+    struct addrinfo *res = NULL;
+    struct addrinfo hints;
+    struct addrinfo *ai;
+    int s;
+
+    __builtin_bzero (&hints, sizeof (hints));
+    hints.ai_family = self->family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    s = hev_task_dns_getaddrinfo (self->name, self->port, &hints, &res);
+    if ((s != 0) || !res)
+        return;
+
+    for (ai = res; ai && (resolv->nr_addrs < HEV_FSH_RESOLVER_ADDRS);
+         ai = ai->ai_next) {
+        HevFshResolverAddr *addr = &resolv->addrs[resolv->nr_addrs];
+
+        if (ai->ai_addrlen > sizeof (addr->addr))
+            continue;
+
+        addr->len = ai->ai_addrlen;
+        memcpy (&addr->addr, ai->ai_addr, ai->ai_addrlen);
+        resolv->nr_addrs++;
+    }
+
+    freeaddrinfo (res);
+}
+
+static void
+hev_fsh_resolver_lookup (HevFshResolver *self)
+{
+    HevTaskCallResolv *resolv = NULL;
+    unsigned long long now;
+    HevTaskCall *call;
+    unsigned int n = 0;
+
+    LOG_D ("%p fsh resolver lookup %s", self, self->name);
+
+    call = hev_task_call_new (sizeof (HevTaskCallResolv), 16384);
+    if (call) {
+        resolv = (HevTaskCallResolv *)call;
+        resolv->resolver = self;
+        resolv->nr_addrs = 0;
+
+        hev_task_call_jump (call, resolv_entry);
+        n = resolv->nr_addrs;
+    }
+
+    now = hev_fsh_resolver_now ();
+    pthread_mutex_lock (&self->lock);
+
+    if (n) {
+        memcpy (self->addrs, resolv->addrs, sizeof (HevFshResolverAddr) * n);
+        self->nr_addrs = n;
+        self->is_negative = 0;
+        self->refresh = now + HEV_FSH_RESOLVER_TTL - HEV_FSH_RESOLVER_TTL / 5;
+    } else {
+        /* a stale answer beats none, either way ask again soon */
+        self->is_negative = !self->nr_addrs;
+        self->refresh = now + HEV_FSH_RESOLVER_NEGATIVE_TTL;
+    }
+    self->is_resolving = 0;
+
+    pthread_mutex_unlock (&self->lock);
+
+    if (call)
+        hev_task_call_destroy (call);
+
+    if (!n)
+        LOG_W ("%p fsh resolver lookup %s failed", self, self->name);
+}
+
+static void
+hev_fsh_resolver_task_entry (void *data)
+{
+    HevFshResolver *self = data;
+
+    hev_fsh_resolver_lookup (self);
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+static void
+hev_fsh_resolver_spawn (HevFshResolver *self)
+{
+    HevTask *task;
+
+    task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!task) {
+        pthread_mutex_lock (&self->lock);
+        self->is_resolving = 0;
+        pthread_mutex_unlock (&self->lock);
+        return;
+    }
+
+    hev_object_ref (HEV_OBJECT (self));
+    hev_fsh_task_run (task, HEV_FSH_TASK_SERVICE, hev_fsh_resolver_task_entry,
+                      self);
+}
+
+static unsigned int
+hev_fsh_resolver_interleave (HevFshResolver *self, HevFshResolverAddr *addrs,
+                             unsigned int max)
+{
+    unsigned char p[HEV_FSH_RESOLVER_ADDRS];
+    unsigned char o[HEV_FSH_RESOLVER_ADDRS];
+    unsigned int np = 0, no = 0, ip = 0, io = 0;
+    unsigned int i, n = 0;
+    int family;
+
+    family = self->preferred;
+    if (!family)
+        family = self->addrs[0].addr.ss_family;
+
+    for (i = 0; i < self->nr_addrs; i++) {
+        if (self->addrs[i].addr.ss_family == family)
+            p[np++] = i;
+        else
+            o[no++] = i;
+    }
+
+    while ((n < max) && ((ip < np) || (io < no))) {
+        if ((ip < np) && (!(n & 1) || (io >= no)))
+            i = p[ip++];
+        else
+            i = o[io++];
+
+        addrs[n++] = self->addrs[i];
+    }
+
+    return n;
+}
+
+int
+hev_fsh_resolver_get (HevFshResolver *self, HevFshResolverAddr *addrs,
+                      unsigned int max)
+{
+    unsigned long long now;
+    unsigned int n;
+    int spawn = 0;
+
+    pthread_mutex_lock (&self->lock);
+
+    while (!self->nr_addrs) {
+        now = hev_fsh_resolver_now ();
+
+        if (self->is_resolving) {
+            pthread_mutex_unlock (&self->lock);
+            hev_task_sleep (10);
+            pthread_mutex_lock (&self->lock);
+            continue;
+        }
+
+        if (self->is_negative && (now < self->refresh)) {
+            pthread_mutex_unlock (&self->lock);
+            return -1;
+        }
+
+        self->is_resolving = 1;
+        pthread_mutex_unlock (&self->lock);
+        hev_fsh_resolver_lookup (self);
+        pthread_mutex_lock (&self->lock);
+    }
+
+    now = hev_fsh_resolver_now ();
+    if ((now >= self->refresh) && !self->is_resolving) {
+        self->is_resolving = 1;
+        spawn = 1;
+    }
+
+    n = hev_fsh_resolver_interleave (self, addrs, max);
+
+    pthread_mutex_unlock (&self->lock);
+
+    if (spawn)
+        hev_fsh_resolver_spawn (self);
+
+    return n;
+}
+
+void
+hev_fsh_resolver_set_preferred (HevFshResolver *self, int family)
+{
+    pthread_mutex_lock (&self->lock);
+    self->preferred = family;
+    pthread_mutex_unlock (&self->lock);
+}
+
+HevFshResolver *
+hev_fsh_resolver_new (const char *name, const char *port, int family)
+{
+    HevFshResolver *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevFshResolver));
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_resolver_construct (self, name, port, family);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh resolver new", self);
+
+    return self;
+}
+
+int
+hev_fsh_resolver_construct (HevFshResolver *self, const char *name,
+                            const char *port, int family)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh resolver construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_RESOLVER_TYPE;
+
+    self->name = name;
+    self->port = port;
+    self->family = family;
+    pthread_mutex_init (&self->lock, NULL);
+
+    return 0;
+}
+
+static void
+hev_fsh_resolver_destruct (HevObject *base)
+{
+    HevFshResolver *self = HEV_FSH_RESOLVER (base);
+
+    LOG_D ("%p fsh resolver destruct", self);
+
+    pthread_mutex_destroy (&self->lock);
+
+    HEV_OBJECT_TYPE->finalizer (base);
+    hev_free (self);
+}
+
+HevObjectClass *
+hev_fsh_resolver_class (void)
+{
+    static HevFshResolverClass klass;
+    HevFshResolverClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevFshResolver";
+        okptr->finalizer = hev_fsh_resolver_destruct;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,85 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-resolver.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh resolver cache
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_RESOLVER_H__
+#define __HEV_FSH_RESOLVER_H__
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "hev-object.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_RESOLVER(p) ((HevFshResolver *)p)
+#define HEV_FSH_RESOLVER_CLASS(p) ((HevFshResolverClass *)p)
+#define HEV_FSH_RESOLVER_TYPE (hev_fsh_resolver_class ())
+
+#define HEV_FSH_RESOLVER_ADDRS (8)
+
+typedef struct _HevFshResolver HevFshResolver;
+typedef struct _HevFshResolverAddr HevFshResolverAddr;
+typedef struct _HevFshResolverClass HevFshResolverClass;
+
+struct _HevFshResolverAddr
+{
+    socklen_t len;
+    struct sockaddr_storage addr;
+};
+
+/*
+ * The addresses of one name, looked up once and handed out from memory:
+ * refreshed by a task of its own before they expire, kept when a refresh
+ * fails, and a failed first lookup is remembered for a short while.
+ * They are handed out with the families interleaved, the family that
+ * connected last first.
+ */
+struct _HevFshResolver
+{
+    HevObject base;
+
+    int family;
+    int preferred;
+    const char *name;
+    const char *port;
+
+    unsigned int nr_addrs;
+    unsigned int is_resolving : 1;
+    unsigned int is_negative : 1;
+    unsigned long long expire;
+    unsigned long long refresh;
+
+    pthread_mutex_t lock;
+    HevFshResolverAddr addrs[HEV_FSH_RESOLVER_ADDRS];
+};
+
+struct _HevFshResolverClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_fsh_resolver_class (void);
+
+int hev_fsh_resolver_construct (HevFshResolver *self, const char *name,
+                                const char *port, int family);
+
+HevFshResolver *hev_fsh_resolver_new (const char *name, const char *port,
+                                      int family);
+
+int hev_fsh_resolver_get (HevFshResolver *self, HevFshResolverAddr *addrs,
+                          unsigned int max);
+void hev_fsh_resolver_set_preferred (HevFshResolver *self, int family);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_RESOLVER_H__ */
@@ -0,0 +1,776 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-server-worker.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh server worker
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-pipe.h>
+#include <hev-task-io-socket.h>
+#include <hev-task-system.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-server.h"
+#include "hev-fsh-session.h"
+#include "hev-fsh-task.h"
+
+#include "hev-fsh-server-worker.h"
+
+#define HEV_FSH_SERVER_WORKER_TRANSFER_WAIT (5000)
+#define HEV_FSH_SERVER_WORKER_RETRY_MAX (60000)
+
+typedef struct _HevFshServerWorkerEvent HevFshServerWorkerEvent;
+
+enum
+{
+    EVENT_HANDOFF = 0,
+    EVENT_DRAIN,
+    EVENT_TRANSFER,
+    EVENT_ADOPT,
+    EVENT_STOP,
+};
+
+struct _HevFshServerWorkerEvent
+{
+    int type;
+    int fds[2];
+    union
+    {
+        struct
+        {
+            HevFshMessage msg;
+            HevFshMessageToken mt;
+            unsigned int peer;
+        };
+        HevFshHandoverSession hs;
+    };
+};
+
+static unsigned int
+hev_fsh_server_worker_token_hash (HevFshToken token)
+{
+    unsigned int hash;
+
+    hash = (unsigned int)token[12] << 24;
+    hash |= (unsigned int)token[13] << 16;
+    hash |= (unsigned int)token[14] << 8;
+    hash |= (unsigned int)token[15];
+
+    return hash;
+}
+
+HevFshServerWorker *
+hev_fsh_server_worker_route (HevFshServerWorker *self, HevFshToken token)
+{
+    HevFshServer *server = self->server;
+    unsigned int hash;
+
+    if (server->nr_workers == 1)
+        return self;
+
+    hash = hev_fsh_server_worker_token_hash (token);
+
+    return server->workers[hash % server->nr_workers];
+}
+
+void
+hev_fsh_server_worker_token_generate (HevFshServerWorker *self,
+                                      HevFshToken token)
+{
+    unsigned int n = self->server->nr_workers;
+    unsigned int hash;
+
+    hev_fsh_protocol_token_generate (token);
+    if (n == 1)
+        return;
+
+    /* pin the token to this worker, so its peers are routed to us */
+    hash = hev_fsh_server_worker_token_hash (token);
+    hash -= hash % n;
+    if (hash > (UINT_MAX - self->id))
+        hash -= n;
+    hash += self->id;
+
+    token[12] = hash >> 24;
+    token[13] = hash >> 16;
+    token[14] = hash >> 8;
+    token[15] = hash;
+}
+
+unsigned int
+hev_fsh_server_worker_admit (HevFshServerWorker *self)
+{
+    unsigned long long now, tat, burst, interval;
+    unsigned long long retry;
+    struct timespec ts;
+
+    if (!self->login_rate)
+        return 0;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+
+    /* a bucket of one second worth of logins, refilled at the rate */
+    burst = 1000000ULL;
+    interval = burst / self->login_rate;
+    tat = (self->login_tat > now) ? self->login_tat : now;
+    if ((tat - now) <= burst) {
+        self->login_tat = tat + interval;
+        return 0;
+    }
+
+    retry = tat - burst;
+    if (self->retry_tat > retry)
+        retry = self->retry_tat;
+    retry += interval;
+    if ((retry - now) > (HEV_FSH_SERVER_WORKER_RETRY_MAX * 1000ULL))
+        retry = tat - burst + interval;
+    self->retry_tat = retry;
+
+    return (retry - now + 999) / 1000;
+}
+
+int
+hev_fsh_server_worker_handoff (HevFshServerWorker *self, int fd,
+                               HevFshMessage *msg, HevFshMessageToken *mt,
+                               unsigned int peer)
+{
+    HevFshServerWorkerEvent e;
+    ssize_t res;
+
+    LOG_D ("%p fsh server worker handoff %d", self, fd);
+
+    e.type = EVENT_HANDOFF;
+    e.fds[0] = fd;
+    memcpy (&e.msg, msg, sizeof (e.msg));
+    memcpy (&e.mt, mt, sizeof (e.mt));
+    e.peer = peer;
+
+    /* atomic, the size of event is less than PIPE_BUF */
+    res = write (self->event_fds[1], &e, sizeof (e));
+    if (res != sizeof (e)) {
+        LOG_W ("%p fsh server worker handoff", self);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+hev_fsh_server_worker_drain (HevFshServerWorker *self)
+{
+    HevFshServerWorkerEvent e = { .type = EVENT_DRAIN };
+    ssize_t res;
+
+    /* async signal safe, acted on by the event task of the worker */
+    res = write (self->event_fds[1], &e, sizeof (e));
+    if (res != sizeof (e))
+        return -1;
+
+    return 0;
+}
+
+int
+hev_fsh_server_worker_stop (HevFshServerWorker *self)
+{
+    HevFshServerWorkerEvent e = { .type = EVENT_STOP };
+    ssize_t res;
+
+    res = write (self->event_fds[1], &e, sizeof (e));
+    if (res != sizeof (e))
+        return -1;
+
+    return 0;
+}
+
+int
+hev_fsh_server_worker_transfer (HevFshServerWorker *self, int fd)
+{
+    HevFshServerWorkerEvent e = { .type = EVENT_TRANSFER, .fds = { fd } };
+    ssize_t res;
+
+    res = write (self->event_fds[1], &e, sizeof (e));
+    if (res != sizeof (e))
+        return -1;
+
+    return 0;
+}
+
+int
+hev_fsh_server_worker_adopt (HevFshServerWorker *self,
+                             HevFshHandoverSession *hs, int *fds)
+{
+    HevFshServerWorkerEvent e = { .type = EVENT_ADOPT };
+    ssize_t res;
+
+    e.fds[0] = fds[0];
+    e.fds[1] = fds[1];
+    memcpy (&e.hs, hs, sizeof (e.hs));
+
+    res = write (self->event_fds[1], &e, sizeof (e));
+    if (res != sizeof (e))
+        return -1;
+
+    return 0;
+}
+
+static int
+hev_fsh_server_worker_yielder (HevTaskYieldType type, void *data)
+{
+    HevFshServerWorker *self = data;
+
+    hev_task_yield (type);
+
+    return self->is_draining;
+}
+
+static int
+hev_fsh_server_worker_accept (HevFshServerWorker *self, struct sockaddr *addr,
+                              socklen_t *len)
+{
+    HevFshUringAccept *acc = &self->acc;
+    int fd;
+
+    if (!self->uring)
+        return hev_task_io_socket_accept (self->fd, addr, len,
+                                          hev_fsh_server_worker_yielder, self);
+
+    if (self->is_draining && (acc->head == acc->tail) && !acc->base.is_busy)
+        return -1;
+
+    fd = hev_fsh_uring_accept (self->uring, acc, self->fd);
+    if (fd < 0) {
+        if ((errno == ENOSYS) || (errno == EINVAL)) {
+            LOG_I ("%p fsh server worker uring accept unsupported", self);
+            self->uring = NULL;
+        }
+        return -1;
+    }
+
+    if (getpeername (fd, addr, len) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void
+hev_fsh_server_worker_task_entry (void *data)
+{
+    HevFshServerWorker *self = data;
+    unsigned int timeout;
+
+    timeout = hev_fsh_config_get_timeout (self->config);
+    hev_task_add_fd (hev_task_self (), self->fd, POLLIN);
+    self->uring = hev_fsh_uring_get ();
+
+    for (;;) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof (addr);
+        HevFshSession *s;
+        int fd;
+
+        fd = hev_fsh_server_worker_accept (self, (struct sockaddr *)&addr,
+                                           &len);
+        if (fd < 0) {
+            if (self->is_draining)
+                break;
+            LOG_W ("%p fsh server worker accept", self);
+            continue;
+        }
+
+        if (hev_fsh_tarpit_check (self->tarpit, (struct sockaddr *)&addr) < 0) {
+            close (fd);
+            continue;
+        }
+
+        s = hev_fsh_session_new (fd, timeout, self);
+        if (!s) {
+            close (fd);
+            continue;
+        }
+
+        hev_fsh_io_run (HEV_FSH_IO (s));
+    }
+
+    /* a successor holds the listener too, it keeps accepting there */
+    LOG_I ("%p fsh server worker stop accepting", self);
+    hev_task_del_fd (hev_task_self (), self->fd);
+    close (self->fd);
+    self->fd = -1;
+}
+
+static unsigned int
+hev_fsh_server_worker_nr_sessions (HevFshServer *server)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < server->nr_workers; i++) {
+        HevFshServerWorker *w = server->workers[i];
+        n += __atomic_load_n (&w->nr_sessions, __ATOMIC_RELAXED);
+    }
+
+    return n;
+}
+
+static void
+hev_fsh_server_worker_transfer_sessions (HevFshServerWorker *self)
+{
+    HevFshSessionManager *manager = self->manager;
+    unsigned int i, n = 0, iter = 0;
+    HevFshSession *s;
+    int fd;
+
+    while ((s = hev_fsh_session_manager_next (manager, &iter))) {
+        HevFshHandoverSession hs;
+
+        fd = hev_fsh_session_transfer (s, &hs);
+        if (fd < 0) {
+            iter++;
+            continue;
+        }
+
+        if (hev_fsh_handover_put_session (self->transfer_fd, &hs, &fd) == 0)
+            n++;
+        close (fd);
+    }
+
+    for (s = self->splices; s; s = s->next)
+        hev_task_wakeup (HEV_FSH_IO (s)->task);
+
+    for (i = 0; self->splices && (i < HEV_FSH_SERVER_WORKER_TRANSFER_WAIT);
+         i += 100)
+        hev_task_sleep (100);
+
+    LOG_I ("%p fsh server worker transferred %u sessions", self, n);
+
+    fd = self->transfer_fd;
+    self->transfer_fd = -1;
+    close (fd);
+}
+
+static void
+hev_fsh_server_worker_drain_task_entry (void *data)
+{
+    HevFshServerWorker *self = data;
+    HevFshSessionManager *manager = self->manager;
+    unsigned int timeout, spread, interval = 0;
+    unsigned int iter;
+    struct timespec ts;
+    HevFshSession *s;
+    time_t deadline;
+
+    if (self->transfer_fd >= 0)
+        hev_fsh_server_worker_transfer_sessions (self);
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    timeout = hev_fsh_config_get_drain_timeout (self->config);
+    deadline = ts.tv_sec + timeout;
+
+    /* idle forwarders are closed over the first half, not all at once */
+    spread = timeout * 500;
+    if (manager->size)
+        interval = spread / manager->size;
+
+    for (;;) {
+        unsigned int skips = 0;
+
+        iter = 0;
+        while ((s = hev_fsh_session_manager_next (manager, &iter))) {
+            /* the slot is refilled by deletion shifting, looked at again */
+            if (!hev_fsh_session_drain (s)) {
+                skips += hev_fsh_session_is_forwarder (s);
+                iter++;
+                continue;
+            }
+
+            if (interval)
+                hev_task_sleep (interval);
+            else
+                hev_task_yield (HEV_TASK_YIELD);
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        if (!skips || (ts.tv_sec >= deadline))
+            break;
+
+        hev_task_sleep (100);
+    }
+
+    if (self->id)
+        return;
+
+    for (;;) {
+        unsigned int n = hev_fsh_server_worker_nr_sessions (self->server);
+
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        if (!n || (ts.tv_sec >= deadline)) {
+            LOG_I ("%p fsh server drained, %u sessions left", self, n);
+            break;
+        }
+
+        hev_task_sleep (100);
+    }
+
+    exit (0);
+}
+
+static void
+hev_fsh_server_worker_do_drain (HevFshServerWorker *self)
+{
+    if (self->is_draining)
+        return;
+
+    LOG_I ("%p fsh server worker drain", self);
+
+    self->is_draining = 1;
+    if (self->uring)
+        hev_fsh_uring_cancel (self->uring, &self->acc.base);
+    hev_task_wakeup (self->task);
+    if (self->server->cluster)
+        hev_fsh_cluster_drain (self->server->cluster, self);
+
+    self->drain_task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->drain_task) {
+        if (!self->id)
+            exit (0);
+        return;
+    }
+
+    hev_task_ref (self->drain_task);
+    hev_fsh_task_run (self->drain_task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_server_worker_drain_task_entry, self);
+}
+
+static void
+hev_fsh_server_worker_event_task_entry (void *data)
+{
+    HevFshServerWorker *self = data;
+    int fd = self->event_fds[0];
+    unsigned int timeout;
+
+    timeout = hev_fsh_config_get_timeout (self->config);
+    hev_task_add_fd (hev_task_self (), fd, POLLIN);
+
+    for (;;) {
+        HevFshServerWorkerEvent e;
+        HevFshSession *s;
+        ssize_t res;
+
+        res = hev_task_io_read (fd, &e, sizeof (e), NULL, NULL);
+        if (res != sizeof (e)) {
+            LOG_E ("%p fsh server worker event", self);
+            break;
+        }
+
+        switch (e.type) {
+        case EVENT_TRANSFER:
+            if (self->is_draining)
+                close (e.fds[0]);
+            else
+                self->transfer_fd = e.fds[0];
+            /* fall through */
+        case EVENT_DRAIN:
+            hev_fsh_server_worker_do_drain (self);
+            continue;
+        case EVENT_ADOPT:
+            s = hev_fsh_session_adopt (self, &e.hs, e.fds, timeout);
+            if (s)
+                hev_fsh_io_run (HEV_FSH_IO (s));
+            continue;
+        case EVENT_STOP:
+            LOG_I ("%p fsh server stopped", self);
+            exit (0);
+        }
+
+        s = hev_fsh_session_new (e.fds[0], timeout, self);
+        if (!s) {
+            close (e.fds[0]);
+            continue;
+        }
+
+        hev_fsh_session_set_message (s, &e.msg, &e.mt, e.peer);
+        hev_fsh_io_run (HEV_FSH_IO (s));
+    }
+}
+
+int
+hev_fsh_server_worker_run (HevFshServerWorker *self)
+{
+    LOG_D ("%p fsh server worker run", self);
+
+    self->task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->task)
+        return -1;
+
+    self->event_task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->event_task) {
+        hev_task_unref (self->task);
+        self->task = NULL;
+        return -1;
+    }
+
+    if ((hev_fsh_tarpit_run (self->tarpit) < 0) ||
+        (hev_fsh_idler_run (self->idler) < 0)) {
+        hev_task_unref (self->event_task);
+        hev_task_unref (self->task);
+        self->event_task = NULL;
+        self->task = NULL;
+        return -1;
+    }
+
+    hev_task_ref (self->task);
+    hev_fsh_task_run (self->task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_server_worker_task_entry, self);
+
+    hev_task_ref (self->event_task);
+    hev_fsh_task_run (self->event_task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_server_worker_event_task_entry, self);
+
+    if (self->server->cluster &&
+        (hev_fsh_cluster_run (self->server->cluster, self) < 0))
+        LOG_E ("%p fsh server worker cluster", self);
+
+    return 0;
+}
+
+static void *
+hev_fsh_server_worker_thread_entry (void *data)
+{
+    HevFshServerWorker *self = data;
+    sigset_t set;
+
+    /* signals are handled by the main thread */
+    sigemptyset (&set);
+    sigaddset (&set, SIGINT);
+    sigaddset (&set, SIGTERM);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+    if (hev_task_system_init () < 0) {
+        LOG_E ("%p fsh server worker task system", self);
+        return NULL;
+    }
+
+    if (hev_fsh_server_worker_run (self) == 0)
+        hev_task_system_run ();
+
+    hev_task_system_fini ();
+
+    return NULL;
+}
+
+int
+hev_fsh_server_worker_spawn (HevFshServerWorker *self)
+{
+    int res;
+
+    LOG_D ("%p fsh server worker spawn", self);
+
+    res = pthread_create (&self->thread, NULL,
+                          hev_fsh_server_worker_thread_entry, self);
+    if (res != 0) {
+        LOG_E ("%p fsh server worker thread", self);
+        return -1;
+    }
+
+    pthread_detach (self->thread);
+
+    return 0;
+}
+
+static int
+hev_fsh_server_worker_socket (HevFshServerWorker *self)
+{
+    HevFshResolverAddr server;
+    struct sockaddr *addr;
+    socklen_t addr_len;
+    int reuse = 1;
+    int fd;
+
+    if (hev_fsh_config_get_server_addrs (self->config, &server, 1) <= 0) {
+        LOG_E ("%p fsh server worker socket addr", self);
+        return -1;
+    }
+
+    addr = (struct sockaddr *)&server.addr;
+    addr_len = server.len;
+
+    fd = hev_task_io_socket_socket (addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        LOG_E ("%p fsh server worker socket socket", self);
+        return -1;
+    }
+
+    if (setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (int)) < 0) {
+        LOG_E ("%p fsh server worker socket reuse", self);
+        close (fd);
+        return -1;
+    }
+
+    /* a listener per worker, a successor binds next to ours */
+    if ((self->server->nr_workers > 1) ||
+        hev_fsh_config_get_handover_path (self->config)) {
+        if (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof (int)) <
+            0) {
+            LOG_E ("%p fsh server worker socket reuse port", self);
+            close (fd);
+            return -1;
+        }
+    }
+
+    if (bind (fd, addr, addr_len) < 0) {
+        LOG_E ("%p fsh server worker socket bind", self);
+        close (fd);
+        return -1;
+    }
+
+    if (listen (fd, 10) < 0) {
+        LOG_E ("%p fsh server worker socket listen", self);
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+HevFshServerWorker *
+hev_fsh_server_worker_new (HevFshServer *server, int id, int fd)
+{
+    HevFshServerWorker *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevFshServerWorker));
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_server_worker_construct (self, server, id, fd);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh server worker new", self);
+
+    return self;
+}
+
+int
+hev_fsh_server_worker_construct (HevFshServerWorker *self,
+                                 HevFshServer *server, int id, int fd)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh server worker construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_SERVER_WORKER_TYPE;
+
+    self->id = id;
+    self->server = server;
+    self->config = server->config;
+    self->transfer_fd = -1;
+
+    self->login_rate = hev_fsh_config_get_login_rate (self->config);
+    if (self->login_rate) {
+        self->login_rate /= server->nr_workers;
+        if (!self->login_rate)
+            self->login_rate = 1;
+    }
+
+    self->fd = fd;
+    if (self->fd < 0)
+        self->fd = hev_fsh_server_worker_socket (self);
+    if (self->fd < 0)
+        return -1;
+
+    res = hev_task_io_pipe_pipe (self->event_fds);
+    if (res < 0) {
+        LOG_E ("%p fsh server worker pipe", self);
+        close (self->fd);
+        return -1;
+    }
+
+    self->manager = hev_fsh_session_manager_new ();
+    if (!self->manager)
+        goto close;
+
+    self->tarpit = hev_fsh_tarpit_new ();
+    if (!self->tarpit) {
+        hev_object_unref (HEV_OBJECT (self->manager));
+        goto close;
+    }
+
+    self->idler = hev_fsh_idler_new ();
+    if (!self->idler) {
+        hev_object_unref (HEV_OBJECT (self->tarpit));
+        hev_object_unref (HEV_OBJECT (self->manager));
+        goto close;
+    }
+
+    return 0;
+
+close:
+    close (self->event_fds[0]);
+    close (self->event_fds[1]);
+    close (self->fd);
+    return -1;
+}
+
+static void
+hev_fsh_server_worker_destruct (HevObject *base)
+{
+    HevFshServerWorker *self = HEV_FSH_SERVER_WORKER (base);
+
+    LOG_D ("%p fsh server worker destruct", self);
+
+    hev_object_unref (HEV_OBJECT (self->idler));
+    hev_object_unref (HEV_OBJECT (self->tarpit));
+    hev_object_unref (HEV_OBJECT (self->manager));
+    if (self->drain_task)
+        hev_task_unref (self->drain_task);
+    if (self->event_task)
+        hev_task_unref (self->event_task);
+    if (self->task)
+        hev_task_unref (self->task);
+    close (self->event_fds[0]);
+    close (self->event_fds[1]);
+    if (self->fd >= 0)
+        close (self->fd);
+
+    HEV_OBJECT_TYPE->finalizer (base);
+    hev_free (self);
+}
+
+HevObjectClass *
+hev_fsh_server_worker_class (void)
+{
+    static HevFshServerWorkerClass klass;
+    HevFshServerWorkerClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevFshServerWorker";
+        okptr->finalizer = hev_fsh_server_worker_destruct;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,104 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-server-worker.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh server worker
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_SERVER_WORKER_H__
+#define __HEV_FSH_SERVER_WORKER_H__
+
+#include <pthread.h>
+
+#include <hev-task.h>
+
+#include "hev-object.h"
+#include "hev-fsh-config.h"
+#include "hev-fsh-protocol.h"
+#include "hev-fsh-idler.h"
+#include "hev-fsh-tarpit.h"
+#include "hev-fsh-uring.h"
+#include "hev-fsh-handover.h"
+#include "hev-fsh-session-manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_SERVER_WORKER(p) ((HevFshServerWorker *)p)
+#define HEV_FSH_SERVER_WORKER_CLASS(p) ((HevFshServerWorkerClass *)p)
+#define HEV_FSH_SERVER_WORKER_TYPE (hev_fsh_server_worker_class ())
+
+typedef struct _HevFshServer HevFshServer;
+typedef struct _HevFshServerWorker HevFshServerWorker;
+typedef struct _HevFshServerWorkerClass HevFshServerWorkerClass;
+
+struct _HevFshServerWorker
+{
+    HevObject base;
+
+    int id;
+    int fd;
+    int event_fds[2];
+    int transfer_fd;
+    unsigned int nr_sessions;
+    unsigned int login_rate;
+    unsigned char is_draining;
+    unsigned long long login_tat;
+    unsigned long long retry_tat;
+    pthread_t thread;
+
+    HevTask *task;
+    HevTask *event_task;
+    HevTask *drain_task;
+    HevFshServer *server;
+    HevFshConfig *config;
+    HevFshIdler *idler;
+    HevFshTarpit *tarpit;
+    HevFshSessionManager *manager;
+    HevFshSession *splices;
+    HevFshUring *uring;
+    HevFshUringAccept acc;
+};
+
+struct _HevFshServerWorkerClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_fsh_server_worker_class (void);
+
+int hev_fsh_server_worker_construct (HevFshServerWorker *self,
+                                     HevFshServer *server, int id, int fd);
+
+HevFshServerWorker *hev_fsh_server_worker_new (HevFshServer *server, int id,
+                                               int fd);
+
+int hev_fsh_server_worker_run (HevFshServerWorker *self);
+int hev_fsh_server_worker_spawn (HevFshServerWorker *self);
+
+HevFshServerWorker *hev_fsh_server_worker_route (HevFshServerWorker *self,
+                                                 HevFshToken token);
+
+void hev_fsh_server_worker_token_generate (HevFshServerWorker *self,
+                                           HevFshToken token);
+
+unsigned int hev_fsh_server_worker_admit (HevFshServerWorker *self);
+
+int hev_fsh_server_worker_handoff (HevFshServerWorker *self, int fd,
+                                   HevFshMessage *msg, HevFshMessageToken *mt,
+                                   unsigned int peer);
+
+int hev_fsh_server_worker_drain (HevFshServerWorker *self);
+int hev_fsh_server_worker_stop (HevFshServerWorker *self);
+int hev_fsh_server_worker_transfer (HevFshServerWorker *self, int fd);
+int hev_fsh_server_worker_adopt (HevFshServerWorker *self,
+                                 HevFshHandoverSession *hs, int *fds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_SERVER_WORKER_H__ */
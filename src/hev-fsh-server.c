@@ -13,44 +13,16 @@
 
 #include <hev-task.h>
 #include <hev-task-io.h>
-#include <hev-task-io-pipe.h>
 #include <hev-task-io-socket.h>
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
+#include "hev-fsh-task.h"
 #include "hev-fsh-session.h"
+#include "hev-fsh-handover.h"
 
 #include "hev-fsh-server.h"
 
-static void
-hev_fsh_server_task_entry (void *data)
-{
-    HevFshServer *self = HEV_FSH_SERVER (data);
-    unsigned int timeout;
-
-    timeout = hev_fsh_config_get_timeout (self->config);
-    hev_task_add_fd (hev_task_self (), self->fd, POLLIN);
-
-    for (;;) {
-        HevFshSession *s;
-        int fd;
-
-        fd = hev_task_io_socket_accept (self->fd, NULL, NULL, NULL, NULL);
-        if (fd < 0) {
-            LOG_W ("%p fsh server accept", self);
-            continue;
-        }
-
-        s = hev_fsh_session_new (fd, timeout, self->manager);
-        if (!s) {
-            close (fd);
-            continue;
-        }
-
-        hev_fsh_io_run (HEV_FSH_IO (s));
-    }
-}
-
 HevFshBase *
 hev_fsh_server_new (HevFshConfig *config)
 {
@@ -72,69 +44,182 @@ hev_fsh_server_new (HevFshConfig *config)
     return HEV_FSH_BASE (self);
 }
 
-void
-hev_fsh_server_start (HevFshBase *base)
+static void
+hev_fsh_server_drain (HevFshServer *self)
 {
-    HevFshServer *self = HEV_FSH_SERVER (base);
+    unsigned int i;
 
-    LOG_D ("%p fsh server start", base);
+    /* async signal safe, a second stop does not wait for the tunnels */
+    if (self->is_draining) {
+        hev_fsh_server_worker_stop (self->workers[0]);
+        return;
+    }
+    self->is_draining = 1;
 
-    hev_task_ref (self->task);
-    hev_task_run (self->task, hev_fsh_server_task_entry, self);
+    for (i = 0; i < self->nr_workers; i++)
+        hev_fsh_server_worker_drain (self->workers[i]);
 }
 
-void
-hev_fsh_server_stop (HevFshBase *base)
+static void
+hev_fsh_server_transfer (HevFshServer *self, int fd)
 {
-    LOG_D ("%p fsh clinet stop", base);
+    unsigned int i;
+
+    /* async signal safe, a stop from now on does not wait any longer */
+    self->is_draining = 1;
+
+    for (i = 0; i < self->nr_workers; i++) {
+        HevFshServerWorker *worker = self->workers[i];
+        int wfd = dup (fd);
+
+        if ((wfd < 0) || (hev_fsh_server_worker_transfer (worker, wfd) < 0)) {
+            if (wfd >= 0)
+                close (wfd);
+            hev_fsh_server_worker_drain (worker);
+        }
+    }
 
-    exit (0);
+    close (fd);
 }
 
-static int
-hev_fsh_server_socket (HevFshServer *self, HevFshConfig *config)
+static void
+hev_fsh_server_handover_task_entry (void *data)
 {
-    struct sockaddr *addr;
-    socklen_t addr_len;
-    int reuse = 1;
-    int fd;
-
-    addr = hev_fsh_config_get_server_sockaddr (config, &addr_len);
-    if (!addr) {
-        LOG_E ("%p fsh server socket addr", self);
-        return -1;
-    }
+    HevFshServer *self = data;
+    int fds[HEV_FSH_HANDOVER_MAX_FDS];
+    unsigned int i;
 
-    fd = hev_task_io_socket_socket (addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
-    if (fd < 0) {
-        LOG_E ("%p fsh server socket socket", self);
-        return -1;
-    }
+    for (i = 0; i < self->nr_workers; i++)
+        fds[i] = self->workers[i]->fd;
+
+    hev_task_add_fd (hev_task_self (), self->handover_fd, POLLIN);
+
+    for (;;) {
+        int fd, res;
+
+        fd = hev_task_io_socket_accept (self->handover_fd, NULL, NULL, NULL,
+                                        NULL);
+        if (fd < 0)
+            continue;
+
+        hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+        res = hev_fsh_handover_send (fd, fds, self->nr_workers, NULL, NULL);
+        hev_task_del_fd (hev_task_self (), fd);
+
+        if (res == 0) {
+            LOG_I ("%p fsh server handed over", self);
+            hev_fsh_server_transfer (self, fd);
+            break;
+        }
 
-    if (setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (int)) < 0) {
-        LOG_E ("%p fsh server socket reuse", self);
         close (fd);
-        return -1;
+        LOG_W ("%p fsh server handover", self);
     }
 
-    if (bind (fd, addr, addr_len) < 0) {
-        LOG_E ("%p fsh server socket bind", self);
-        close (fd);
-        return -1;
+    hev_task_del_fd (hev_task_self (), self->handover_fd);
+    close (self->handover_fd);
+    self->handover_fd = -1;
+}
+
+static void
+hev_fsh_server_adopt_task_entry (void *data)
+{
+    HevFshServer *self = data;
+    unsigned int n = 0;
+
+    hev_task_add_fd (hev_task_self (), self->adopt_fd, POLLIN);
+
+    for (;;) {
+        HevFshServerWorker *worker;
+        HevFshHandoverSession hs;
+        int fds[2] = { -1, -1 };
+
+        if (hev_fsh_handover_get_session (self->adopt_fd, &hs, fds, NULL,
+                                          NULL) <= 0)
+            break;
+
+        worker = hev_fsh_server_worker_route (self->workers[0], hs.token);
+        if (hev_fsh_server_worker_adopt (worker, &hs, fds) < 0) {
+            close (fds[0]);
+            if (fds[1] >= 0)
+                close (fds[1]);
+            continue;
+        }
+
+        n++;
     }
 
-    if (listen (fd, 10) < 0) {
-        LOG_E ("%p fsh server socket listen", self);
-        close (fd);
-        return -1;
+    LOG_I ("%p fsh server adopted %u sessions", self, n);
+
+    hev_task_del_fd (hev_task_self (), self->adopt_fd);
+    close (self->adopt_fd);
+    self->adopt_fd = -1;
+}
+
+static void
+hev_fsh_server_adopt (HevFshServer *self)
+{
+    self->adopt_task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->adopt_task) {
+        LOG_E ("%p fsh server adopt task", self);
+        return;
     }
 
-    return fd;
+    hev_task_ref (self->adopt_task);
+    hev_fsh_task_run (self->adopt_task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_server_adopt_task_entry, self);
+}
+
+void
+hev_fsh_server_start (HevFshBase *base)
+{
+    HevFshServer *self = HEV_FSH_SERVER (base);
+    unsigned int i;
+
+    LOG_D ("%p fsh server start", base);
+
+    /* classes are initialized lazily, do it before sharing with threads */
+    hev_fsh_session_class ();
+
+    for (i = 1; i < self->nr_workers; i++)
+        hev_fsh_server_worker_spawn (self->workers[i]);
+
+    hev_fsh_server_worker_run (self->workers[0]);
+
+    if (self->adopt_fd >= 0)
+        hev_fsh_server_adopt (self);
+
+    if (self->handover_fd < 0)
+        return;
+
+    self->handover_task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->handover_task) {
+        LOG_E ("%p fsh server handover task", self);
+        return;
+    }
+
+    hev_task_ref (self->handover_task);
+    hev_fsh_task_run (self->handover_task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_server_handover_task_entry, self);
+}
+
+void
+hev_fsh_server_stop (HevFshBase *base)
+{
+    HevFshServer *self = HEV_FSH_SERVER (base);
+
+    LOG_D ("%p fsh server stop", base);
+
+    hev_fsh_server_drain (self);
 }
 
 int
 hev_fsh_server_construct (HevFshServer *self, HevFshConfig *config)
 {
+    int fds[HEV_FSH_HANDOVER_MAX_FDS];
+    unsigned int i, j, nr_fds = 0;
+    const char *path;
+    int hfd = -1;
     int res;
 
     res = hev_fsh_base_construct (&self->base);
@@ -145,38 +230,95 @@ hev_fsh_server_construct (HevFshServer *self, HevFshConfig *config)
 
     HEV_OBJECT (self)->klass = HEV_FSH_SERVER_TYPE;
 
-    self->fd = hev_fsh_server_socket (self, config);
-    if (self->fd < 0)
-        return -1;
+    self->config = config;
+    self->handover_fd = -1;
+    self->adopt_fd = -1;
+    self->nr_workers = hev_fsh_config_get_threads (config);
+
+    path = hev_fsh_config_get_handover_path (config);
+    if (path)
+        hfd = hev_fsh_handover_fetch (path, fds, &nr_fds);
+
+    /* closing a listener would reset its queue, every one gets a worker */
+    if (nr_fds > self->nr_workers)
+        self->nr_workers = nr_fds;
+    if (self->nr_workers > HEV_FSH_HANDOVER_MAX_FDS)
+        self->nr_workers = HEV_FSH_HANDOVER_MAX_FDS;
+
+    self->workers = hev_malloc0 (sizeof (void *) * self->nr_workers);
+    if (!self->workers) {
+        i = 0;
+        goto close;
+    }
+
+    for (i = 0; i < self->nr_workers; i++) {
+        int fd = (i < nr_fds) ? fds[i] : -1;
 
-    self->task = hev_task_new (HEV_FSH_CONFIG_TASK_STACK_SIZE);
-    if (!self->task) {
-        close (self->fd);
-        return -1;
+        self->workers[i] = hev_fsh_server_worker_new (self, i, fd);
+        if (!self->workers[i])
+            goto error;
     }
 
-    self->manager = hev_fsh_session_manager_new ();
-    if (!self->manager) {
-        hev_task_unref (self->task);
-        close (self->fd);
-        return -1;
+    if ((hfd >= 0) && (hev_fsh_handover_ack (hfd) == 0))
+        self->adopt_fd = hfd;
+    else if (hfd >= 0)
+        close (hfd);
+
+    if (path)
+        self->handover_fd = hev_fsh_handover_listen (path);
+
+    path = hev_fsh_config_get_snapshot_path (config);
+    if (path) {
+        unsigned int timeout = hev_fsh_config_get_timeout (config);
+
+        self->snapshot = hev_fsh_snapshot_new (path, timeout);
+        if (!self->snapshot)
+            LOG_E ("%p fsh server snapshot", self);
     }
 
-    self->config = config;
+    if (hev_fsh_config_get_nr_peers (config)) {
+        self->cluster = hev_fsh_cluster_new (config, self->nr_workers);
+        if (!self->cluster)
+            LOG_E ("%p fsh server cluster", self);
+    }
 
     return 0;
+
+error:
+    for (j = i++; j-- > 0;)
+        hev_object_unref (HEV_OBJECT (self->workers[j]));
+    hev_free (self->workers);
+close:
+    for (; i < nr_fds; i++)
+        close (fds[i]);
+    if (hfd >= 0)
+        close (hfd);
+    return -1;
 }
 
 static void
 hev_fsh_server_destruct (HevObject *base)
 {
     HevFshServer *self = HEV_FSH_SERVER (base);
+    unsigned int i;
 
     LOG_D ("%p fsh server destruct", self);
 
-    hev_object_unref (HEV_OBJECT (self->manager));
-    hev_task_unref (self->task);
-    close (self->fd);
+    if (self->adopt_task)
+        hev_task_unref (self->adopt_task);
+    if (self->handover_task)
+        hev_task_unref (self->handover_task);
+    if (self->adopt_fd >= 0)
+        close (self->adopt_fd);
+    if (self->handover_fd >= 0)
+        close (self->handover_fd);
+    for (i = 0; i < self->nr_workers; i++)
+        hev_object_unref (HEV_OBJECT (self->workers[i]));
+    hev_free (self->workers);
+    if (self->cluster)
+        hev_object_unref (HEV_OBJECT (self->cluster));
+    if (self->snapshot)
+        hev_object_unref (HEV_OBJECT (self->snapshot));
 
     HEV_FSH_BASE_TYPE->finalizer (base);
 }
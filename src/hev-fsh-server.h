@@ -10,11 +10,11 @@
 #ifndef __HEV_FSH_SERVER_H__
 #define __HEV_FSH_SERVER_H__
 
-#include <hev-task.h>
-
 #include "hev-fsh-base.h"
 #include "hev-fsh-config.h"
-#include "hev-fsh-session-manager.h"
+#include "hev-fsh-cluster.h"
+#include "hev-fsh-snapshot.h"
+#include "hev-fsh-server-worker.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,12 +31,17 @@ struct _HevFshServer
 {
     HevFshBase base;
 
-    int fd;
-    int quit;
+    unsigned int nr_workers;
+    int handover_fd;
+    int adopt_fd;
+    volatile int is_draining;
 
-    HevTask *task;
+    HevTask *handover_task;
+    HevTask *adopt_task;
     HevFshConfig *config;
-    HevFshSessionManager *manager;
+    HevFshCluster *cluster;
+    HevFshSnapshot *snapshot;
+    HevFshServerWorker **workers;
 };
 
 struct _HevFshServerClass
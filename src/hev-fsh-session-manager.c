@@ -7,70 +7,156 @@
  ============================================================================
  */
 
+#include <stdint.h>
 #include <string.h>
 
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
-#include "hev-compiler.h"
 #include "hev-fsh-session.h"
 
 #include "hev-fsh-session-manager.h"
 
-void
+#define HEV_FSH_SESSION_MANAGER_MIN_SLOTS (64)
+
+struct _HevFshSessionManagerSlot
+{
+    unsigned int hash;
+    HevFshSession *session;
+};
+
+static unsigned int
+hev_fsh_session_manager_hash (int type, HevFshToken token)
+{
+    uint64_t a, b;
+
+    /* tokens are random, mix all bytes to decorrelate from worker routing */
+    memcpy (&a, &token[0], sizeof (a));
+    memcpy (&b, &token[8], sizeof (b));
+
+    a ^= (b + type) * 0x9e3779b97f4a7c15ULL;
+    a ^= a >> 33;
+    a *= 0xff51afd7ed558ccdULL;
+    a ^= a >> 33;
+
+    return a;
+}
+
+static int
+hev_fsh_session_manager_resize (HevFshSessionManager *self, unsigned int size)
+{
+    HevFshSessionManagerSlot *slots;
+    unsigned int mask = size - 1;
+    unsigned int i;
+
+    slots = hev_calloc (size, sizeof (HevFshSessionManagerSlot));
+    if (!slots)
+        return -1;
+
+    for (i = 0; i <= self->mask; i++) {
+        HevFshSessionManagerSlot *o = &self->slots[i];
+        unsigned int j;
+
+        if (!o->session)
+            continue;
+
+        for (j = o->hash & mask; slots[j].session; j = (j + 1) & mask)
+            ;
+        slots[j] = *o;
+    }
+
+    hev_free (self->slots);
+    self->slots = slots;
+    self->mask = mask;
+
+    return 0;
+}
+
+int
 hev_fsh_session_manager_insert (HevFshSessionManager *self, HevFshSession *s)
 {
-    HevRBTreeNode **n = &self->tree.root, *parent = NULL;
-
-    while (*n) {
-        HevFshSession *t = container_of (*n, HevFshSession, node);
-
-        parent = *n;
-
-        if (s->type < t->type) {
-            n = &((*n)->left);
-        } else if (s->type > t->type) {
-            n = &((*n)->right);
-        } else {
-            if (memcmp (s->token, t->token, sizeof (HevFshToken)) < 0)
-                n = &((*n)->left);
-            else
-                n = &((*n)->right);
+    unsigned int i;
+
+    if (((self->size + 1) * 4) > ((self->mask + 1) * 3)) {
+        int res;
+
+        res = hev_fsh_session_manager_resize (self, (self->mask + 1) * 2);
+        if ((res < 0) && ((self->size + 1) > self->mask)) {
+            LOG_E ("%p fsh session manager insert", self);
+            return -1;
         }
     }
 
-    hev_rbtree_node_link (&s->node, parent, n);
-    hev_rbtree_insert_color (&self->tree, &s->node);
+    s->hash = hev_fsh_session_manager_hash (s->type, s->token);
+    for (i = s->hash & self->mask; self->slots[i].session;
+         i = (i + 1) & self->mask)
+        ;
+
+    self->slots[i].hash = s->hash;
+    self->slots[i].session = s;
+    self->size++;
+
+    return 0;
 }
 
 void
 hev_fsh_session_manager_remove (HevFshSessionManager *self, HevFshSession *s)
 {
-    hev_rbtree_erase (&self->tree, &s->node);
+    unsigned int i, j;
+
+    for (i = s->hash & self->mask; self->slots[i].session != s;
+         i = (i + 1) & self->mask) {
+        if (!self->slots[i].session)
+            return;
+    }
+
+    /* backward shift deletion, no tombstones */
+    for (j = (i + 1) & self->mask; self->slots[j].session;
+         j = (j + 1) & self->mask) {
+        unsigned int k = self->slots[j].hash & self->mask;
+
+        /* move slot j back unless its home lies cyclically in (i, j] */
+        if (((j - k) & self->mask) < ((j - i) & self->mask))
+            continue;
+
+        self->slots[i] = self->slots[j];
+        i = j;
+    }
+
+    self->slots[i].session = NULL;
+    self->size--;
 }
 
 HevFshSession *
 hev_fsh_session_manager_find (HevFshSessionManager *self, int type,
                               HevFshToken *token)
 {
-    HevRBTreeNode **n = &self->tree.root;
-
-    while (*n) {
-        HevFshSession *t = container_of (*n, HevFshSession, node);
-
-        if (type < t->type) {
-            n = &((*n)->left);
-        } else if (type > t->type) {
-            n = &((*n)->right);
-        } else {
-            int res = memcmp (*token, t->token, sizeof (HevFshToken));
-            if (res < 0)
-                n = &((*n)->left);
-            else if (res > 0)
-                n = &((*n)->right);
-            else
-                return t;
-        }
+    unsigned int hash;
+    unsigned int i;
+
+    hash = hev_fsh_session_manager_hash (type, *token);
+    for (i = hash & self->mask; self->slots[i].session;
+         i = (i + 1) & self->mask) {
+        HevFshSession *t = self->slots[i].session;
+
+        if (self->slots[i].hash != hash || t->type != type)
+            continue;
+
+        if (memcmp (*token, t->token, sizeof (HevFshToken)) == 0)
+            return t;
+    }
+
+    return NULL;
+}
+
+HevFshSession *
+hev_fsh_session_manager_next (HevFshSessionManager *self, unsigned int *iter)
+{
+    for (; *iter <= self->mask; (*iter)++) {
+        HevFshSession *t = self->slots[*iter].session;
+
+        if (t)
+            return t;
     }
 
     return NULL;
@@ -110,6 +196,12 @@ hev_fsh_session_manager_construct (HevFshSessionManager *self)
 
     HEV_OBJECT (self)->klass = HEV_FSH_SESSION_MANAGER_TYPE;
 
+    self->mask = HEV_FSH_SESSION_MANAGER_MIN_SLOTS - 1;
+    self->slots = hev_calloc (HEV_FSH_SESSION_MANAGER_MIN_SLOTS,
+                              sizeof (HevFshSessionManagerSlot));
+    if (!self->slots)
+        return -1;
+
     return 0;
 }
 
@@ -120,6 +212,7 @@ hev_fsh_session_manager_destruct (HevObject *base)
 
     LOG_D ("%p fsh session manager destruct", self);
 
+    hev_free (self->slots);
     HEV_OBJECT_TYPE->finalizer (base);
     hev_free (self);
 }
@@ -11,7 +11,6 @@
 #define __HEV_FSH_SESSION_MANAGER_H__
 
 #include "hev-object.h"
-#include "hev-rbtree.h"
 #include "hev-fsh-protocol.h"
 
 #ifdef __cplusplus
@@ -25,12 +24,15 @@ extern "C" {
 typedef struct _HevFshSession HevFshSession;
 typedef struct _HevFshSessionManager HevFshSessionManager;
 typedef struct _HevFshSessionManagerClass HevFshSessionManagerClass;
+typedef struct _HevFshSessionManagerSlot HevFshSessionManagerSlot;
 
 struct _HevFshSessionManager
 {
     HevObject base;
 
-    HevRBTree tree;
+    unsigned int size;
+    unsigned int mask;
+    HevFshSessionManagerSlot *slots;
 };
 
 struct _HevFshSessionManagerClass
@@ -44,8 +46,8 @@ int hev_fsh_session_manager_construct (HevFshSessionManager *self);
 
 HevFshSessionManager *hev_fsh_session_manager_new (void);
 
-void hev_fsh_session_manager_insert (HevFshSessionManager *self,
-                                     HevFshSession *s);
+int hev_fsh_session_manager_insert (HevFshSessionManager *self,
+                                    HevFshSession *s);
 
 void hev_fsh_session_manager_remove (HevFshSessionManager *self,
                                      HevFshSession *s);
@@ -53,6 +55,9 @@ void hev_fsh_session_manager_remove (HevFshSessionManager *self,
 HevFshSession *hev_fsh_session_manager_find (HevFshSessionManager *self,
                                              int type, HevFshToken *token);
 
+HevFshSession *hev_fsh_session_manager_next (HevFshSessionManager *self,
+                                             unsigned int *iter);
+
 #ifdef __cplusplus
 }
 #endif
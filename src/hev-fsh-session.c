@@ -7,10 +7,12 @@
  ============================================================================
  */
 
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
@@ -18,26 +20,44 @@
 #include <hev-memory-allocator.h>
 
 #include "hev-logger.h"
+#include "hev-random.h"
 #include "hev-compiler.h"
 #include "hev-fsh-config.h"
+#include "hev-fsh-server.h"
+#include "hev-fsh-splice.h"
+#include "hev-fsh-uring.h"
 
 #include "hev-fsh-session.h"
 
+#define HEV_FSH_SESSION_QUEUE_SIZE (32)
+#define HEV_FSH_SESSION_FLUSH_BATCH (8)
+#define HEV_FSH_SESSION_RETRY_DELAY (1000)
+
+#ifdef __linux__
+#define HEV_FSH_SESSION_TOKEN_VER (5)
+#else
+#define HEV_FSH_SESSION_TOKEN_VER (4)
+#endif
+
 enum
 {
     TYPE_NULL = 0,
     TYPE_FORWARD,
     TYPE_CONNECT,
+    TYPE_ACCEPT,
+    TYPE_PARK,
     TYPE_SPLICE,
+    TYPE_NODE,
+    TYPE_RECOVER,
     TYPE_CLOSED,
 };
 
-static void
-sleep_wait (unsigned int milliseconds)
+struct _HevFshSessionQueued
 {
-    while (milliseconds)
-        milliseconds = hev_task_sleep (milliseconds);
-}
+    HevFshSession *connector;
+    HevFshMessage msg;
+    HevFshMessageToken mt;
+};
 
 static void
 hev_fsh_session_log (HevFshSession *self, const char *type)
@@ -71,183 +91,877 @@ hev_fsh_session_log (HevFshSession *self, const char *type)
         LOG_I ("%s %s [%s]:%d", type, ts, sa, port);
 }
 
+static void
+hev_fsh_session_tarpit (HevFshSession *self)
+{
+    HevFshConfig *config = self->worker->config;
+    struct sockaddr *addr = NULL;
+    socklen_t len;
+
+    if (self->peer)
+        addr = hev_fsh_config_get_peer_sockaddr (config, self->peer - 1, &len);
+
+    /* the probe waits without a task, its stack is released now */
+    hev_task_del_fd (hev_task_self (), self->client_fd);
+    hev_fsh_tarpit_add (self->worker->tarpit, self->client_fd, addr);
+    self->client_fd = -1;
+}
+
+static void
+hev_fsh_session_wakeup (HevFshSession *self)
+{
+    HevFshIO *io = HEV_FSH_IO (self);
+
+    if (io->task)
+        hev_task_wakeup (io->task);
+    else
+        hev_fsh_io_run (io);
+}
+
+static void
+hev_fsh_session_kick (HevFshSession *self)
+{
+    HevFshIO *io = HEV_FSH_IO (self);
+
+    hev_fsh_session_manager_remove (self->manager, self);
+    self->is_mgr = 0;
+    self->type = TYPE_CLOSED;
+
+    io->timeout = 0;
+    hev_fsh_session_wakeup (self);
+}
+
+static void
+hev_fsh_session_announce (HevFshSession *self, int is_held)
+{
+    HevFshCluster *cluster = self->worker->server->cluster;
+
+    if (cluster)
+        hev_fsh_cluster_announce (cluster, self->worker, self->token, is_held);
+}
+
+static void
+hev_fsh_session_remember (HevFshSession *self, int is_held)
+{
+    HevFshSnapshot *snapshot = self->worker->server->snapshot;
+
+    if (!snapshot || self->worker->is_draining)
+        return;
+
+    if (is_held) {
+        unsigned int flags = 0;
+
+        if (self->is_temp_token)
+            flags |= HEV_FSH_SNAPSHOT_TEMP;
+        if (self->is_klive)
+            flags |= HEV_FSH_SNAPSHOT_QUIET;
+        hev_fsh_snapshot_put (snapshot, self->token, flags);
+    } else
+        hev_fsh_snapshot_del (snapshot, self->token);
+}
+
+static int
+hev_fsh_session_idle (HevFshSession *self)
+{
+    HevFshIO *io = HEV_FSH_IO (self);
+    char b;
+    int res;
+
+    if (self->mux && self->mux->nr_streams)
+        return 0;
+
+    if (self->queue_used || (self->reader.head != self->reader.tail))
+        return 0;
+    res = recv (self->client_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if ((res >= 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+        return 0;
+
+    if (!self->is_klive) {
+        res = hev_fsh_io_set_deadline (io, io->timeout);
+        if (res < 0)
+            return 0;
+    }
+
+    hev_task_del_fd (hev_task_self (), self->client_fd);
+    res = hev_fsh_idler_add (self->worker->idler, self);
+    if (res < 0) {
+        hev_task_add_fd (hev_task_self (), self->client_fd, POLLIN | POLLOUT);
+        return 0;
+    }
+
+    self->is_idle = 1;
+    hev_fsh_task_put (io->task, io->role);
+    io->task = NULL;
+
+    return 1;
+}
+
+static int
+hev_fsh_session_is_closed (HevFshSession *self)
+{
+    char b;
+    int res;
+
+    res = recv (self->client_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (res == 0)
+        return 1;
+    if ((res < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+        return 1;
+
+    return 0;
+}
+
+static HevFshSession *
+hev_fsh_session_recover (HevFshSession *self, HevFshMessageToken *mt)
+{
+    HevFshSnapshot *snapshot = self->worker->server->snapshot;
+    HevFshTimerWheel *wheel = hev_fsh_timer_wheel_get ();
+    HevFshIO *io = HEV_FSH_IO (self);
+    unsigned int delay;
+    int res;
+
+    if (!snapshot || !wheel || self->worker->is_draining)
+        return NULL;
+
+    delay = hev_fsh_snapshot_hold (snapshot, mt->token);
+    if (!delay)
+        return NULL;
+
+    self->type = TYPE_RECOVER;
+    memcpy (self->token, mt->token, sizeof (HevFshToken));
+    res = hev_fsh_session_manager_insert (self->manager, self);
+    if (res < 0) {
+        self->type = TYPE_NULL;
+        return NULL;
+    }
+    self->is_mgr = 1;
+
+    hev_fsh_timer_wheel_del (wheel, &io->timer);
+    hev_fsh_io_set_deadline (io, delay);
+
+    while (self->type == TYPE_RECOVER) {
+        hev_task_yield (HEV_TASK_WAITIO);
+        if (self->type != TYPE_RECOVER)
+            break;
+        if (io->is_expired || hev_fsh_session_is_closed (self)) {
+            hev_fsh_session_manager_remove (self->manager, self);
+            self->is_mgr = 0;
+            self->type = TYPE_NULL;
+            return NULL;
+        }
+    }
+
+    if (self->type != TYPE_NULL)
+        return NULL;
+
+    return hev_fsh_session_manager_find (self->manager, TYPE_FORWARD,
+                                         &mt->token);
+}
+
+static int
+hev_fsh_session_write_message (HevFshSession *self, int fd, int ver, int cmd,
+                               void *data, size_t size)
+{
+    struct msghdr mh = { 0 };
+    struct iovec iov[2];
+    HevFshMessage msg;
+    int res;
+
+    msg.ver = ver;
+    msg.cmd = cmd;
+
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof (msg);
+    iov[1].iov_base = data;
+    iov[1].iov_len = size;
+
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+
+    hev_task_mutex_lock (&self->wlock);
+    res = hev_task_io_socket_sendmsg (fd, &mh, MSG_WAITALL, io_yielder, self);
+    hev_task_mutex_unlock (&self->wlock);
+
+    return res;
+}
+
+static int
+hev_fsh_session_queue_message (HevFshSession *self, int ver, int cmd,
+                               HevFshMessageToken *mt, HevFshSession *c)
+{
+    const unsigned int mask = HEV_FSH_SESSION_QUEUE_SIZE - 1;
+    HevFshSessionQueued *q;
+
+    if (!self->queue) {
+        self->queue = hev_malloc (sizeof (HevFshSessionQueued) *
+                                  HEV_FSH_SESSION_QUEUE_SIZE);
+        if (!self->queue)
+            return -1;
+    }
+
+    if (self->queue_used == HEV_FSH_SESSION_QUEUE_SIZE)
+        return -1;
+
+    q = &self->queue[(self->queue_head + self->queue_used) & mask];
+    q->msg.ver = ver;
+    q->msg.cmd = cmd;
+    memcpy (&q->mt, mt, sizeof (HevFshMessageToken));
+    q->connector = c;
+    hev_object_ref (HEV_OBJECT (c));
+    self->queue_used++;
+
+    return 0;
+}
+
+static void
+hev_fsh_session_queue_pop (HevFshSession *self, unsigned int n)
+{
+    const unsigned int mask = HEV_FSH_SESSION_QUEUE_SIZE - 1;
+
+    while (n--) {
+        HevFshSessionQueued *q = &self->queue[self->queue_head];
+
+        hev_object_unref (HEV_OBJECT (q->connector));
+        self->queue_head = (self->queue_head + 1) & mask;
+        self->queue_used--;
+    }
+}
+
+static void
+hev_fsh_session_flush_fail (HevFshSession *self)
+{
+    LOG_D ("%p fsh session flush fail", self);
+
+    while (self->queue_used) {
+        HevFshSession *c = self->queue[self->queue_head].connector;
+
+        if ((c->type == TYPE_CONNECT) && c->is_mgr)
+            hev_fsh_session_kick (c);
+        hev_fsh_session_queue_pop (self, 1);
+    }
+}
+
+static int
+hev_fsh_session_flush (HevFshSession *self)
+{
+    const unsigned int mask = HEV_FSH_SESSION_QUEUE_SIZE - 1;
+
+    while (self->queue_used) {
+        struct iovec iov[HEV_FSH_SESSION_FLUSH_BATCH * 2];
+        struct msghdr mh = { 0 };
+        unsigned int i, n;
+        int res;
+
+        n = self->queue_used;
+        if (n > HEV_FSH_SESSION_FLUSH_BATCH)
+            n = HEV_FSH_SESSION_FLUSH_BATCH;
+
+        for (i = 0; i < n; i++) {
+            HevFshSessionQueued *q;
+
+            q = &self->queue[(self->queue_head + i) & mask];
+            iov[i * 2].iov_base = &q->msg;
+            iov[i * 2].iov_len = sizeof (HevFshMessage);
+            iov[i * 2 + 1].iov_base = &q->mt;
+            iov[i * 2 + 1].iov_len = sizeof (HevFshMessageToken);
+        }
+
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n * 2;
+
+        hev_task_mutex_lock (&self->wlock);
+        res = hev_task_io_socket_sendmsg (self->client_fd, &mh, MSG_WAITALL,
+                                          io_yielder, self);
+        hev_task_mutex_unlock (&self->wlock);
+        if (res <= 0)
+            return -1;
+
+        hev_fsh_session_queue_pop (self, n);
+    }
+
+    return 0;
+}
+
+static int
+hev_fsh_session_forward_yielder (HevTaskYieldType type, void *data)
+{
+    HevFshSession *self = data;
+
+    /* woken by a connector, its message goes out before we wait again */
+    if (self->queue_used && (hev_fsh_session_flush (self) < 0))
+        return -1;
+
+    return io_yielder (type, data);
+}
+
+static int
+hev_fsh_session_retry (HevFshSession *self, unsigned int delay)
+{
+    HevFshMessageRetry mr;
+    int cmd;
+
+    LOG_D ("%p fsh session retry %u", self, delay);
+
+    cmd = HEV_FSH_CMD_RETRY;
+    mr.delay = htonl (delay);
+    hev_fsh_session_write_message (self, self->client_fd, 1, cmd, &mr,
+                                   sizeof (mr));
+
+    return -1;
+}
+
+static int
+hev_fsh_session_login (HevFshSession *self, int msg_ver,
+                       HevFshMessageToken *mt)
+{
+    HevTask *task = hev_task_self ();
+    unsigned int delay;
+    HevFshSession *s;
+    int priority;
+    int cmd;
+    int res;
+
+    if (self->type)
+        return -1;
+
+    delay = hev_fsh_server_worker_admit (self->worker);
+    if (delay)
+        return hev_fsh_session_retry (self, delay);
+
+    /* queued behind connectors and tunnels ready on this worker */
+    priority = hev_task_get_priority (task);
+    hev_task_set_priority (task, HEV_TASK_PRIORITY_LOW);
+    hev_task_yield (HEV_TASK_YIELD);
+    hev_task_set_priority (task, priority);
+
+    if (msg_ver == 1) {
+        hev_fsh_server_worker_token_generate (self->worker, self->token);
+    } else {
+        HevFshToken zt = { 0 };
+
+        if (memcmp (zt, mt->token, sizeof (HevFshToken)) == 0) {
+            hev_fsh_server_worker_token_generate (self->worker, self->token);
+        } else {
+            memcpy (self->token, mt->token, sizeof (HevFshToken));
+        }
+    }
+
+    s = hev_fsh_session_manager_find (self->manager, TYPE_FORWARD,
+                                      &self->token);
+    if (s)
+        hev_fsh_session_kick (s);
+
+    cmd = HEV_FSH_CMD_TOKEN;
+    memcpy (mt->token, self->token, sizeof (HevFshToken));
+    res = hev_fsh_session_write_message (self, self->client_fd,
+                                         HEV_FSH_SESSION_TOKEN_VER, cmd, mt,
+                                         sizeof (*mt));
+    if (res <= 0)
+        return -1;
+
+    self->type = TYPE_FORWARD;
+    self->is_temp_token = (msg_ver == 3) ? 1 : 0;
+    res = hev_fsh_session_manager_insert (self->manager, self);
+    if (res < 0)
+        return -1;
+    self->is_mgr = 1;
+    hev_fsh_session_log (self, "L");
+    hev_fsh_session_announce (self, 1);
+    hev_fsh_session_remember (self, 1);
+
+    while ((s = hev_fsh_session_manager_find (self->manager, TYPE_RECOVER,
+                                              &self->token))) {
+        hev_fsh_session_manager_remove (s->manager, s);
+        s->is_mgr = 0;
+        s->type = TYPE_NULL;
+        hev_fsh_session_wakeup (s);
+    }
+
+    return 0;
+}
+
+static int
+hev_fsh_session_wait (HevFshSession *self, int type)
+{
+    HevFshIO *io = HEV_FSH_IO (self);
+    int is_klive = 0;
+    int res;
+
+    if (type == TYPE_PARK) {
+        res = hev_fsh_protocol_set_keep_alive (self->client_fd,
+                                               io->timeout / 1000);
+        is_klive = (res == 0);
+    }
+
+    if (!is_klive) {
+        res = hev_fsh_io_set_deadline (io, io->timeout);
+        if (res < 0)
+            return -1;
+    }
+
+    while (self->type == type) {
+        hev_task_yield (HEV_TASK_WAITIO);
+        if (self->type != type)
+            break;
+        if (io->is_expired && !is_klive) {
+            LOG_D ("%p fsh session wait timeout", self);
+            return -1;
+        }
+        if (hev_fsh_session_is_closed (self))
+            return -1;
+    }
+
+    if (self->type == TYPE_CLOSED)
+        return -1;
+
+    return 0;
+}
+
+static void
+hev_fsh_session_pair (HevFshSession *self, HevFshSession *peer)
+{
+    HevTask *task = HEV_FSH_IO (self)->task;
+
+    LOG_D ("%p fsh session pair %p", self, peer);
+
+    hev_fsh_session_manager_remove (self->manager, self);
+    self->is_mgr = 0;
+    self->type = TYPE_SPLICE;
+
+    if (peer->is_mgr) {
+        hev_fsh_session_manager_remove (peer->manager, peer);
+        peer->is_mgr = 0;
+    }
+    peer->type = TYPE_NULL;
+
+    self->remote_fd = peer->client_fd;
+    peer->client_fd = -1;
+    hev_task_del_fd (HEV_FSH_IO (peer)->task, self->remote_fd);
+    hev_task_add_fd (task, self->remote_fd, POLLIN | POLLOUT);
+
+    if (task != hev_task_self ())
+        hev_task_wakeup (task);
+    else
+        hev_task_wakeup (HEV_FSH_IO (peer)->task);
+}
+
+static int
+hev_fsh_session_splice_yielder (HevTaskYieldType type, void *data)
+{
+    HevFshSession *self = data;
+
+    if (io_yielder (type, data))
+        return 1;
+
+    return self->worker->transfer_fd >= 0;
+}
+
+static void
+hev_fsh_session_splice_transfer (HevFshSession *self)
+{
+    HevFshHandoverSession hs = { 0 };
+    int fds[2];
+    int res;
+
+    hs.type = HEV_FSH_HANDOVER_SPLICE;
+    memcpy (hs.token, self->token, sizeof (HevFshToken));
+    fds[0] = self->client_fd;
+    fds[1] = self->remote_fd;
+    hev_task_del_fd (hev_task_self (), fds[0]);
+    hev_task_del_fd (hev_task_self (), fds[1]);
+
+    res = hev_fsh_handover_put_session (self->worker->transfer_fd, &hs, fds);
+    if (res < 0) {
+        LOG_W ("%p fsh session transfer splice", self);
+        return;
+    }
+
+    LOG_D ("%p fsh session transfer splice", self);
+}
+
+static void
+hev_fsh_session_splice (HevFshSession *self)
+{
+    HevFshServerWorker *worker = self->worker;
+    HevTaskIOYielder yielder = io_yielder;
+    int res;
+
+    /* ops of io_uring are in flight to the end, those stay with us */
+    if (!hev_fsh_uring_get ()) {
+        yielder = hev_fsh_session_splice_yielder;
+        self->next = worker->splices;
+        self->pprev = &worker->splices;
+        if (worker->splices)
+            worker->splices->pprev = &self->next;
+        worker->splices = self;
+    }
+
+    res = hev_fsh_splice (HEV_FSH_SPLICE_BULK, self->client_fd,
+                          self->client_fd, self->remote_fd, self->remote_fd,
+                          yielder, self);
+    if (res && !HEV_FSH_IO (self)->is_expired)
+        hev_fsh_session_splice_transfer (self);
+
+    if (self->pprev) {
+        *self->pprev = self->next;
+        if (self->next)
+            self->next->pprev = self->pprev;
+        self->pprev = NULL;
+    }
+}
+
+static int
+hev_fsh_session_connect_mux (HevFshSession *self, HevFshMux *mux,
+                             HevFshMessageToken *mt)
+{
+    self->type = TYPE_SPLICE;
+    memcpy (self->token, mt->token, sizeof (HevFshToken));
+    hev_fsh_session_log (self, "C");
+
+    hev_fsh_mux_splice (mux, self->client_fd, mt->token, NULL, 0);
+    hev_object_unref (HEV_OBJECT (mux));
+
+    return -1;
+}
+
+static int
+hev_fsh_session_connect (HevFshSession *self, int msg_ver,
+                         HevFshMessageToken *mt)
+{
+    HevFshCluster *cluster = self->worker->server->cluster;
+    HevFshSession *s, *a, *p = NULL;
+    int cmd;
+    int res;
+
+    if (self->type)
+        return -1;
+
+    s = hev_fsh_session_manager_find (self->manager, TYPE_FORWARD, &mt->token);
+    if (!s) {
+        HevFshMux *mux = NULL;
+
+        if (cluster && (msg_ver == 1))
+            mux = hev_fsh_cluster_route (cluster, self->worker, mt->token);
+        if (mux)
+            return hev_fsh_session_connect_mux (self, mux, mt);
+
+        s = hev_fsh_session_recover (self, mt);
+        if (self->type)
+            return -1;
+    }
+
+    if (!s) {
+        hev_fsh_session_tarpit (self);
+        return -1;
+    }
+
+    if (s->is_temp_token)
+        hev_fsh_server_worker_token_generate (self->worker, mt->token);
+
+    if (s->mux) {
+        hev_object_ref (HEV_OBJECT (s->mux));
+        return hev_fsh_session_connect_mux (self, s->mux, mt);
+    }
+
+    /* register before notifying, the accept can never miss us */
+    self->type = TYPE_CONNECT;
+    memcpy (self->token, mt->token, sizeof (HevFshToken));
+    res = hev_fsh_session_manager_insert (self->manager, self);
+    if (res < 0)
+        return -1;
+    self->is_mgr = 1;
+
+    hev_fsh_session_log (self, "C");
+
+    a = hev_fsh_session_manager_find (self->manager, TYPE_ACCEPT, &mt->token);
+    if (!a && s->is_pool)
+        p = hev_fsh_session_manager_find (self->manager, TYPE_PARK, &s->key);
+
+    cmd = HEV_FSH_CMD_CONNECT;
+    if (a) {
+        hev_fsh_session_pair (self, a);
+    } else if (p) {
+        hev_fsh_session_pair (self, p);
+        res = hev_fsh_session_write_message (self, self->remote_fd, 1, cmd, mt,
+                                             sizeof (*mt));
+        if (res <= 0)
+            return -1;
+    } else {
+        HevFshIO *io = HEV_FSH_IO (s);
+
+        res = hev_fsh_session_queue_message (s, 1, cmd, mt, self);
+        if (res < 0) {
+            LOG_W ("%p fsh session forwarder queue full", self);
+            return hev_fsh_session_retry (self, HEV_FSH_SESSION_RETRY_DELAY);
+        }
+
+        if (!s->is_klive)
+            hev_fsh_io_set_deadline (io, io->timeout);
+
+        hev_fsh_session_wakeup (s);
+    }
+
+    res = hev_fsh_session_wait (self, TYPE_CONNECT);
+    if (res < 0)
+        return -1;
+
+    hev_fsh_session_splice (self);
+
+    return -1;
+}
+
+static int
+hev_fsh_session_accept (HevFshSession *self, HevFshMessageToken *mt)
+{
+    HevFshSession *s;
+    int res;
+
+    if (self->type)
+        return -1;
+
+    s = hev_fsh_session_manager_find (self->manager, TYPE_CONNECT, &mt->token);
+    if (s) {
+        hev_fsh_session_pair (s, self);
+        return -1;
+    }
+
+    /* wait for connect */
+    self->type = TYPE_ACCEPT;
+    memcpy (self->token, mt->token, sizeof (HevFshToken));
+    res = hev_fsh_session_manager_insert (self->manager, self);
+    if (res < 0)
+        return -1;
+    self->is_mgr = 1;
+
+    hev_fsh_session_wait (self, TYPE_ACCEPT);
+
+    return -1;
+}
+
+static int
+hev_fsh_session_pool (HevFshSession *self, HevFshMessageToken *mt)
+{
+    if (self->type != TYPE_FORWARD)
+        return -1;
+
+    memcpy (self->key, mt->token, sizeof (HevFshToken));
+    self->is_pool = 1;
+
+    return 0;
+}
+
 static int
-hev_fsh_session_write_message (HevFshSession *self, int ver, int cmd,
-                               void *data, size_t size)
+hev_fsh_session_mux (HevFshSession *self)
 {
-    int fd = self->client_fd;
-    struct msghdr mh = { 0 };
-    struct iovec iov[2];
-    HevFshMessage msg;
-    int res;
+    unsigned int timeout = self->base.timeout;
 
-    msg.ver = ver;
-    msg.cmd = cmd;
+    if ((self->type != TYPE_FORWARD) || self->mux)
+        return -1;
 
-    iov[0].iov_base = &msg;
-    iov[0].iov_len = sizeof (msg);
-    iov[1].iov_base = data;
-    iov[1].iov_len = size;
+    self->mux = hev_fsh_mux_new (self->client_fd, timeout, NULL, NULL);
+    if (!self->mux)
+        return -1;
+    hev_fsh_mux_set_reader (self->mux, &self->reader);
 
-    mh.msg_iov = iov;
-    mh.msg_iovlen = 2;
+    return 0;
+}
 
-    hev_task_mutex_lock (&self->wlock);
-    res = hev_task_io_socket_sendmsg (fd, &mh, MSG_WAITALL, io_yielder, self);
-    hev_task_mutex_unlock (&self->wlock);
+static int
+hev_fsh_session_stream (HevFshSession *self, HevFshMessage *msg)
+{
+    if (!self->mux)
+        return -1;
 
-    return res;
+    return hev_fsh_mux_dispatch (self->mux, msg, io_yielder, self);
 }
 
 static int
-hev_fsh_session_login (HevFshSession *self, int msg_ver)
+hev_fsh_session_park (HevFshSession *self, HevFshMessageToken *mt)
 {
-    HevFshMessageToken mt;
+    HevFshMessageToken key;
     HevFshSession *s;
-    int cmd;
     int res;
 
     if (self->type)
         return -1;
 
-    if (msg_ver == 1) {
-        hev_fsh_protocol_token_generate (self->token);
-    } else {
-        HevFshToken zt = { 0 };
-
-        res = hev_task_io_socket_recv (self->client_fd, &mt, sizeof (mt),
-                                       MSG_WAITALL, io_yielder, self);
-        if (res <= 0)
-            return -1;
-
-        if (memcmp (zt, mt.token, sizeof (HevFshToken)) == 0) {
-            hev_fsh_protocol_token_generate (self->token);
-        } else {
-            memcpy (self->token, mt.token, sizeof (HevFshToken));
-        }
-    }
-
-    s = hev_fsh_session_manager_find (self->manager, TYPE_FORWARD,
-                                      &self->token);
-    if (s) {
-        HevFshIO *io = HEV_FSH_IO (s);
-
-        s->is_mgr = 0;
-        s->type = TYPE_CLOSED;
-        hev_fsh_session_manager_remove (s->manager, s);
+    res = hev_fsh_reader_read (&self->reader, self->client_fd, &key,
+                               sizeof (key), 0, io_yielder, self);
+    if (res <= 0)
+        return -1;
 
-        io->timeout = 0;
-        hev_task_wakeup (io->task);
+    s = hev_fsh_session_manager_find (self->manager, TYPE_FORWARD, &mt->token);
+    if (!s || !s->is_pool ||
+        memcmp (s->key, key.token, sizeof (HevFshToken)) != 0) {
+        hev_fsh_session_tarpit (self);
+        return -1;
     }
 
-    cmd = HEV_FSH_CMD_TOKEN;
-    memcpy (mt.token, self->token, sizeof (HevFshToken));
-    res = hev_fsh_session_write_message (self, 1, cmd, &mt, sizeof (mt));
-    if (res <= 0)
+    self->type = TYPE_PARK;
+    memcpy (self->token, key.token, sizeof (HevFshToken));
+    memcpy (self->key, mt->token, sizeof (HevFshToken));
+    res = hev_fsh_session_manager_insert (self->manager, self);
+    if (res < 0)
         return -1;
-
     self->is_mgr = 1;
-    self->type = TYPE_FORWARD;
-    self->is_temp_token = (msg_ver == 3) ? 1 : 0;
-    hev_fsh_session_manager_insert (self->manager, self);
-    hev_fsh_session_log (self, "L");
 
-    return 0;
+    hev_fsh_session_wait (self, TYPE_PARK);
+
+    return -1;
 }
 
-static void
-hev_fsh_session_splice (HevFshSession *self)
+static int
+hev_fsh_session_node_accept (HevFshMux *mux, HevFshToken token, void *data)
 {
-    unsigned timeout = self->base.timeout;
+    HevFshSession *self = data;
+    HevFshConfig *config = self->worker->config;
+    HevFshServerWorker *worker;
+    HevFshMessageToken mt;
+    HevFshMessage msg;
+    unsigned int timeout;
+    struct sockaddr *addr;
+    HevFshSession *s;
+    socklen_t len;
+    int fds[2];
 
-    /* wait for accept */
-    while (timeout) {
-        if (self->remote_fd >= 0)
-            break;
-        timeout = hev_task_sleep (timeout);
+    addr = hev_fsh_config_get_peer_sockaddr (config, self->peer - 1, &len);
+    if (hev_fsh_tarpit_check (self->worker->tarpit, addr) < 0)
+        return -1;
+
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0,
+                    fds) < 0)
+        return -1;
+
+    msg.ver = 2;
+    msg.cmd = HEV_FSH_CMD_CONNECT;
+    memcpy (mt.token, token, sizeof (HevFshToken));
+
+    worker = hev_fsh_server_worker_route (self->worker, token);
+    if (worker != self->worker) {
+        if (hev_fsh_server_worker_handoff (worker, fds[0], &msg, &mt,
+                                           self->peer) < 0)
+            goto close;
+        return fds[1];
     }
 
-    hev_task_io_splice (self->client_fd, self->client_fd, self->remote_fd,
-                        self->remote_fd, 8192, io_yielder, self);
+    timeout = hev_fsh_config_get_timeout (config);
+    s = hev_fsh_session_new (fds[0], timeout, self->worker);
+    if (!s)
+        goto close;
+
+    hev_fsh_session_set_message (s, &msg, &mt, self->peer);
+    hev_fsh_io_run (HEV_FSH_IO (s));
+
+    return fds[1];
+
+close:
+    close (fds[0]);
+    close (fds[1]);
+    return -1;
 }
 
 static int
-hev_fsh_session_connect (HevFshSession *self)
+hev_fsh_session_node (HevFshSession *self, HevFshMessageToken *mt)
 {
-    HevFshMessageToken mt;
-    HevFshSession *s;
+    HevFshCluster *cluster = self->worker->server->cluster;
+    unsigned int timeout = self->base.timeout;
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof (addr);
+    HevFshToken reply[2], proof;
+    HevFshMessageToken pt;
+    HevFshMessage msg;
+    int peer = -1;
     int cmd;
     int res;
 
-    if (self->type)
+    if (self->type || !cluster)
         return -1;
 
-    res = hev_task_io_socket_recv (self->client_fd, &mt, sizeof (mt),
-                                   MSG_WAITALL, io_yielder, self);
+    /* listed peers only */
+    res = getpeername (self->client_fd, (struct sockaddr *)&addr, &len);
+    if (res >= 0)
+        peer = hev_fsh_cluster_find_peer (cluster, (struct sockaddr *)&addr);
+    if (peer < 0) {
+        hev_fsh_session_tarpit (self);
+        return -1;
+    }
+
+    cmd = HEV_FSH_CMD_NODE;
+    memcpy (reply[0], cluster->node, sizeof (HevFshToken));
+    hev_random_get_bytes (reply[1], sizeof (HevFshToken));
+    res = hev_fsh_session_write_message (self, self->client_fd, 2, cmd, reply,
+                                         sizeof (reply));
     if (res <= 0)
         return -1;
 
-    s = hev_fsh_session_manager_find (self->manager, TYPE_FORWARD, &mt.token);
-    if (!s) {
-        sleep_wait (1500);
+    res = hev_fsh_reader_read (&self->reader, self->client_fd, &msg,
+                               sizeof (msg), 0, io_yielder, self);
+    if ((res <= 0) || (msg.cmd != cmd) || (msg.ver != 3))
+        return -1;
+    res = hev_fsh_reader_read (&self->reader, self->client_fd, &pt,
+                               sizeof (pt), 0, io_yielder, self);
+    if (res <= 0)
         return -1;
-    }
 
-    if (s->is_temp_token)
-        hev_fsh_protocol_token_generate (mt.token);
+    hev_fsh_cluster_prove (cluster, reply[1], mt->token, cluster->node, proof);
+    if (memcmp (proof, pt.token, sizeof (HevFshToken)) != 0) {
+        LOG_W ("%p fsh session node proof", self);
+        hev_fsh_session_tarpit (self);
+        return -1;
+    }
 
-    cmd = HEV_FSH_CMD_CONNECT;
-    res = hev_fsh_session_write_message (s, 1, cmd, &mt, sizeof (mt));
-    if (res <= 0)
+    self->mux = hev_fsh_mux_new (self->client_fd, timeout,
+                                 hev_fsh_session_node_accept, self);
+    if (!self->mux)
         return -1;
+    hev_fsh_mux_set_reader (self->mux, &self->reader);
 
-    self->is_mgr = 1;
-    self->type = TYPE_CONNECT;
-    memcpy (self->token, mt.token, sizeof (HevFshToken));
-    hev_fsh_session_manager_insert (self->manager, self);
-    hev_fsh_session_log (self, "C");
+    self->type = TYPE_NODE;
+    self->peer = peer + 1;
+    memcpy (self->token, mt->token, sizeof (HevFshToken));
+    hev_fsh_session_log (self, "N");
 
-    hev_fsh_session_splice (self);
+    /* up as long as the peer is, a drain does not wait for it */
+    __atomic_sub_fetch (&self->worker->nr_sessions, 1, __ATOMIC_RELAXED);
 
-    return -1;
+    return 0;
 }
 
 static int
-hev_fsh_session_accept (HevFshSession *self)
+hev_fsh_session_node_token (HevFshSession *self, int msg_ver,
+                            HevFshMessageToken *mt)
 {
-    HevFshSessionManager *manager = self->manager;
-    HevFshMessageToken mt;
-    HevFshSession *s;
-    unsigned timeout;
-    int res;
+    HevFshCluster *cluster = self->worker->server->cluster;
 
-    res = hev_task_io_socket_recv (self->client_fd, &mt, sizeof (mt),
-                                   MSG_WAITALL, io_yielder, self);
-    if (res <= 0)
+    if (self->type != TYPE_NODE)
         return -1;
 
-    /* wait for connect */
-    timeout = self->base.timeout;
-    while (timeout) {
-        s = hev_fsh_session_manager_find (manager, TYPE_CONNECT, &mt.token);
-        if (s)
-            break;
-        timeout = hev_task_sleep (timeout);
-    }
+    hev_fsh_cluster_learn (cluster, self, self->token, mt->token,
+                           msg_ver == 1);
 
-    if (!s)
+    return 0;
+}
+
+static int
+hev_fsh_session_kernel_alive (HevFshSession *self)
+{
+    unsigned int timeout;
+    int res;
+
+    if (self->type != TYPE_FORWARD)
         return -1;
 
-    s->type = TYPE_SPLICE;
-    s->remote_fd = self->client_fd;
-    hev_fsh_session_manager_remove (manager, s);
-    hev_fsh_session_manager_insert (manager, s);
-    hev_task_del_fd (hev_task_self (), self->client_fd);
-    hev_task_add_fd (HEV_FSH_IO (s)->task, s->remote_fd, POLLIN | POLLOUT);
-    hev_task_wakeup (HEV_FSH_IO (s)->task);
+    timeout = hev_fsh_config_get_timeout (self->worker->config);
+    res = hev_fsh_protocol_set_keep_alive (self->client_fd, timeout);
+    if (res < 0) {
+        LOG_E ("%p fsh session kernel alive", self);
+        return 0;
+    }
 
-    self->client_fd = -1;
-    return -1;
+    self->is_klive = 1;
+    hev_fsh_session_remember (self, 1);
+
+    return 0;
 }
 
 static int
@@ -259,9 +973,22 @@ hev_fsh_session_keep_alive (HevFshSession *self, int msg_ver)
     if (msg_ver == 1)
         return 0;
 
+    if (msg_ver == 3)
+        return hev_fsh_session_kernel_alive (self);
+
+    if (self->type == TYPE_FORWARD)
+        hev_fsh_session_remember (self, 1);
+
     msg.ver = 1;
     msg.cmd = HEV_FSH_CMD_KEEP_ALIVE;
 
+    if (self->mux) {
+        res = hev_fsh_mux_write_message (self->mux, msg.ver, msg.cmd, NULL, 0);
+        if (res <= 0)
+            return -1;
+        return 0;
+    }
+
     hev_task_mutex_lock (&self->wlock);
     res = hev_task_io_socket_send (self->client_fd, &msg, sizeof (msg),
                                    MSG_WAITALL, io_yielder, self);
@@ -275,47 +1002,196 @@ hev_fsh_session_keep_alive (HevFshSession *self, int msg_ver)
 static void
 hev_fsh_session_close_session (HevFshSession *self)
 {
-    if (self->type)
+    if (self->type && (self->type != TYPE_PARK))
         hev_fsh_session_log (self, "D");
 
-    if (self->is_mgr)
+    if (self->type == TYPE_NODE)
+        hev_fsh_cluster_forget (self->worker->server->cluster, self);
+    else if ((self->type == TYPE_FORWARD) && self->is_mgr) {
+        hev_fsh_session_announce (self, 0);
+        hev_fsh_session_remember (self, 0);
+    }
+
+    if (self->is_mgr) {
         hev_fsh_session_manager_remove (self->manager, self);
+        self->is_mgr = 0;
+    }
 
     hev_object_unref (HEV_OBJECT (self));
 }
 
+static int
+hev_fsh_session_read_message (HevFshSession *self, HevFshMessage *msg,
+                              HevFshMessageToken *mt)
+{
+    HevTaskIOYielder yielder = io_yielder;
+    size_t ahead;
+    int res;
+
+    if (self->is_pending) {
+        self->is_pending = 0;
+        memcpy (msg, &self->msg, sizeof (HevFshMessage));
+        memcpy (mt, &self->mt, sizeof (HevFshMessageToken));
+        return 0;
+    }
+
+    /* read ahead only where nothing is spliced */
+    switch (self->type) {
+    case TYPE_NULL:
+        ahead = sizeof (*mt);
+        break;
+    case TYPE_FORWARD:
+        yielder = hev_fsh_session_forward_yielder;
+        /* fall through */
+    case TYPE_NODE:
+        ahead = sizeof (self->rbuf);
+        break;
+    default:
+        ahead = 0;
+    }
+    res = hev_fsh_reader_read (&self->reader, self->client_fd, msg,
+                               sizeof (*msg), ahead, yielder, self);
+    if (res <= 0)
+        return -1;
+
+    switch (msg->cmd) {
+    case HEV_FSH_CMD_LOGIN:
+        if (msg->ver == 1)
+            return 0;
+        break;
+    case HEV_FSH_CMD_CONNECT:
+    case HEV_FSH_CMD_ACCEPT:
+    case HEV_FSH_CMD_POOL:
+    case HEV_FSH_CMD_PARK:
+    case HEV_FSH_CMD_NODE:
+    case HEV_FSH_CMD_NODE_TOKEN:
+        break;
+    default:
+        return 0;
+    }
+
+    res = hev_fsh_reader_read (&self->reader, self->client_fd, mt,
+                               sizeof (*mt), 0, io_yielder, self);
+    if (res <= 0)
+        return -1;
+
+    return 1;
+}
+
+static int
+hev_fsh_session_route (HevFshSession *self, HevFshMessage *msg,
+                       HevFshMessageToken *mt)
+{
+    HevFshServerWorker *worker;
+    int res;
+
+    worker = hev_fsh_server_worker_route (self->worker, mt->token);
+    if (worker == self->worker)
+        return 0;
+
+    hev_task_del_fd (hev_task_self (), self->client_fd);
+    res = hev_fsh_server_worker_handoff (worker, self->client_fd, msg, mt,
+                                         self->peer);
+    if (res < 0)
+        return -1;
+
+    self->client_fd = -1;
+    return 1;
+}
+
 static void
 hev_fsh_session_task_entry (void *data)
 {
     HevFshSession *self = data;
 
+    if (self->is_idle) {
+        self->is_idle = 0;
+        if (hev_fsh_timer_is_armed (&self->retry))
+            hev_fsh_timer_wheel_del (hev_fsh_timer_wheel_get (), &self->retry);
+        hev_fsh_idler_del (self->worker->idler, self);
+        if (HEV_FSH_IO (self)->is_expired) {
+            LOG_D ("%p fsh session idle timeout", self);
+            hev_fsh_session_close_session (self);
+            return;
+        }
+    }
+
     hev_task_add_fd (hev_task_self (), self->client_fd, POLLIN | POLLOUT);
 
+    switch (self->type) {
+    case TYPE_PARK:
+        hev_fsh_session_wait (self, TYPE_PARK);
+        hev_fsh_session_close_session (self);
+        return;
+    case TYPE_SPLICE:
+        hev_task_add_fd (hev_task_self (), self->remote_fd, POLLIN | POLLOUT);
+        hev_fsh_session_splice (self);
+        hev_fsh_session_close_session (self);
+        return;
+    }
+
     for (;;) {
+        HevFshMessageToken mt;
         HevFshMessage msg;
         int res;
 
-        res = hev_task_io_socket_recv (self->client_fd, &msg, sizeof (msg),
-                                       MSG_WAITALL, io_yielder, self);
+        if ((self->type == TYPE_FORWARD) && self->queue_used &&
+            (hev_fsh_session_flush (self) < 0)) {
+            hev_fsh_session_close_session (self);
+            break;
+        }
+
+        if ((self->type == TYPE_FORWARD) && hev_fsh_session_idle (self))
+            return;
 
+        res = hev_fsh_session_read_message (self, &msg, &mt);
         if (res < 0) {
             hev_fsh_session_close_session (self);
             break;
         }
 
+        if (res > 0 && !self->type) {
+            res = hev_fsh_session_route (self, &msg, &mt);
+            if (res != 0) {
+                hev_fsh_session_close_session (self);
+                break;
+            }
+        }
+
         switch (msg.cmd) {
         case HEV_FSH_CMD_LOGIN:
-            res = hev_fsh_session_login (self, msg.ver);
+            res = hev_fsh_session_login (self, msg.ver, &mt);
             break;
         case HEV_FSH_CMD_CONNECT:
-            res = hev_fsh_session_connect (self);
+            res = hev_fsh_session_connect (self, msg.ver, &mt);
             break;
         case HEV_FSH_CMD_ACCEPT:
-            res = hev_fsh_session_accept (self);
+            res = hev_fsh_session_accept (self, &mt);
+            break;
+        case HEV_FSH_CMD_POOL:
+            res = hev_fsh_session_pool (self, &mt);
+            break;
+        case HEV_FSH_CMD_PARK:
+            res = hev_fsh_session_park (self, &mt);
+            break;
+        case HEV_FSH_CMD_MUX:
+            res = hev_fsh_session_mux (self);
+            break;
+        case HEV_FSH_CMD_STREAM_OPEN:
+        case HEV_FSH_CMD_STREAM_DATA:
+        case HEV_FSH_CMD_STREAM_WINDOW:
+        case HEV_FSH_CMD_STREAM_CLOSE:
+            res = hev_fsh_session_stream (self, &msg);
             break;
         case HEV_FSH_CMD_KEEP_ALIVE:
             res = hev_fsh_session_keep_alive (self, msg.ver);
             break;
+        case HEV_FSH_CMD_NODE:
+            res = hev_fsh_session_node (self, &mt);
+            break;
+        case HEV_FSH_CMD_NODE_TOKEN:
+            res = hev_fsh_session_node_token (self, msg.ver, &mt);
+            break;
         default:
             res = -1;
         }
@@ -327,28 +1203,51 @@ hev_fsh_session_task_entry (void *data)
     }
 }
 
+static void
+hev_fsh_session_retry_handler (HevFshTimerWheel *wheel, HevFshTimer *timer)
+{
+    HevFshIO *io = timer->data;
+
+    if (!io->task)
+        hev_fsh_io_run (io);
+}
+
 void
 hev_fsh_session_run (HevFshIO *base)
 {
+    HevFshSession *self = HEV_FSH_SESSION (base);
+
     LOG_D ("%p fsh session run", base);
 
-    hev_task_run (base->task, hev_fsh_session_task_entry, base);
+    /* no memory, retried by a timer of its own */
+    if (!base->task) {
+        base->task = hev_fsh_task_new (base->role);
+        if (!base->task) {
+            HevFshTimerWheel *wheel = hev_fsh_timer_wheel_get ();
+
+            if (wheel && !hev_fsh_timer_is_armed (&self->retry))
+                hev_fsh_timer_wheel_add (wheel, &self->retry,
+                                         HEV_FSH_SESSION_RETRY_DELAY);
+            return;
+        }
+    }
+
+    hev_fsh_io_task_run (base, hev_fsh_session_task_entry);
 }
 
 HevFshSession *
-hev_fsh_session_new (int fd, unsigned int timeout,
-                     HevFshSessionManager *manager)
+hev_fsh_session_new (int fd, unsigned int timeout, HevFshServerWorker *worker)
 {
     HevFshSession *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevFshSession));
+    self = hev_fsh_io_alloc (sizeof (HevFshSession), HEV_FSH_TASK_SESSION);
     if (!self)
         return NULL;
 
-    res = hev_fsh_session_construct (self, fd, timeout, manager);
+    res = hev_fsh_session_construct (self, fd, timeout, worker);
     if (res < 0) {
-        hev_free (self);
+        hev_fsh_io_free (self);
         return NULL;
     }
 
@@ -357,13 +1256,164 @@ hev_fsh_session_new (int fd, unsigned int timeout,
     return self;
 }
 
+HevFshSession *
+hev_fsh_session_adopt (HevFshServerWorker *worker, HevFshHandoverSession *hs,
+                       int *fds, unsigned int timeout)
+{
+    HevFshSession *self;
+    int res;
+
+    self = hev_fsh_session_new (fds[0], timeout, worker);
+    if (!self) {
+        close (fds[0]);
+        if (hs->type == HEV_FSH_HANDOVER_SPLICE)
+            close (fds[1]);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh session adopt %u", self, hs->type);
+
+    switch (hs->type) {
+    case HEV_FSH_HANDOVER_FORWARD:
+        self->type = TYPE_FORWARD;
+        self->is_temp_token = !!(hs->flags & HEV_FSH_HANDOVER_TEMP_TOKEN);
+        self->is_pool = !!(hs->flags & HEV_FSH_HANDOVER_POOL);
+        self->is_klive = !!(hs->flags & HEV_FSH_HANDOVER_KLIVE);
+        memcpy (self->token, hs->token, sizeof (HevFshToken));
+        memcpy (self->key, hs->key, sizeof (HevFshToken));
+        break;
+    case HEV_FSH_HANDOVER_PARK:
+        self->type = TYPE_PARK;
+        memcpy (self->token, hs->key, sizeof (HevFshToken));
+        memcpy (self->key, hs->token, sizeof (HevFshToken));
+        break;
+    case HEV_FSH_HANDOVER_SPLICE:
+        self->type = TYPE_SPLICE;
+        self->remote_fd = fds[1];
+        memcpy (self->token, hs->token, sizeof (HevFshToken));
+        return self;
+    }
+
+    if ((self->type == TYPE_FORWARD) &&
+        hev_fsh_session_manager_find (self->manager, TYPE_FORWARD,
+                                      &self->token))
+        goto error;
+
+    res = hev_fsh_session_manager_insert (self->manager, self);
+    if (res < 0)
+        goto error;
+    self->is_mgr = 1;
+
+    if (self->type == TYPE_FORWARD) {
+        hev_fsh_session_announce (self, 1);
+        hev_fsh_session_remember (self, 1);
+    }
+
+    return self;
+
+error:
+    hev_object_unref (HEV_OBJECT (self));
+    return NULL;
+}
+
+int
+hev_fsh_session_transfer (HevFshSession *self, HevFshHandoverSession *hs)
+{
+    HevFshIO *io = HEV_FSH_IO (self);
+    int fd;
+
+    memset (hs, 0, sizeof (HevFshHandoverSession));
+
+    switch (self->type) {
+    case TYPE_FORWARD:
+        /* busy or carrying streams, drained instead */
+        if (!self->is_idle || self->mux || self->queue_used)
+            return -1;
+        hs->type = HEV_FSH_HANDOVER_FORWARD;
+        if (self->is_temp_token)
+            hs->flags |= HEV_FSH_HANDOVER_TEMP_TOKEN;
+        if (self->is_pool)
+            hs->flags |= HEV_FSH_HANDOVER_POOL;
+        if (self->is_klive)
+            hs->flags |= HEV_FSH_HANDOVER_KLIVE;
+        memcpy (hs->token, self->token, sizeof (HevFshToken));
+        memcpy (hs->key, self->key, sizeof (HevFshToken));
+        break;
+    case TYPE_PARK:
+        hs->type = HEV_FSH_HANDOVER_PARK;
+        memcpy (hs->token, self->key, sizeof (HevFshToken));
+        memcpy (hs->key, self->token, sizeof (HevFshToken));
+        break;
+    default:
+        return -1;
+    }
+
+    LOG_D ("%p fsh session transfer", self);
+
+    /* leaves the pollers before it is sent */
+    fd = self->client_fd;
+    if (!self->is_idle) {
+        hev_task_del_fd (io->task, fd);
+        self->client_fd = -1;
+        hev_fsh_session_kick (self);
+        return fd;
+    }
+
+    self->is_idle = 0;
+    hev_fsh_idler_del (self->worker->idler, self);
+    self->client_fd = -1;
+    hev_fsh_session_manager_remove (self->manager, self);
+    self->is_mgr = 0;
+    hev_object_unref (HEV_OBJECT (self));
+
+    return fd;
+}
+
+int
+hev_fsh_session_drain (HevFshSession *self)
+{
+    switch (self->type) {
+    case TYPE_FORWARD:
+        if (self->mux && self->mux->nr_streams)
+            return 0;
+        break;
+    case TYPE_PARK:
+    case TYPE_RECOVER:
+        break;
+    default:
+        return 0;
+    }
+
+    LOG_D ("%p fsh session drain", self);
+
+    hev_fsh_session_kick (self);
+
+    return 1;
+}
+
+int
+hev_fsh_session_is_forwarder (HevFshSession *self)
+{
+    return self->type == TYPE_FORWARD;
+}
+
+void
+hev_fsh_session_set_message (HevFshSession *self, HevFshMessage *msg,
+                             HevFshMessageToken *mt, unsigned int peer)
+{
+    self->is_pending = 1;
+    self->peer = peer;
+    memcpy (&self->msg, msg, sizeof (HevFshMessage));
+    memcpy (&self->mt, mt, sizeof (HevFshMessageToken));
+}
+
 int
 hev_fsh_session_construct (HevFshSession *self, int fd, unsigned int timeout,
-                           HevFshSessionManager *manager)
+                           HevFshServerWorker *worker)
 {
     int res;
 
-    res = hev_fsh_io_construct (&self->base, timeout);
+    res = hev_fsh_io_construct (&self->base, timeout, HEV_FSH_TASK_SESSION);
     if (res < 0)
         return res;
 
@@ -373,7 +1423,12 @@ hev_fsh_session_construct (HevFshSession *self, int fd, unsigned int timeout,
 
     self->client_fd = fd;
     self->remote_fd = -1;
-    self->manager = manager;
+    self->worker = worker;
+    hev_fsh_reader_init (&self->reader, self->rbuf, sizeof (self->rbuf));
+    self->retry.handler = hev_fsh_session_retry_handler;
+    self->retry.data = self;
+    self->manager = worker->manager;
+    __atomic_add_fetch (&worker->nr_sessions, 1, __ATOMIC_RELAXED);
 
     return 0;
 }
@@ -385,10 +1440,22 @@ hev_fsh_session_destruct (HevObject *base)
 
     LOG_D ("%p fsh session destruct", self);
 
+    if (hev_fsh_timer_is_armed (&self->retry))
+        hev_fsh_timer_wheel_del (hev_fsh_timer_wheel_get (), &self->retry);
+    if (self->mux) {
+        hev_fsh_mux_stop (self->mux);
+        hev_object_unref (HEV_OBJECT (self->mux));
+    }
     if (self->remote_fd >= 0)
         close (self->remote_fd);
     if (self->client_fd >= 0)
         close (self->client_fd);
+    if (self->queue) {
+        hev_fsh_session_flush_fail (self);
+        hev_free (self->queue);
+    }
+    if (self->type != TYPE_NODE)
+        __atomic_sub_fetch (&self->worker->nr_sessions, 1, __ATOMIC_RELAXED);
 
     HEV_FSH_IO_TYPE->finalizer (base);
 }
@@ -13,9 +13,12 @@
 #include <hev-task.h>
 #include <hev-task-mutex.h>
 
-#include "hev-rbtree.h"
 #include "hev-fsh-io.h"
+#include "hev-fsh-mux.h"
+#include "hev-fsh-reader.h"
 #include "hev-fsh-protocol.h"
+#include "hev-fsh-handover.h"
+#include "hev-fsh-server-worker.h"
 #include "hev-fsh-session-manager.h"
 
 #ifdef __cplusplus
@@ -28,6 +31,7 @@ extern "C" {
 
 typedef struct _HevFshSession HevFshSession;
 typedef struct _HevFshSessionClass HevFshSessionClass;
+typedef struct _HevFshSessionQueued HevFshSessionQueued;
 
 struct _HevFshSession
 {
@@ -39,11 +43,30 @@ struct _HevFshSession
     unsigned char type;
     unsigned char is_mgr : 1;
     unsigned char is_temp_token : 1;
-
+    unsigned char is_pending : 1;
+    unsigned char is_pool : 1;
+    unsigned char is_idle : 1;
+    unsigned char is_klive : 1;
+
+    unsigned int hash;
+    unsigned short peer;
+    unsigned char queue_head;
+    unsigned char queue_used;
+    HevFshSessionQueued *queue;
+    unsigned char rbuf[sizeof (HevFshMessage) + sizeof (HevFshMessageToken)];
+    HevFshReader reader;
+    HevFshToken key;
     HevFshToken token;
+    HevFshMessage msg;
+    HevFshMessageToken mt;
     HevTaskMutex wlock;
-    HevRBTreeNode node;
+    HevFshTimer retry;
+
+    HevFshSession *next;
+    HevFshSession **pprev;
 
+    HevFshMux *mux;
+    HevFshServerWorker *worker;
     HevFshSessionManager *manager;
 };
 
@@ -56,10 +79,21 @@ HevObjectClass *hev_fsh_session_class (void);
 
 int hev_fsh_session_construct (HevFshSession *self, int fd,
                                unsigned int timeout,
-                               HevFshSessionManager *manager);
+                               HevFshServerWorker *worker);
 
 HevFshSession *hev_fsh_session_new (int fd, unsigned int timeout,
-                                    HevFshSessionManager *manager);
+                                    HevFshServerWorker *worker);
+
+HevFshSession *hev_fsh_session_adopt (HevFshServerWorker *worker,
+                                      HevFshHandoverSession *hs, int *fds,
+                                      unsigned int timeout);
+
+int hev_fsh_session_drain (HevFshSession *self);
+int hev_fsh_session_is_forwarder (HevFshSession *self);
+int hev_fsh_session_transfer (HevFshSession *self, HevFshHandoverSession *hs);
+
+void hev_fsh_session_set_message (HevFshSession *self, HevFshMessage *msg,
+                                  HevFshMessageToken *mt, unsigned int peer);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,384 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-snapshot.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh token snapshot
+ ============================================================================
+ */
+
+#include <time.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+
+#include "hev-fsh-snapshot.h"
+
+#define HEV_FSH_SNAPSHOT_MAGIC (0x53485346)
+#define HEV_FSH_SNAPSHOT_VERSION (2)
+#define HEV_FSH_SNAPSHOT_SLOTS (65536)
+#define HEV_FSH_SNAPSHOT_GRACE (10000)
+
+#define HEV_FSH_SNAPSHOT_USED (1 << 0)
+
+struct _HevFshSnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t size;
+    uint32_t run;
+    uint32_t reserved;
+};
+
+struct _HevFshSnapshotRecord
+{
+    HevFshToken token;
+    uint64_t last_seen;
+    uint32_t hash;
+    uint32_t flags;
+    uint32_t run;
+    uint32_t reserved;
+};
+
+static unsigned long long
+hev_fsh_snapshot_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static unsigned int
+hev_fsh_snapshot_hash (HevFshToken token)
+{
+    uint64_t a, b;
+
+    memcpy (&a, &token[0], sizeof (a));
+    memcpy (&b, &token[8], sizeof (b));
+
+    a ^= b * 0x9e3779b97f4a7c15ULL;
+    a ^= a >> 33;
+    a *= 0xff51afd7ed558ccdULL;
+    a ^= a >> 33;
+
+    return a;
+}
+
+static HevFshSnapshotRecord *
+hev_fsh_snapshot_find (HevFshSnapshot *self, HevFshToken token,
+                       unsigned int hash)
+{
+    unsigned int i;
+
+    for (i = hash & self->mask; self->records[i].flags;
+         i = (i + 1) & self->mask) {
+        HevFshSnapshotRecord *r = &self->records[i];
+
+        if (r->hash != hash)
+            continue;
+
+        if (memcmp (r->token, token, sizeof (HevFshToken)) == 0)
+            return r;
+    }
+
+    return NULL;
+}
+
+static HevFshSnapshotRecord *
+hev_fsh_snapshot_insert (HevFshSnapshot *self, HevFshToken token,
+                         unsigned int hash)
+{
+    HevFshSnapshotRecord *r;
+    unsigned int i;
+
+    if (((self->header->size + 1) * 4) > ((self->mask + 1) * 3))
+        return NULL;
+
+    for (i = hash & self->mask; self->records[i].flags;
+         i = (i + 1) & self->mask)
+        ;
+
+    r = &self->records[i];
+    memcpy (r->token, token, sizeof (HevFshToken));
+    r->hash = hash;
+    self->header->size++;
+
+    return r;
+}
+
+void
+hev_fsh_snapshot_put (HevFshSnapshot *self, HevFshToken token,
+                      unsigned int flags)
+{
+    unsigned int hash = hev_fsh_snapshot_hash (token);
+    HevFshSnapshotRecord *r;
+
+    pthread_mutex_lock (&self->lock);
+
+    r = hev_fsh_snapshot_find (self, token, hash);
+    if (!r)
+        r = hev_fsh_snapshot_insert (self, token, hash);
+
+    if (r) {
+        r->last_seen = time (NULL);
+        r->flags = HEV_FSH_SNAPSHOT_USED | flags;
+        r->run = self->header->run;
+    }
+
+    pthread_mutex_unlock (&self->lock);
+}
+
+void
+hev_fsh_snapshot_del (HevFshSnapshot *self, HevFshToken token)
+{
+    unsigned int hash = hev_fsh_snapshot_hash (token);
+    HevFshSnapshotRecord *r;
+    unsigned int i, j;
+
+    pthread_mutex_lock (&self->lock);
+
+    r = hev_fsh_snapshot_find (self, token, hash);
+    if (!r)
+        goto exit;
+
+    /* backward shift deletion, no tombstones */
+    i = r - self->records;
+    for (j = (i + 1) & self->mask; self->records[j].flags;
+         j = (j + 1) & self->mask) {
+        unsigned int k = self->records[j].hash & self->mask;
+
+        /* move slot j back unless its home lies cyclically in (i, j] */
+        if (((j - k) & self->mask) < ((j - i) & self->mask))
+            continue;
+
+        self->records[i] = self->records[j];
+        i = j;
+    }
+
+    __builtin_bzero (&self->records[i], sizeof (HevFshSnapshotRecord));
+    self->header->size--;
+
+exit:
+    pthread_mutex_unlock (&self->lock);
+}
+
+unsigned int
+hev_fsh_snapshot_hold (HevFshSnapshot *self, HevFshToken token)
+{
+    unsigned int hash = hev_fsh_snapshot_hash (token);
+    unsigned long long now;
+    HevFshSnapshotRecord *r;
+
+    if (!self->deadline)
+        return 0;
+
+    now = hev_fsh_snapshot_now ();
+    if (now >= self->deadline)
+        return 0;
+
+    pthread_mutex_lock (&self->lock);
+    r = hev_fsh_snapshot_find (self, token, hash);
+    pthread_mutex_unlock (&self->lock);
+
+    if (!r)
+        return 0;
+
+    return self->deadline - now;
+}
+
+static unsigned int
+hev_fsh_snapshot_load (HevFshSnapshot *self, unsigned int timeout)
+{
+    size_t size = sizeof (HevFshSnapshotRecord) * (self->mask + 1);
+    HevFshSnapshotRecord *records;
+    uint64_t newest = 0;
+    unsigned int i, n = 0;
+
+    records = hev_malloc (size);
+    if (records)
+        memcpy (records, self->records, size);
+
+    __builtin_bzero (self->records, size);
+    self->header->size = 0;
+
+    if (!records) {
+        self->header->run++;
+        return 0;
+    }
+
+    for (i = 0; i <= self->mask; i++) {
+        if (records[i].flags & HEV_FSH_SNAPSHOT_QUIET)
+            continue;
+        if (records[i].flags && (records[i].last_seen > newest))
+            newest = records[i].last_seen;
+    }
+
+    /* drop the silent, and the quiet not seen in the last run */
+    for (i = 0; i <= self->mask; i++) {
+        HevFshSnapshotRecord *o = &records[i];
+        unsigned int hash;
+        HevFshSnapshotRecord *r;
+
+        if (!o->flags)
+            continue;
+        if (!(o->flags & HEV_FSH_SNAPSHOT_QUIET) &&
+            ((o->last_seen + timeout) < newest))
+            continue;
+        if ((o->flags & HEV_FSH_SNAPSHOT_QUIET) &&
+            (o->run != self->header->run))
+            continue;
+
+        /* a crash in the middle of a deletion may leave one twice */
+        hash = hev_fsh_snapshot_hash (o->token);
+        if (hev_fsh_snapshot_find (self, o->token, hash))
+            continue;
+
+        r = hev_fsh_snapshot_insert (self, o->token, hash);
+        if (!r)
+            break;
+
+        r->last_seen = o->last_seen;
+        r->flags = o->flags;
+        r->run = o->run;
+        n++;
+    }
+
+    hev_free (records);
+    self->header->run++;
+
+    return n;
+}
+
+HevFshSnapshot *
+hev_fsh_snapshot_new (const char *path, unsigned int timeout)
+{
+    HevFshSnapshot *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevFshSnapshot));
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_snapshot_construct (self, path, timeout);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh snapshot new", self);
+
+    return self;
+}
+
+int
+hev_fsh_snapshot_construct (HevFshSnapshot *self, const char *path,
+                            unsigned int timeout)
+{
+    size_t size;
+    struct stat st;
+    unsigned int n;
+    void *map;
+    int res;
+    int fd;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh snapshot construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_SNAPSHOT_TYPE;
+
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -1;
+
+    size = sizeof (HevFshSnapshotHeader);
+    size += sizeof (HevFshSnapshotRecord) * HEV_FSH_SNAPSHOT_SLOTS;
+
+    /* allocated up front, a full disk can not fault a store to the map */
+    res = fstat (fd, &st);
+    if ((res == 0) && (st.st_size != size)) {
+        res = ftruncate (fd, 0);
+        if (res == 0)
+            res = posix_fallocate (fd, 0, size);
+    }
+    if (res != 0) {
+        close (fd);
+        return -1;
+    }
+
+    map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    self->header = map;
+    self->records = (HevFshSnapshotRecord *)(self->header + 1);
+    self->mask = HEV_FSH_SNAPSHOT_SLOTS - 1;
+    pthread_mutex_init (&self->lock, NULL);
+
+    if ((self->header->magic != HEV_FSH_SNAPSHOT_MAGIC) ||
+        (self->header->version != HEV_FSH_SNAPSHOT_VERSION) ||
+        (self->header->slots != HEV_FSH_SNAPSHOT_SLOTS)) {
+        __builtin_bzero (map, size);
+        self->header->magic = HEV_FSH_SNAPSHOT_MAGIC;
+        self->header->version = HEV_FSH_SNAPSHOT_VERSION;
+        self->header->slots = HEV_FSH_SNAPSHOT_SLOTS;
+        return 0;
+    }
+
+    n = hev_fsh_snapshot_load (self, timeout);
+    if (n) {
+        self->deadline = hev_fsh_snapshot_now () + HEV_FSH_SNAPSHOT_GRACE;
+        LOG_I ("fsh snapshot holds %u tokens for %u ms", n,
+               HEV_FSH_SNAPSHOT_GRACE);
+    }
+
+    return 0;
+}
+
+static void
+hev_fsh_snapshot_destruct (HevObject *base)
+{
+    HevFshSnapshot *self = HEV_FSH_SNAPSHOT (base);
+    size_t size;
+
+    LOG_D ("%p fsh snapshot destruct", self);
+
+    size = sizeof (HevFshSnapshotHeader);
+    size += sizeof (HevFshSnapshotRecord) * (self->mask + 1);
+
+    pthread_mutex_destroy (&self->lock);
+    munmap (self->header, size);
+
+    HEV_OBJECT_TYPE->finalizer (base);
+    hev_free (self);
+}
+
+HevObjectClass *
+hev_fsh_snapshot_class (void)
+{
+    static HevFshSnapshotClass klass;
+    HevFshSnapshotClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevFshSnapshot";
+        okptr->finalizer = hev_fsh_snapshot_destruct;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,73 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-snapshot.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh token snapshot
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_SNAPSHOT_H__
+#define __HEV_FSH_SNAPSHOT_H__
+
+#include <pthread.h>
+
+#include "hev-object.h"
+#include "hev-fsh-protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_SNAPSHOT(p) ((HevFshSnapshot *)p)
+#define HEV_FSH_SNAPSHOT_CLASS(p) ((HevFshSnapshotClass *)p)
+#define HEV_FSH_SNAPSHOT_TYPE (hev_fsh_snapshot_class ())
+
+#define HEV_FSH_SNAPSHOT_TEMP (1 << 1)
+#define HEV_FSH_SNAPSHOT_QUIET (1 << 2)
+
+typedef struct _HevFshSnapshot HevFshSnapshot;
+typedef struct _HevFshSnapshotClass HevFshSnapshotClass;
+typedef struct _HevFshSnapshotHeader HevFshSnapshotHeader;
+typedef struct _HevFshSnapshotRecord HevFshSnapshotRecord;
+
+/*
+ * The forwarders held, kept in a shared file mapping: the page cache
+ * outlives a crashed process, so the next one knows which forwarders
+ * are about to come back and holds their connectors for a while.
+ */
+struct _HevFshSnapshot
+{
+    HevObject base;
+
+    unsigned int mask;
+    unsigned long long deadline;
+
+    pthread_mutex_t lock;
+    HevFshSnapshotHeader *header;
+    HevFshSnapshotRecord *records;
+};
+
+struct _HevFshSnapshotClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_fsh_snapshot_class (void);
+
+int hev_fsh_snapshot_construct (HevFshSnapshot *self, const char *path,
+                                unsigned int timeout);
+
+HevFshSnapshot *hev_fsh_snapshot_new (const char *path, unsigned int timeout);
+
+void hev_fsh_snapshot_put (HevFshSnapshot *self, HevFshToken token,
+                           unsigned int flags);
+void hev_fsh_snapshot_del (HevFshSnapshot *self, HevFshToken token);
+
+unsigned int hev_fsh_snapshot_hold (HevFshSnapshot *self, HevFshToken token);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_SNAPSHOT_H__ */
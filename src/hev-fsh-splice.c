@@ -0,0 +1,615 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-splice.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh splice
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-uring.h"
+
+#include "hev-fsh-splice.h"
+
+#define HEV_FSH_SPLICE_POOL_SIZE (32)
+#define HEV_FSH_SPLICE_COPY_SIZE (8192)
+#define HEV_FSH_SPLICE_CHUNK_MIN (4096)
+#define HEV_FSH_SPLICE_CHUNK_MAX (1048576)
+#define HEV_FSH_SPLICE_BULK_CHUNK (262144)
+#define HEV_FSH_SPLICE_GROW_FULLS (2)
+#define HEV_FSH_SPLICE_SHRINK_SMALLS (8)
+#define HEV_FSH_SPLICE_FLUSH_TRIES (50)
+#define HEV_FSH_SPLICE_FLUSH_WAIT (20)
+
+#ifdef __linux__
+
+typedef struct _HevFshSplicePipe HevFshSplicePipe;
+typedef struct _HevFshSplicePool HevFshSplicePool;
+typedef struct _HevFshSplicer HevFshSplicer;
+typedef struct _HevFshSpliceStats HevFshSpliceStats;
+typedef struct _HevFshUringSplicer HevFshUringSplicer;
+
+struct _HevFshSplicePipe
+{
+    int fds[2];
+    unsigned int cap;
+};
+
+struct _HevFshSplicePool
+{
+    unsigned int count;
+    HevFshSplicePipe pipes[HEV_FSH_SPLICE_POOL_SIZE];
+};
+
+struct _HevFshSplicer
+{
+    HevFshSplicePipe pipe;
+    unsigned int size;
+
+    unsigned int chunk;
+    unsigned int chunk_max;
+    unsigned int fulls;
+    unsigned int smalls;
+
+    unsigned long long bytes;
+    unsigned long long calls;
+
+    /* fd_in can't be spliced from (a tty on older kernels), copy it */
+    unsigned int off;
+    unsigned int len;
+    char *buf;
+};
+
+struct _HevFshUringSplicer
+{
+    HevFshUringOp in;
+    HevFshUringOp out;
+
+    unsigned int off;
+    unsigned int len;
+    unsigned char is_eof;
+    unsigned char is_err;
+    unsigned char is_in_sock;
+    unsigned char is_out_sock;
+
+    unsigned long long bytes;
+    unsigned long long calls;
+    char *buf;
+};
+
+struct _HevFshSpliceStats
+{
+    unsigned long long bytes;
+    unsigned long long calls;
+    unsigned long bulks;
+    unsigned long interactives;
+};
+
+static const char *names[HEV_FSH_SPLICE_TYPE_MAX] = {
+    "term",
+    "bulk",
+};
+
+static const unsigned int pipe_sizes[HEV_FSH_SPLICE_TYPE_MAX] = {
+    16384,
+    262144,
+};
+
+static const unsigned int chunk_sizes[HEV_FSH_SPLICE_TYPE_MAX] = {
+    4096,
+    65536,
+};
+
+static HevFshSpliceStats stats[HEV_FSH_SPLICE_TYPE_MAX];
+static __thread HevFshSplicePool pools[HEV_FSH_SPLICE_TYPE_MAX];
+
+static int
+hev_fsh_splice_pipe_get (HevFshSpliceType type, HevFshSplicePipe *pipe)
+{
+    HevFshSplicePool *pool = &pools[type];
+    int cap;
+
+    if (pool->count) {
+        *pipe = pool->pipes[--pool->count];
+        return 0;
+    }
+
+    if (pipe2 (pipe->fds, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+
+    fcntl (pipe->fds[1], F_SETPIPE_SZ, pipe_sizes[type]);
+    cap = fcntl (pipe->fds[1], F_GETPIPE_SZ);
+    pipe->cap = (cap > 0) ? cap : 4096;
+
+    return 0;
+}
+
+static void
+hev_fsh_splice_pipe_put (HevFshSpliceType type, HevFshSplicePipe *pipe,
+                         unsigned int size)
+{
+    HevFshSplicePool *pool = &pools[type];
+
+    if (size || (pool->count == HEV_FSH_SPLICE_POOL_SIZE)) {
+        close (pipe->fds[0]);
+        close (pipe->fds[1]);
+        return;
+    }
+
+    pool->pipes[pool->count++] = *pipe;
+}
+
+static void
+hev_fsh_splice_adapt (HevFshSplicer *self, ssize_t s)
+{
+    if (s == self->chunk) {
+        self->smalls = 0;
+        if ((++self->fulls < HEV_FSH_SPLICE_GROW_FULLS) ||
+            (self->chunk == HEV_FSH_SPLICE_CHUNK_MAX))
+            return;
+
+        self->fulls = 0;
+        self->chunk <<= 1;
+        if (self->chunk > self->chunk_max)
+            self->chunk_max = self->chunk;
+
+        if (self->chunk > self->pipe.cap) {
+            int cap;
+
+            fcntl (self->pipe.fds[1], F_SETPIPE_SZ, self->chunk);
+            cap = fcntl (self->pipe.fds[1], F_GETPIPE_SZ);
+            if (cap > 0)
+                self->pipe.cap = cap;
+            if (self->chunk > self->pipe.cap)
+                self->chunk = self->pipe.cap;
+        }
+    } else if (s < (self->chunk >> 3)) {
+        self->fulls = 0;
+        if ((++self->smalls < HEV_FSH_SPLICE_SHRINK_SMALLS) ||
+            (self->chunk == HEV_FSH_SPLICE_CHUNK_MIN))
+            return;
+
+        self->smalls = 0;
+        self->chunk >>= 1;
+    }
+}
+
+static int
+hev_fsh_splice_copy (HevFshSplicer *self, int fd_in, int fd_out)
+{
+    int res = 1;
+
+    if (!self->len) {
+        ssize_t s = read (fd_in, self->buf, HEV_FSH_SPLICE_COPY_SIZE);
+        if (0 >= s) {
+            if ((0 > s) && (EAGAIN == errno))
+                res = 0;
+            else
+                res = -1;
+        } else {
+            self->off = 0;
+            self->len = s;
+        }
+    }
+
+    if (self->len) {
+        ssize_t s = write (fd_out, self->buf + self->off, self->len);
+        if (0 >= s) {
+            if ((0 > s) && (EAGAIN == errno))
+                res = 0;
+            else
+                res = -1;
+        } else {
+            res = 1;
+            self->off += s;
+            self->len -= s;
+        }
+    }
+
+    return res;
+}
+
+static int
+hev_fsh_splice_step (HevFshSplicer *self, int fd_in, int fd_out)
+{
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    int res = 1;
+
+    if (self->buf)
+        return hev_fsh_splice_copy (self, fd_in, fd_out);
+
+    if (self->size < self->chunk) {
+        ssize_t s = splice (fd_in, NULL, self->pipe.fds[1], NULL,
+                            self->chunk - self->size, flags);
+        self->calls++;
+        if (0 >= s) {
+            if ((0 > s) && (EINVAL == errno) && !self->size) {
+                self->buf = hev_malloc (HEV_FSH_SPLICE_COPY_SIZE);
+                if (!self->buf)
+                    return -1;
+                return hev_fsh_splice_copy (self, fd_in, fd_out);
+            }
+            if ((0 > s) && (EAGAIN == errno))
+                res = 0;
+            else
+                res = -1;
+        } else {
+            if (!self->size)
+                hev_fsh_splice_adapt (self, s);
+            self->size += s;
+            self->bytes += s;
+        }
+    }
+
+    if (self->size) {
+        ssize_t s = splice (self->pipe.fds[0], NULL, fd_out, NULL, self->size,
+                            flags);
+        self->calls++;
+        if (0 >= s) {
+            if ((0 > s) && (EAGAIN == errno))
+                res = 0;
+            else
+                res = -1;
+        } else {
+            res = 1;
+            self->size -= s;
+        }
+    }
+
+    return res;
+}
+
+static int
+hev_fsh_splice_flush (HevFshSplicer *self, int fd_out)
+{
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    int i;
+
+    for (i = 0; i < HEV_FSH_SPLICE_FLUSH_TRIES;) {
+        ssize_t s;
+
+        if (self->buf) {
+            if (!self->len)
+                return 0;
+            s = write (fd_out, self->buf + self->off, self->len);
+        } else {
+            if (!self->size)
+                return 0;
+            s = splice (self->pipe.fds[0], NULL, fd_out, NULL, self->size,
+                        flags);
+        }
+
+        if (0 >= s) {
+            if ((0 > s) && (EAGAIN == errno)) {
+                hev_task_sleep (HEV_FSH_SPLICE_FLUSH_WAIT);
+                i++;
+                continue;
+            }
+            return -1;
+        }
+
+        if (self->buf) {
+            self->off += s;
+            self->len -= s;
+        } else {
+            self->size -= s;
+        }
+    }
+
+    return -1;
+}
+
+static void
+hev_fsh_splice_init (HevFshSplicer *self, HevFshSpliceType type)
+{
+    self->chunk = chunk_sizes[type];
+    if (self->chunk > self->pipe.cap)
+        self->chunk = self->pipe.cap;
+    self->chunk_max = self->chunk;
+}
+
+static void
+hev_fsh_splice_fini (HevFshSplicer *self, HevFshSpliceType type,
+                     const char *dir, void *data)
+{
+    HevFshSpliceStats *st = &stats[type];
+    const char *regime = "interactive";
+
+    if (self->buf)
+        hev_free (self->buf);
+    hev_fsh_splice_pipe_put (type, &self->pipe, self->size);
+
+    __atomic_fetch_add (&st->bytes, self->bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&st->calls, self->calls, __ATOMIC_RELAXED);
+    if (self->chunk_max >= HEV_FSH_SPLICE_BULK_CHUNK) {
+        __atomic_fetch_add (&st->bulks, 1, __ATOMIC_RELAXED);
+        regime = "bulk";
+    } else {
+        __atomic_fetch_add (&st->interactives, 1, __ATOMIC_RELAXED);
+    }
+
+    LOG_D ("%p fsh splice %s %s bytes %llu calls %llu chunk %u/%u", data, dir,
+           regime, self->bytes, self->calls, self->chunk, self->chunk_max);
+}
+
+static int
+hev_fsh_splice_is_sock (int fd)
+{
+    struct stat st;
+
+    if (fstat (fd, &st) < 0)
+        return 0;
+
+    return S_ISSOCK (st.st_mode);
+}
+
+static int
+hev_fsh_splice_uring_step (HevFshUringSplicer *self, HevFshUring *uring,
+                           unsigned int size, int fd_in, int fd_out)
+{
+    int res = 0;
+
+    if (self->in.is_done) {
+        self->in.is_done = 0;
+        if (self->in.res == -EAGAIN) {
+            /* woken spuriously, issued again below */
+        } else if (self->in.res > 0) {
+            self->off = 0;
+            self->len = self->in.res;
+            self->bytes += self->in.res;
+            res = 1;
+        } else {
+            self->is_eof = 1;
+        }
+    }
+
+    if (self->out.is_done) {
+        self->out.is_done = 0;
+        if (self->out.res == -EAGAIN) {
+            /* woken spuriously, issued again below */
+        } else if (self->out.res > 0) {
+            self->off += self->out.res;
+            self->len -= self->out.res;
+            res = 1;
+        } else {
+            self->is_err = 1;
+        }
+    }
+
+    if (self->is_err || (self->is_eof && !self->len))
+        return -1;
+
+    if (!self->len && !self->is_eof && !self->in.is_busy) {
+        char *buf = self->buf;
+        int res;
+
+        if (self->is_in_sock)
+            res = hev_fsh_uring_recv (uring, &self->in, fd_in, buf, size);
+        else
+            res = hev_fsh_uring_read (uring, &self->in, fd_in, buf, size);
+        if (res < 0)
+            return -1;
+        self->calls++;
+    }
+    if (self->len && !self->out.is_busy) {
+        char *buf = self->buf + self->off;
+        int res;
+
+        if (self->is_out_sock)
+            res = hev_fsh_uring_send (uring, &self->out, fd_out, buf,
+                                      self->len);
+        else
+            res = hev_fsh_uring_write (uring, &self->out, fd_out, buf,
+                                       self->len);
+        if (res < 0)
+            return -1;
+        self->calls++;
+    }
+
+    return res;
+}
+
+static void
+hev_fsh_splice_uring_fini (HevFshUringSplicer *self, HevFshUring *uring,
+                           HevFshSpliceType type, const char *dir, void *data)
+{
+    HevFshSpliceStats *st = &stats[type];
+
+    /* the kernel owns the buffer until the cancelled ops complete */
+    while ((hev_fsh_uring_cancel (uring, &self->in) < 0) ||
+           (hev_fsh_uring_cancel (uring, &self->out) < 0))
+        hev_task_yield (HEV_TASK_YIELD);
+    while (self->in.is_busy || self->out.is_busy)
+        hev_task_yield (HEV_TASK_WAITIO);
+
+    __atomic_fetch_add (&st->bytes, self->bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&st->calls, self->calls, __ATOMIC_RELAXED);
+
+    LOG_D ("%p fsh splice %s uring bytes %llu calls %llu", data, dir,
+           self->bytes, self->calls);
+}
+
+static int
+hev_fsh_splice_uring (HevFshSpliceType type, int fd_a_i, int fd_a_o,
+                      int fd_b_i, int fd_b_o, HevTaskIOYielder yielder,
+                      void *yielder_data)
+{
+    HevFshUringSplicer splicer_f = { 0 };
+    HevFshUringSplicer splicer_b = { 0 };
+    unsigned int size = pipe_sizes[type];
+    HevFshUring *uring;
+    int res_f = 1;
+    int res_b = 1;
+
+    uring = hev_fsh_uring_get ();
+    if (!uring)
+        return -1;
+
+    splicer_f.is_in_sock = hev_fsh_splice_is_sock (fd_a_i);
+    splicer_f.is_out_sock = hev_fsh_splice_is_sock (fd_b_o);
+    splicer_b.is_in_sock = hev_fsh_splice_is_sock (fd_b_i);
+    splicer_b.is_out_sock = hev_fsh_splice_is_sock (fd_a_o);
+
+    splicer_f.buf = hev_malloc (size);
+    if (!splicer_f.buf)
+        return -1;
+    splicer_b.buf = hev_malloc (size);
+    if (!splicer_b.buf) {
+        hev_free (splicer_f.buf);
+        return -1;
+    }
+
+    for (;;) {
+        HevTaskYieldType yield;
+
+        if (res_f >= 0)
+            res_f = hev_fsh_splice_uring_step (&splicer_f, uring, size, fd_a_i,
+                                               fd_b_o);
+        if (res_b >= 0)
+            res_b = hev_fsh_splice_uring_step (&splicer_b, uring, size, fd_b_i,
+                                               fd_a_o);
+
+        if (fd_a_i == fd_a_o || fd_b_i == fd_b_o) {
+            if (res_f < 0 || res_b < 0)
+                break;
+        } else {
+            if (res_f < 0 && res_b < 0)
+                break;
+        }
+        if (res_f > 0 || res_b > 0)
+            yield = HEV_TASK_YIELD;
+        else
+            yield = HEV_TASK_WAITIO;
+
+        if (yielder) {
+            if (yielder (yield, yielder_data))
+                break;
+        } else {
+            hev_task_yield (yield);
+        }
+    }
+
+    hev_fsh_splice_uring_fini (&splicer_b, uring, type, "b", yielder_data);
+    hev_fsh_splice_uring_fini (&splicer_f, uring, type, "f", yielder_data);
+    hev_free (splicer_b.buf);
+    hev_free (splicer_f.buf);
+
+    return 0;
+}
+
+int
+hev_fsh_splice (HevFshSpliceType type, int fd_a_i, int fd_a_o, int fd_b_i,
+                int fd_b_o, HevTaskIOYielder yielder, void *yielder_data)
+{
+    HevFshSplicer splicer_f = { 0 };
+    HevFshSplicer splicer_b = { 0 };
+    int is_stopped = 0;
+    int res_f = 1;
+    int res_b = 1;
+    int res = 0;
+
+    if (hev_fsh_splice_uring (type, fd_a_i, fd_a_o, fd_b_i, fd_b_o, yielder,
+                              yielder_data) == 0)
+        return 0;
+
+    if (hev_fsh_splice_pipe_get (type, &splicer_f.pipe) < 0)
+        goto fallback;
+    if (hev_fsh_splice_pipe_get (type, &splicer_b.pipe) < 0) {
+        hev_fsh_splice_pipe_put (type, &splicer_f.pipe, 0);
+        goto fallback;
+    }
+
+    hev_fsh_splice_init (&splicer_f, type);
+    hev_fsh_splice_init (&splicer_b, type);
+
+    for (;;) {
+        HevTaskYieldType yield;
+
+        if (res_f >= 0)
+            res_f = hev_fsh_splice_step (&splicer_f, fd_a_i, fd_b_o);
+        if (res_b >= 0)
+            res_b = hev_fsh_splice_step (&splicer_b, fd_b_i, fd_a_o);
+
+        if (fd_a_i == fd_a_o || fd_b_i == fd_b_o) {
+            if (res_f < 0 || res_b < 0)
+                break;
+        } else {
+            if (res_f < 0 && res_b < 0)
+                break;
+        }
+        if (res_f > 0 || res_b > 0)
+            yield = HEV_TASK_YIELD;
+        else
+            yield = HEV_TASK_WAITIO;
+
+        if (yielder) {
+            if (yielder (yield, yielder_data)) {
+                is_stopped = 1;
+                break;
+            }
+        } else {
+            hev_task_yield (yield);
+        }
+    }
+
+    /* bytes held in the pipes would be lost with the fds, deliver them */
+    if (is_stopped && (res_f >= 0) && (res_b >= 0) &&
+        (hev_fsh_splice_flush (&splicer_f, fd_b_o) == 0) &&
+        (hev_fsh_splice_flush (&splicer_b, fd_a_o) == 0))
+        res = 1;
+
+    hev_fsh_splice_fini (&splicer_b, type, "b", yielder_data);
+    hev_fsh_splice_fini (&splicer_f, type, "f", yielder_data);
+    return res;
+
+fallback:
+    LOG_D ("fsh splice pipe failed");
+    hev_task_io_splice (fd_a_i, fd_a_o, fd_b_i, fd_b_o, 8192, yielder,
+                        yielder_data);
+    return 0;
+}
+
+void
+hev_fsh_splice_report (void)
+{
+    int i;
+
+    for (i = 0; i < HEV_FSH_SPLICE_TYPE_MAX; i++) {
+        HevFshSpliceStats *st = &stats[i];
+
+        if (!st->calls)
+            continue;
+
+        LOG_I ("fsh splice %s bytes %llu calls %llu bulk %lu interactive %lu",
+               names[i], st->bytes, st->calls, st->bulks, st->interactives);
+    }
+}
+
+#else /* __linux__ */
+
+int
+hev_fsh_splice (HevFshSpliceType type, int fd_a_i, int fd_a_o, int fd_b_i,
+                int fd_b_o, HevTaskIOYielder yielder, void *yielder_data)
+{
+    hev_task_io_splice (fd_a_i, fd_a_o, fd_b_i, fd_b_o, 8192, yielder,
+                        yielder_data);
+    return 0;
+}
+
+void
+hev_fsh_splice_report (void)
+{
+}
+
+#endif /* !__linux__ */
@@ -0,0 +1,41 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-splice.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh splice
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_SPLICE_H__
+#define __HEV_FSH_SPLICE_H__
+
+#include <hev-task-io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _HevFshSpliceType HevFshSpliceType;
+
+enum _HevFshSpliceType
+{
+    HEV_FSH_SPLICE_TERM = 0,
+    HEV_FSH_SPLICE_BULK,
+    HEV_FSH_SPLICE_TYPE_MAX,
+};
+
+/*
+ * Returns 1 when the yielder stopped a relay with every byte it took in
+ * written out, the fds can be handed on mid-stream; 0 otherwise.
+ */
+int hev_fsh_splice (HevFshSpliceType type, int fd_a_i, int fd_a_o, int fd_b_i,
+                    int fd_b_o, HevTaskIOYielder yielder, void *yielder_data);
+
+void hev_fsh_splice_report (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_SPLICE_H__ */
@@ -0,0 +1,316 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-tarpit.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh tarpit
+ ============================================================================
+ */
+
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-task.h"
+
+#include "hev-fsh-tarpit.h"
+
+#define HEV_FSH_TARPIT_SIZE (4096)
+#define HEV_FSH_TARPIT_SOURCES (1024)
+#define HEV_FSH_TARPIT_DELAY (1500)
+#define HEV_FSH_TARPIT_MAX_SHIFT (3)
+#define HEV_FSH_TARPIT_WINDOW (60000)
+#define HEV_FSH_TARPIT_LIMIT (32)
+
+struct _HevFshTarpitEntry
+{
+    unsigned long long deadline;
+    int fd;
+};
+
+typedef struct _HevFshTarpitSource HevFshTarpitSource;
+
+struct _HevFshTarpitSource
+{
+    unsigned char addr[16];
+    unsigned int count;
+    unsigned long long time;
+};
+
+static HevFshTarpitSource sources[HEV_FSH_TARPIT_SOURCES];
+static pthread_mutex_t sources_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long
+hev_fsh_tarpit_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static HevFshTarpitSource *
+hev_fsh_tarpit_source (struct sockaddr *sa, unsigned long long now)
+{
+    HevFshTarpitSource *s;
+    unsigned char addr[16];
+    unsigned int hash = 2166136261U;
+    int i;
+
+    switch (sa->sa_family) {
+    case AF_INET: {
+        struct sockaddr_in *sa4 = (struct sockaddr_in *)sa;
+
+        __builtin_bzero (addr, 10);
+        addr[10] = 0xff;
+        addr[11] = 0xff;
+        memcpy (&addr[12], &sa4->sin_addr, 4);
+        break;
+    }
+    case AF_INET6: {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)sa;
+
+        memcpy (addr, &sa6->sin6_addr, 16);
+        break;
+    }
+    default:
+        return NULL;
+    }
+
+    for (i = 0; i < 16; i++)
+        hash = (hash ^ addr[i]) * 16777619U;
+
+    /* shared by the workers, a token routes a probe away from its source */
+    s = &sources[hash & (HEV_FSH_TARPIT_SOURCES - 1)];
+    if (memcmp (s->addr, addr, 16) != 0 ||
+        (now - s->time) > HEV_FSH_TARPIT_WINDOW) {
+        memcpy (s->addr, addr, 16);
+        s->count = 0;
+    }
+
+    return s;
+}
+
+static void
+hev_fsh_tarpit_push (HevFshTarpit *self, unsigned long long deadline, int fd)
+{
+    HevFshTarpitEntry *heap = self->heap;
+    unsigned int i = self->size++;
+
+    while (i) {
+        unsigned int p = (i - 1) / 2;
+
+        if (heap[p].deadline <= deadline)
+            break;
+
+        heap[i] = heap[p];
+        i = p;
+    }
+
+    heap[i].deadline = deadline;
+    heap[i].fd = fd;
+}
+
+static void
+hev_fsh_tarpit_pop (HevFshTarpit *self)
+{
+    HevFshTarpitEntry *heap = self->heap;
+    HevFshTarpitEntry last = heap[--self->size];
+    unsigned int i = 0;
+
+    for (;;) {
+        unsigned int c = i * 2 + 1;
+
+        if (c >= self->size)
+            break;
+
+        if (((c + 1) < self->size) && (heap[c + 1].deadline < heap[c].deadline))
+            c++;
+
+        if (last.deadline <= heap[c].deadline)
+            break;
+
+        heap[i] = heap[c];
+        i = c;
+    }
+
+    heap[i] = last;
+}
+
+int
+hev_fsh_tarpit_check (HevFshTarpit *self, struct sockaddr *addr)
+{
+    unsigned long long now = hev_fsh_tarpit_now ();
+    HevFshTarpitSource *s;
+    int res = 0;
+
+    pthread_mutex_lock (&sources_lock);
+    s = hev_fsh_tarpit_source (addr, now);
+    if (s && (s->count >= HEV_FSH_TARPIT_LIMIT)) {
+        s->time = now;
+        res = -1;
+    }
+    pthread_mutex_unlock (&sources_lock);
+
+    return res;
+}
+
+void
+hev_fsh_tarpit_add (HevFshTarpit *self, int fd, struct sockaddr *addr)
+{
+    unsigned long long now = hev_fsh_tarpit_now ();
+    unsigned int delay = HEV_FSH_TARPIT_DELAY;
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof (ss);
+    int res = 0;
+
+    if (!addr) {
+        addr = (struct sockaddr *)&ss;
+        res = getpeername (fd, addr, &len);
+    }
+    if (res >= 0) {
+        HevFshTarpitSource *s;
+
+        pthread_mutex_lock (&sources_lock);
+        s = hev_fsh_tarpit_source (addr, now);
+        if (s) {
+            unsigned int shift = s->count++;
+
+            if (shift > HEV_FSH_TARPIT_MAX_SHIFT)
+                shift = HEV_FSH_TARPIT_MAX_SHIFT;
+            delay <<= shift;
+            s->time = now;
+        }
+        pthread_mutex_unlock (&sources_lock);
+    }
+
+    LOG_D ("%p fsh tarpit add %d %u", self, fd, delay);
+
+    if (self->size == HEV_FSH_TARPIT_SIZE) {
+        close (fd);
+        return;
+    }
+
+    hev_fsh_tarpit_push (self, now + delay, fd);
+    if (self->heap[0].fd == fd)
+        hev_task_wakeup (self->task);
+}
+
+static void
+hev_fsh_tarpit_task_entry (void *data)
+{
+    HevFshTarpit *self = data;
+
+    for (;;) {
+        unsigned long long now = hev_fsh_tarpit_now ();
+
+        while (self->size && (self->heap[0].deadline <= now)) {
+            close (self->heap[0].fd);
+            hev_fsh_tarpit_pop (self);
+        }
+
+        if (self->size)
+            hev_task_sleep (self->heap[0].deadline - now);
+        else
+            hev_task_yield (HEV_TASK_WAITIO);
+    }
+}
+
+int
+hev_fsh_tarpit_run (HevFshTarpit *self)
+{
+    LOG_D ("%p fsh tarpit run", self);
+
+    self->task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->task)
+        return -1;
+
+    hev_task_ref (self->task);
+    hev_fsh_task_run (self->task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_tarpit_task_entry, self);
+
+    return 0;
+}
+
+HevFshTarpit *
+hev_fsh_tarpit_new (void)
+{
+    HevFshTarpit *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevFshTarpit));
+    if (!self)
+        return NULL;
+
+    res = hev_fsh_tarpit_construct (self);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p fsh tarpit new", self);
+
+    return self;
+}
+
+int
+hev_fsh_tarpit_construct (HevFshTarpit *self)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return res;
+
+    LOG_D ("%p fsh tarpit construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_FSH_TARPIT_TYPE;
+
+    self->heap = hev_malloc (HEV_FSH_TARPIT_SIZE * sizeof (HevFshTarpitEntry));
+    if (!self->heap)
+        return -1;
+
+    return 0;
+}
+
+static void
+hev_fsh_tarpit_destruct (HevObject *base)
+{
+    HevFshTarpit *self = HEV_FSH_TARPIT (base);
+    unsigned int i;
+
+    LOG_D ("%p fsh tarpit destruct", self);
+
+    for (i = 0; i < self->size; i++)
+        close (self->heap[i].fd);
+    if (self->task)
+        hev_task_unref (self->task);
+    hev_free (self->heap);
+
+    HEV_OBJECT_TYPE->finalizer (base);
+    hev_free (self);
+}
+
+HevObjectClass *
+hev_fsh_tarpit_class (void)
+{
+    static HevFshTarpitClass klass;
+    HevFshTarpitClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevFshTarpit";
+        okptr->finalizer = hev_fsh_tarpit_destruct;
+    }
+
+    return okptr;
+}
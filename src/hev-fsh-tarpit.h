@@ -0,0 +1,62 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-tarpit.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh tarpit
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_TARPIT_H__
+#define __HEV_FSH_TARPIT_H__
+
+#include <sys/socket.h>
+
+#include <hev-task.h>
+
+#include "hev-object.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_TARPIT(p) ((HevFshTarpit *)p)
+#define HEV_FSH_TARPIT_CLASS(p) ((HevFshTarpitClass *)p)
+#define HEV_FSH_TARPIT_TYPE (hev_fsh_tarpit_class ())
+
+typedef struct _HevFshTarpit HevFshTarpit;
+typedef struct _HevFshTarpitClass HevFshTarpitClass;
+typedef struct _HevFshTarpitEntry HevFshTarpitEntry;
+
+struct _HevFshTarpit
+{
+    HevObject base;
+
+    unsigned int size;
+    HevFshTarpitEntry *heap;
+
+    HevTask *task;
+};
+
+struct _HevFshTarpitClass
+{
+    HevObjectClass base;
+};
+
+HevObjectClass *hev_fsh_tarpit_class (void);
+
+int hev_fsh_tarpit_construct (HevFshTarpit *self);
+
+HevFshTarpit *hev_fsh_tarpit_new (void);
+
+int hev_fsh_tarpit_run (HevFshTarpit *self);
+
+int hev_fsh_tarpit_check (HevFshTarpit *self, struct sockaddr *addr);
+
+void hev_fsh_tarpit_add (HevFshTarpit *self, int fd, struct sockaddr *addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_TARPIT_H__ */
@@ -0,0 +1,216 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-task.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh task
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-config.h"
+
+#include "hev-fsh-task.h"
+
+#define HEV_FSH_TASK_STACK_MIN (4096)
+#define HEV_FSH_TASK_STACK_PAINT ((unsigned long)0x5aa5a55a5aa5a55aULL)
+#define HEV_FSH_TASK_STACK_FLOOR (1024)
+#define HEV_FSH_TASK_STACK_SLACK (512)
+#define HEV_FSH_TASK_POOL_SIZE (64)
+
+typedef struct _HevFshTaskProbe HevFshTaskProbe;
+typedef struct _HevFshTaskPool HevFshTaskPool;
+
+struct _HevFshTaskProbe
+{
+    HevTaskEntry entry;
+    void *data;
+    HevFshTaskRole role;
+};
+
+struct _HevFshTaskPool
+{
+    unsigned int count;
+    HevTask *tasks[HEV_FSH_TASK_POOL_SIZE];
+};
+
+static const char *names[HEV_FSH_TASK_ROLE_MAX] = {
+    "service", "session", "stream", "forward", "port",
+    "sock",    "term",    "connect", "listen",
+};
+
+static unsigned int sizes[HEV_FSH_TASK_ROLE_MAX] = {
+    [0 ... HEV_FSH_TASK_ROLE_MAX - 1] = HEV_FSH_CONFIG_TASK_STACK_SIZE,
+};
+
+static unsigned int marks[HEV_FSH_TASK_ROLE_MAX];
+static unsigned long nr_news[HEV_FSH_TASK_ROLE_MAX];
+static unsigned long nr_hits[HEV_FSH_TASK_ROLE_MAX];
+static int profile;
+
+static __thread HevFshTaskPool pools[HEV_FSH_TASK_ROLE_MAX];
+
+HevTask *
+hev_fsh_task_new (HevFshTaskRole role)
+{
+    HevFshTaskPool *pool = &pools[role];
+    int i;
+
+    __atomic_fetch_add (&nr_news[role], 1, __ATOMIC_RELAXED);
+
+    for (i = pool->count - 1; i >= 0; i--) {
+        HevTask *task = pool->tasks[i];
+
+        if (hev_task_get_state (task) != HEV_TASK_STOPPED)
+            continue;
+
+        pool->tasks[i] = pool->tasks[--pool->count];
+        __atomic_fetch_add (&nr_hits[role], 1, __ATOMIC_RELAXED);
+        return task;
+    }
+
+    return hev_task_new (sizes[role]);
+}
+
+void
+hev_fsh_task_put (HevTask *task, HevFshTaskRole role)
+{
+    HevFshTaskPool *pool = &pools[role];
+
+    if (pool->count == HEV_FSH_TASK_POOL_SIZE) {
+        hev_task_unref (task);
+        return;
+    }
+
+    pool->tasks[pool->count++] = task;
+}
+
+static __attribute__ ((noinline)) volatile unsigned long *
+hev_fsh_task_paint (char *top, unsigned int size)
+{
+    volatile unsigned long *bottom;
+    volatile unsigned long *p;
+
+    /* leave our own frame and the runtime's words at the far end alone */
+    bottom = (void *)(top - size + HEV_FSH_TASK_STACK_FLOOR);
+    p = (void *)((char *)__builtin_frame_address (0) -
+                 HEV_FSH_TASK_STACK_SLACK);
+
+    while (p > bottom)
+        *--p = HEV_FSH_TASK_STACK_PAINT;
+
+    return bottom;
+}
+
+static void
+hev_fsh_task_mark (HevFshTaskRole role, char *top,
+                   volatile unsigned long *bottom)
+{
+    unsigned int size = sizes[role];
+    unsigned int used;
+    unsigned int mark;
+
+    while (*bottom == HEV_FSH_TASK_STACK_PAINT)
+        bottom++;
+
+    used = top - (char *)bottom;
+    if (used >= (size - HEV_FSH_TASK_STACK_FLOOR))
+        used = size;
+
+    mark = __atomic_load_n (&marks[role], __ATOMIC_RELAXED);
+    do {
+        if (used <= mark)
+            return;
+    } while (!__atomic_compare_exchange_n (&marks[role], &mark, used, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    LOG_I ("task %s stack high-water %u/%u", names[role], used, size);
+}
+
+static void
+hev_fsh_task_probe_entry (void *data)
+{
+    HevFshTaskProbe probe = *(HevFshTaskProbe *)data;
+    volatile unsigned long *bottom;
+    char *top;
+
+    hev_free (data);
+
+    top = __builtin_frame_address (0);
+    bottom = hev_fsh_task_paint (top, sizes[probe.role]);
+
+    probe.entry (probe.data);
+
+    hev_fsh_task_mark (probe.role, top, bottom);
+}
+
+int
+hev_fsh_task_run (HevTask *task, HevFshTaskRole role, HevTaskEntry entry,
+                  void *data)
+{
+    HevFshTaskProbe *probe;
+
+    if (!profile)
+        return hev_task_run (task, entry, data);
+
+    probe = hev_malloc (sizeof (HevFshTaskProbe));
+    if (!probe)
+        return hev_task_run (task, entry, data);
+
+    probe->entry = entry;
+    probe->data = data;
+    probe->role = role;
+
+    return hev_task_run (task, hev_fsh_task_probe_entry, probe);
+}
+
+int
+hev_fsh_task_set_stack_size (const char *role, unsigned int size)
+{
+    int i;
+
+    if (size < HEV_FSH_TASK_STACK_MIN)
+        return -1;
+
+    for (i = 0; i < HEV_FSH_TASK_ROLE_MAX; i++) {
+        if (strcmp (names[i], role) == 0) {
+            sizes[i] = size;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void
+hev_fsh_task_set_profile (int enable)
+{
+    profile = enable;
+}
+
+const char *
+hev_fsh_task_get_role_name (HevFshTaskRole role)
+{
+    return names[role];
+}
+
+void
+hev_fsh_task_report (void)
+{
+    int i;
+
+    for (i = 0; i < HEV_FSH_TASK_ROLE_MAX; i++) {
+        if (nr_news[i])
+            LOG_I ("task %s pool hit %lu/%lu", names[i], nr_hits[i],
+                   nr_news[i]);
+
+        if (profile && marks[i])
+            LOG_I ("task %s stack high-water %u/%u", names[i], marks[i],
+                   sizes[i]);
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-task.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh task
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_TASK_H__
+#define __HEV_FSH_TASK_H__
+
+#include <hev-task.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _HevFshTaskRole HevFshTaskRole;
+
+enum _HevFshTaskRole
+{
+    HEV_FSH_TASK_SERVICE = 0,
+    HEV_FSH_TASK_SESSION,
+    HEV_FSH_TASK_STREAM,
+    HEV_FSH_TASK_FORWARD,
+    HEV_FSH_TASK_PORT,
+    HEV_FSH_TASK_SOCK,
+    HEV_FSH_TASK_TERM,
+    HEV_FSH_TASK_CONNECT,
+    HEV_FSH_TASK_LISTEN,
+    HEV_FSH_TASK_ROLE_MAX,
+};
+
+HevTask *hev_fsh_task_new (HevFshTaskRole role);
+void hev_fsh_task_put (HevTask *task, HevFshTaskRole role);
+
+int hev_fsh_task_run (HevTask *task, HevFshTaskRole role, HevTaskEntry entry,
+                      void *data);
+
+int hev_fsh_task_set_stack_size (const char *role, unsigned int size);
+const char *hev_fsh_task_get_role_name (HevFshTaskRole role);
+
+void hev_fsh_task_set_profile (int enable);
+void hev_fsh_task_report (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_TASK_H__ */
@@ -0,0 +1,255 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-timer-wheel.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh timer wheel
+ ============================================================================
+ */
+
+#include <time.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-task.h"
+
+#include "hev-fsh-timer-wheel.h"
+
+#define HEV_FSH_TIMER_WHEEL_TICK (100)
+#define HEV_FSH_TIMER_WHEEL_ROOT_BITS (8)
+#define HEV_FSH_TIMER_WHEEL_LEVEL_BITS (6)
+#define HEV_FSH_TIMER_WHEEL_LEVELS (3)
+
+#define ROOT_SIZE (1 << HEV_FSH_TIMER_WHEEL_ROOT_BITS)
+#define ROOT_MASK (ROOT_SIZE - 1)
+#define LEVEL_SIZE (1 << HEV_FSH_TIMER_WHEEL_LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+#define LEVEL_SHIFT(n) \
+    (HEV_FSH_TIMER_WHEEL_ROOT_BITS + ((n) * HEV_FSH_TIMER_WHEEL_LEVEL_BITS))
+
+struct _HevFshTimerWheel
+{
+    unsigned long long tick;
+    unsigned long long time;
+    unsigned int count;
+
+    HevTask *task;
+    HevFshTimer *root[ROOT_SIZE];
+    HevFshTimer *levels[HEV_FSH_TIMER_WHEEL_LEVELS][LEVEL_SIZE];
+};
+
+static __thread HevFshTimerWheel *wheel;
+
+static unsigned long long
+hev_fsh_timer_wheel_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void
+hev_fsh_timer_wheel_link (HevFshTimerWheel *self, HevFshTimer *timer)
+{
+    unsigned long long delta = timer->expire - self->tick;
+    HevFshTimer **head;
+    unsigned int index;
+    int i;
+
+    if (delta < ROOT_SIZE) {
+        head = &self->root[timer->expire & ROOT_MASK];
+    } else {
+        for (i = 0; i < (HEV_FSH_TIMER_WHEEL_LEVELS - 1); i++) {
+            if (delta < (1ULL << LEVEL_SHIFT (i + 1)))
+                break;
+        }
+
+        /* beyond the top level, cascade again when it comes round */
+        if (delta >= (1ULL << LEVEL_SHIFT (i + 1)))
+            timer->expire = self->tick + (1ULL << LEVEL_SHIFT (i + 1)) - 1;
+
+        index = (timer->expire >> LEVEL_SHIFT (i)) & LEVEL_MASK;
+        head = &self->levels[i][index];
+    }
+
+    timer->next = *head;
+    if (*head)
+        (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void
+hev_fsh_timer_wheel_unlink (HevFshTimer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->pprev = NULL;
+}
+
+static void
+hev_fsh_timer_wheel_cascade (HevFshTimerWheel *self, int level,
+                             unsigned int index)
+{
+    HevFshTimer *list = self->levels[level][index];
+
+    self->levels[level][index] = NULL;
+    if (list)
+        list->pprev = &list;
+
+    while (list) {
+        HevFshTimer *timer = list;
+
+        hev_fsh_timer_wheel_unlink (timer);
+        hev_fsh_timer_wheel_link (self, timer);
+    }
+}
+
+static void
+hev_fsh_timer_wheel_advance (HevFshTimerWheel *self)
+{
+    unsigned int index;
+    HevFshTimer *list;
+    int i;
+
+    self->tick++;
+    self->time += HEV_FSH_TIMER_WHEEL_TICK;
+
+    for (i = 0; i < HEV_FSH_TIMER_WHEEL_LEVELS; i++) {
+        unsigned long long mask = (1ULL << LEVEL_SHIFT (i)) - 1;
+
+        if (self->tick & mask)
+            break;
+
+        index = (self->tick >> LEVEL_SHIFT (i)) & LEVEL_MASK;
+        hev_fsh_timer_wheel_cascade (self, i, index);
+    }
+
+    index = self->tick & ROOT_MASK;
+    list = self->root[index];
+    self->root[index] = NULL;
+    if (list)
+        list->pprev = &list;
+
+    /* handlers may add or delete any timer, the list stays consistent */
+    while (list) {
+        HevFshTimer *timer = list;
+
+        hev_fsh_timer_wheel_unlink (timer);
+        self->count--;
+        timer->handler (self, timer);
+    }
+}
+
+static void
+hev_fsh_timer_wheel_task_entry (void *data)
+{
+    HevFshTimerWheel *self = data;
+
+    for (;;) {
+        unsigned long long now = hev_fsh_timer_wheel_now ();
+
+        while (self->count && ((now - self->time) >= HEV_FSH_TIMER_WHEEL_TICK))
+            hev_fsh_timer_wheel_advance (self);
+
+        if (!self->count)
+            break;
+
+        hev_task_sleep (HEV_FSH_TIMER_WHEEL_TICK - (now - self->time));
+    }
+
+    LOG_D ("%p fsh timer wheel idle", self);
+    self->task = NULL;
+}
+
+static int
+hev_fsh_timer_wheel_start (HevFshTimerWheel *self)
+{
+    if (!self->count)
+        self->time = hev_fsh_timer_wheel_now ();
+
+    if (self->task) {
+        hev_task_wakeup (self->task);
+        return 0;
+    }
+
+    self->task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->task) {
+        LOG_E ("%p fsh timer wheel task", self);
+        return -1;
+    }
+
+    hev_fsh_task_run (self->task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_timer_wheel_task_entry, self);
+
+    return 0;
+}
+
+HevFshTimerWheel *
+hev_fsh_timer_wheel_get (void)
+{
+    HevFshTimerWheel *self = wheel;
+
+    if (self)
+        return self;
+
+    self = hev_malloc0 (sizeof (HevFshTimerWheel));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p fsh timer wheel new", self);
+
+    self->time = hev_fsh_timer_wheel_now ();
+    wheel = self;
+
+    return self;
+}
+
+unsigned long long
+hev_fsh_timer_wheel_get_time (HevFshTimerWheel *self)
+{
+    return self->time;
+}
+
+void
+hev_fsh_timer_wheel_add (HevFshTimerWheel *self, HevFshTimer *timer,
+                         unsigned int milliseconds)
+{
+    unsigned long long ticks;
+
+    if (timer->pprev)
+        hev_fsh_timer_wheel_del (self, timer);
+
+    if (!self->task || (!self->count && (hev_task_self () != self->task)))
+        hev_fsh_timer_wheel_start (self);
+
+    ticks = milliseconds + HEV_FSH_TIMER_WHEEL_TICK - 1;
+    ticks /= HEV_FSH_TIMER_WHEEL_TICK;
+    if (!ticks)
+        ticks = 1;
+
+    timer->expire = self->tick + ticks;
+    hev_fsh_timer_wheel_link (self, timer);
+    self->count++;
+}
+
+void
+hev_fsh_timer_wheel_del (HevFshTimerWheel *self, HevFshTimer *timer)
+{
+    if (!timer->pprev)
+        return;
+
+    hev_fsh_timer_wheel_unlink (timer);
+    self->count--;
+}
+
+int
+hev_fsh_timer_is_armed (HevFshTimer *timer)
+{
+    return !!timer->pprev;
+}
@@ -0,0 +1,46 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-timer-wheel.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh timer wheel
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_TIMER_WHEEL_H__
+#define __HEV_FSH_TIMER_WHEEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevFshTimer HevFshTimer;
+typedef struct _HevFshTimerWheel HevFshTimerWheel;
+typedef void (*HevFshTimerHandler) (HevFshTimerWheel *wheel,
+                                    HevFshTimer *timer);
+
+struct _HevFshTimer
+{
+    HevFshTimer *next;
+    HevFshTimer **pprev;
+    unsigned long long expire;
+
+    HevFshTimerHandler handler;
+    void *data;
+};
+
+HevFshTimerWheel *hev_fsh_timer_wheel_get (void);
+
+unsigned long long hev_fsh_timer_wheel_get_time (HevFshTimerWheel *self);
+
+void hev_fsh_timer_wheel_add (HevFshTimerWheel *self, HevFshTimer *timer,
+                              unsigned int milliseconds);
+void hev_fsh_timer_wheel_del (HevFshTimerWheel *self, HevFshTimer *timer);
+
+int hev_fsh_timer_is_armed (HevFshTimer *timer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_TIMER_WHEEL_H__ */
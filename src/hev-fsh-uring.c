@@ -0,0 +1,589 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-uring.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh io_uring
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-fsh-task.h"
+
+#include "hev-fsh-uring.h"
+
+#define HEV_FSH_URING_ENTRIES (256)
+#define HEV_FSH_URING_HEAD (1UL)
+
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+static int enabled;
+
+void
+hev_fsh_uring_set_enabled (int enable)
+{
+    enabled = enable;
+}
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+struct _HevFshUring
+{
+    int fd;
+    unsigned int pending;
+    unsigned int nr_ops;
+    unsigned int sq_tail;
+
+    unsigned int *sq_head;
+    unsigned int *sq_ktail;
+    unsigned int *sq_mask;
+    unsigned int *sq_entries;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    HevTask *task;
+};
+
+static __thread HevFshUring *uring;
+static __thread int uring_failed;
+
+static int
+hev_fsh_uring_enter (HevFshUring *self, unsigned int to_submit,
+                     unsigned int flags)
+{
+    return syscall (__NR_io_uring_enter, self->fd, to_submit, 0, flags, NULL,
+                    0);
+}
+
+static void
+hev_fsh_uring_submit (HevFshUring *self)
+{
+    int res;
+
+    res = hev_fsh_uring_enter (self, self->pending, 0);
+    if (res < 0) {
+        if ((errno != EBUSY) && (errno != EAGAIN) && (errno != EINTR))
+            LOG_W ("%p fsh uring submit", self);
+        return;
+    }
+
+    self->pending -= res;
+}
+
+static int
+hev_fsh_uring_reap (HevFshUring *self)
+{
+    unsigned int head = *self->cq_head;
+    unsigned int tail;
+    int count = 0;
+
+    tail = __atomic_load_n (self->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, count++) {
+        struct io_uring_cqe *cqe = &self->cqes[head & *self->cq_mask];
+        HevFshUringOp *op = (HevFshUringOp *)(unsigned long)cqe->user_data;
+
+        /* cancels carry no op, a poll head's op completes on its own */
+        if (!op || (cqe->user_data & HEV_FSH_URING_HEAD))
+            continue;
+
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            self->nr_ops--;
+        op->handler (op, cqe->res, cqe->flags);
+    }
+    __atomic_store_n (self->cq_head, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+static void
+hev_fsh_uring_task_entry (void *data)
+{
+    HevFshUring *self = data;
+
+    hev_task_add_fd (hev_task_self (), self->fd, POLLIN);
+
+    for (;;) {
+        int count;
+
+        if (self->pending)
+            hev_fsh_uring_submit (self);
+
+        count = hev_fsh_uring_reap (self);
+        if (count)
+            continue;
+
+        if (!self->pending && !self->nr_ops)
+            break;
+
+        hev_task_yield (HEV_TASK_WAITIO);
+    }
+
+    hev_task_del_fd (hev_task_self (), self->fd);
+    self->task = NULL;
+}
+
+static void
+hev_fsh_uring_start (HevFshUring *self)
+{
+    if (self->task) {
+        hev_task_wakeup (self->task);
+        return;
+    }
+
+    self->task = hev_fsh_task_new (HEV_FSH_TASK_SERVICE);
+    if (!self->task) {
+        LOG_E ("%p fsh uring task", self);
+        return;
+    }
+
+    hev_fsh_task_run (self->task, HEV_FSH_TASK_SERVICE,
+                      hev_fsh_uring_task_entry, self);
+}
+
+static struct io_uring_sqe *
+hev_fsh_uring_get_sqe (HevFshUring *self)
+{
+    unsigned int head;
+    unsigned int idx;
+
+    head = __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE);
+    if ((self->sq_tail - head) >= *self->sq_entries) {
+        hev_fsh_uring_submit (self);
+        head = __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE);
+        if ((self->sq_tail - head) >= *self->sq_entries)
+            return NULL;
+    }
+
+    idx = self->sq_tail & *self->sq_mask;
+    self->sq_array[idx] = idx;
+
+    return memset (&self->sqes[idx], 0, sizeof (struct io_uring_sqe));
+}
+
+static void
+hev_fsh_uring_put_sqe (HevFshUring *self)
+{
+    self->sq_tail++;
+    __atomic_store_n (self->sq_ktail, self->sq_tail, __ATOMIC_RELEASE);
+
+    if (!self->pending++ || !self->task)
+        hev_fsh_uring_start (self);
+}
+
+static void
+hev_fsh_uring_op_handler (HevFshUringOp *op, int res, unsigned int flags)
+{
+    op->res = res;
+    op->is_busy = 0;
+    op->is_done = 1;
+    hev_task_wakeup (op->task);
+}
+
+static int
+hev_fsh_uring_prep (HevFshUring *self, HevFshUringOp *op, int opcode, int fd,
+                    const void *buf, size_t len, unsigned int flags)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = hev_fsh_uring_get_sqe (self);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->msg_flags = flags;
+    /* file position for read and write, recv and send reject it */
+    if ((opcode == IORING_OP_READ) || (opcode == IORING_OP_WRITE))
+        sqe->off = -1;
+    sqe->user_data = (unsigned long)op;
+
+    op->task = hev_task_self ();
+    if (!op->handler)
+        op->handler = hev_fsh_uring_op_handler;
+    op->is_busy = 1;
+    op->is_done = 0;
+    op->is_linked = 0;
+    self->nr_ops++;
+
+    hev_fsh_uring_put_sqe (self);
+
+    return 0;
+}
+
+static int
+hev_fsh_uring_poll (HevFshUring *self, HevFshUringOp *op, int fd,
+                    unsigned int events)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int head;
+
+    /* leaves room for the linked op, a lone link would chain the next */
+    head = __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE);
+    if ((self->sq_tail + 1 - head) >= *self->sq_entries) {
+        hev_fsh_uring_submit (self);
+        head = __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE);
+        if ((self->sq_tail + 1 - head) >= *self->sq_entries)
+            return -1;
+    }
+
+    sqe = hev_fsh_uring_get_sqe (self);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (unsigned long)op | HEV_FSH_URING_HEAD;
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+    sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+#endif
+    hev_fsh_uring_put_sqe (self);
+
+    return 0;
+}
+
+int
+hev_fsh_uring_recv (HevFshUring *self, HevFshUringOp *op, int fd, void *buf,
+                    size_t len)
+{
+    return hev_fsh_uring_prep (self, op, IORING_OP_RECV, fd, buf, len, 0);
+}
+
+int
+hev_fsh_uring_send (HevFshUring *self, HevFshUringOp *op, int fd,
+                    const void *buf, size_t len)
+{
+    return hev_fsh_uring_prep (self, op, IORING_OP_SEND, fd, buf, len,
+                               MSG_NOSIGNAL);
+}
+
+/*
+ * Non-socket fds (ptys, stdio) are O_NONBLOCK, a plain read would just
+ * complete with -EAGAIN. A poll is linked in front to wait in the kernel.
+ */
+int
+hev_fsh_uring_read (HevFshUring *self, HevFshUringOp *op, int fd, void *buf,
+                    size_t len)
+{
+    if (hev_fsh_uring_poll (self, op, fd, POLLIN) < 0)
+        return -1;
+
+    if (hev_fsh_uring_prep (self, op, IORING_OP_READ, fd, buf, len, 0) < 0)
+        return -1;
+
+    op->is_linked = 1;
+
+    return 0;
+}
+
+int
+hev_fsh_uring_write (HevFshUring *self, HevFshUringOp *op, int fd,
+                     const void *buf, size_t len)
+{
+    if (hev_fsh_uring_poll (self, op, fd, POLLOUT) < 0)
+        return -1;
+
+    if (hev_fsh_uring_prep (self, op, IORING_OP_WRITE, fd, buf, len, 0) < 0)
+        return -1;
+
+    op->is_linked = 1;
+
+    return 0;
+}
+
+static int
+hev_fsh_uring_cancel_one (HevFshUring *self, unsigned long user_data)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = hev_fsh_uring_get_sqe (self);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    hev_fsh_uring_put_sqe (self);
+
+    return 0;
+}
+
+int
+hev_fsh_uring_cancel (HevFshUring *self, HevFshUringOp *op)
+{
+    unsigned long user_data = (unsigned long)op;
+
+    if (!op->is_busy)
+        return 0;
+
+    /* a linked op is found by its poll head */
+    if (op->is_linked &&
+        (hev_fsh_uring_cancel_one (self, user_data | HEV_FSH_URING_HEAD) < 0))
+        return -1;
+
+    return hev_fsh_uring_cancel_one (self, user_data);
+}
+
+#ifdef IORING_ACCEPT_MULTISHOT
+
+static void
+hev_fsh_uring_accept_handler (HevFshUringOp *op, int res, unsigned int flags)
+{
+    HevFshUringAccept *acc = (HevFshUringAccept *)op;
+
+    if (!(flags & IORING_CQE_F_MORE))
+        op->is_busy = 0;
+
+    if (res >= 0) {
+        unsigned int used = acc->tail - acc->head;
+
+        if (used == HEV_FSH_URING_ACCEPT_QUEUE) {
+            LOG_W ("%p fsh uring accept queue overflow", acc);
+            close (res);
+        } else {
+            acc->fds[acc->tail++ % HEV_FSH_URING_ACCEPT_QUEUE] = res;
+            used++;
+        }
+
+        if (!acc->is_paused && op->is_busy &&
+            (used >= (HEV_FSH_URING_ACCEPT_QUEUE / 2)) &&
+            (hev_fsh_uring_cancel (uring, op) == 0))
+            acc->is_paused = 1;
+    } else if (!acc->is_paused || (res != -ECANCELED)) {
+        op->res = res;
+    }
+
+    hev_task_wakeup (op->task);
+}
+
+int
+hev_fsh_uring_accept (HevFshUring *self, HevFshUringAccept *acc, int fd)
+{
+    HevFshUringOp *op = &acc->base;
+
+    while (acc->head == acc->tail) {
+        if (!op->is_busy) {
+            struct io_uring_sqe *sqe;
+
+            sqe = hev_fsh_uring_get_sqe (self);
+            if (!sqe)
+                return -1;
+
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = fd;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            sqe->user_data = (unsigned long)op;
+
+            op->task = hev_task_self ();
+            op->handler = hev_fsh_uring_accept_handler;
+            acc->is_paused = 0;
+            op->is_busy = 1;
+            op->res = 0;
+            self->nr_ops++;
+            hev_fsh_uring_put_sqe (self);
+        }
+
+        hev_task_yield (HEV_TASK_WAITIO);
+
+        if (op->res < 0) {
+            errno = -op->res;
+            op->res = 0;
+            return -1;
+        }
+    }
+
+    return acc->fds[acc->head++ % HEV_FSH_URING_ACCEPT_QUEUE];
+}
+
+#else /* IORING_ACCEPT_MULTISHOT */
+
+int
+hev_fsh_uring_accept (HevFshUring *self, HevFshUringAccept *acc, int fd)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* !IORING_ACCEPT_MULTISHOT */
+
+static int
+hev_fsh_uring_map (HevFshUring *self, struct io_uring_params *p)
+{
+    void *sq, *cq;
+
+    self->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof (unsigned);
+    self->cq_ring_size =
+        p->cq_off.cqes + p->cq_entries * sizeof (struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (self->cq_ring_size > self->sq_ring_size)
+            self->sq_ring_size = self->cq_ring_size;
+        self->cq_ring_size = self->sq_ring_size;
+    }
+
+    sq = mmap (NULL, self->sq_ring_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+
+    cq = sq;
+    if (!(p->features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap (NULL, self->cq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            munmap (sq, self->sq_ring_size);
+            return -1;
+        }
+    }
+
+    self->sqes_size = p->sq_entries * sizeof (struct io_uring_sqe);
+    self->sqes = mmap (NULL, self->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED) {
+        if (cq != sq)
+            munmap (cq, self->cq_ring_size);
+        munmap (sq, self->sq_ring_size);
+        return -1;
+    }
+
+    self->sq_ring = sq;
+    self->cq_ring = cq;
+    self->sq_head = sq + p->sq_off.head;
+    self->sq_ktail = sq + p->sq_off.tail;
+    self->sq_mask = sq + p->sq_off.ring_mask;
+    self->sq_entries = sq + p->sq_off.ring_entries;
+    self->sq_array = sq + p->sq_off.array;
+    self->sq_tail = *self->sq_ktail;
+    self->cq_head = cq + p->cq_off.head;
+    self->cq_tail = cq + p->cq_off.tail;
+    self->cq_mask = cq + p->cq_off.ring_mask;
+    self->cqes = cq + p->cq_off.cqes;
+
+    return 0;
+}
+
+HevFshUring *
+hev_fsh_uring_get (void)
+{
+    struct io_uring_params p;
+    HevFshUring *self = uring;
+
+    if (self || !enabled || uring_failed)
+        return self;
+
+    uring_failed = 1;
+
+    self = hev_malloc0 (sizeof (HevFshUring));
+    if (!self)
+        return NULL;
+
+    memset (&p, 0, sizeof (p));
+    p.flags = IORING_SETUP_CLAMP;
+    self->fd = syscall (__NR_io_uring_setup, HEV_FSH_URING_ENTRIES, &p);
+    if (self->fd < 0) {
+        LOG_W ("fsh uring setup (%s)", strerror (errno));
+        goto free;
+    }
+
+    if (!(p.features & IORING_FEAT_FAST_POLL) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        LOG_W ("fsh uring setup (kernel too old)");
+        goto close;
+    }
+
+    if (hev_fsh_uring_map (self, &p) < 0)
+        goto close;
+
+    LOG_D ("%p fsh uring new", self);
+
+    uring_failed = 0;
+    uring = self;
+
+    return self;
+
+close:
+    close (self->fd);
+free:
+    hev_free (self);
+    return NULL;
+}
+
+#else /* __linux__ */
+
+HevFshUring *
+hev_fsh_uring_get (void)
+{
+    return NULL;
+}
+
+int
+hev_fsh_uring_recv (HevFshUring *self, HevFshUringOp *op, int fd, void *buf,
+                    size_t len)
+{
+    return -1;
+}
+
+int
+hev_fsh_uring_send (HevFshUring *self, HevFshUringOp *op, int fd,
+                    const void *buf, size_t len)
+{
+    return -1;
+}
+
+int
+hev_fsh_uring_read (HevFshUring *self, HevFshUringOp *op, int fd, void *buf,
+                    size_t len)
+{
+    return -1;
+}
+
+int
+hev_fsh_uring_write (HevFshUring *self, HevFshUringOp *op, int fd,
+                     const void *buf, size_t len)
+{
+    return -1;
+}
+
+int
+hev_fsh_uring_cancel (HevFshUring *self, HevFshUringOp *op)
+{
+    return -1;
+}
+
+int
+hev_fsh_uring_accept (HevFshUring *self, HevFshUringAccept *acc, int fd)
+{
+    return -1;
+}
+
+#endif /* !__linux__ */
@@ -0,0 +1,70 @@
+/*
+ ============================================================================
+ Name        : hev-fsh-uring.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2021 xyz
+ Description : Fsh io_uring
+ ============================================================================
+ */
+
+#ifndef __HEV_FSH_URING_H__
+#define __HEV_FSH_URING_H__
+
+#include <stddef.h>
+
+#include <hev-task.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_FSH_URING_ACCEPT_QUEUE (64)
+
+typedef struct _HevFshUring HevFshUring;
+typedef struct _HevFshUringOp HevFshUringOp;
+typedef struct _HevFshUringAccept HevFshUringAccept;
+typedef void (*HevFshUringHandler) (HevFshUringOp *op, int res,
+                                    unsigned int flags);
+
+struct _HevFshUringOp
+{
+    HevTask *task;
+    HevFshUringHandler handler;
+
+    int res;
+    unsigned char is_busy;
+    unsigned char is_done;
+    unsigned char is_linked;
+};
+
+struct _HevFshUringAccept
+{
+    HevFshUringOp base;
+
+    unsigned char is_paused;
+    unsigned int head;
+    unsigned int tail;
+    int fds[HEV_FSH_URING_ACCEPT_QUEUE];
+};
+
+HevFshUring *hev_fsh_uring_get (void);
+
+void hev_fsh_uring_set_enabled (int enabled);
+
+int hev_fsh_uring_recv (HevFshUring *self, HevFshUringOp *op, int fd,
+                        void *buf, size_t len);
+int hev_fsh_uring_send (HevFshUring *self, HevFshUringOp *op, int fd,
+                        const void *buf, size_t len);
+int hev_fsh_uring_read (HevFshUring *self, HevFshUringOp *op, int fd,
+                        void *buf, size_t len);
+int hev_fsh_uring_write (HevFshUring *self, HevFshUringOp *op, int fd,
+                         const void *buf, size_t len);
+int hev_fsh_uring_cancel (HevFshUring *self, HevFshUringOp *op);
+
+int hev_fsh_uring_accept (HevFshUring *self, HevFshUringAccept *acc, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_FSH_URING_H__ */
@@ -22,7 +22,11 @@
 #include "hev-logger.h"
 #include "hev-fsh-config.h"
 #include "hev-fsh-server.h"
+#include "hev-fsh-io.h"
 #include "hev-fsh-client.h"
+#include "hev-fsh-task.h"
+#include "hev-fsh-splice.h"
+#include "hev-fsh-uring.h"
 
 #include "hev-main.h"
 
@@ -33,19 +37,25 @@ show_help (void)
 {
     fprintf (stderr,
              "Common: [-4 | -6] [-k KEY] [-t TIMEOUT] [-l LOG] [-v]\n"
-             "Server: -s [SERVER_ADDR:SERVER_PORT]\n"
+             "        [-S ROLE=SIZE,...] [-P] [-U]\n"
+             "Server: -s [-n THREADS] [-D DRAIN] [-L LOGINS] [-H HANDOVER]\n"
+             "        [-W SNAPSHOT] [-C PEER_ADDR:PEER_PORT,...]\n"
+             "        [SERVER_ADDR:SERVER_PORT]\n"
              "Terminal:\n"
-             "  Forwarder: -f [-u USER] SERVER_ADDR[:SERVER_PORT/TOKEN]\n"
+             "  Forwarder: -f [-c CHANNELS | -M] [-u USER] "
+             "SERVER_ADDR[:SERVER_PORT/TOKEN]\n"
              "  Connector: SERVER_ADDR[:SERVER_PORT]/TOKEN\n"
              "TCP Port:\n"
-             "  Forwarder: -f -p [-w ADDR:PORT,... | -b ADDR:PORT,...] "
+             "  Forwarder: -f -p [-c CHANNELS | -M] "
+             "[-w ADDR:PORT,... | -b ADDR:PORT,...] "
              "SERVER_ADDR[:SERVER_PORT/TOKEN]\n"
              "  Connector: -p [LOCAL_ADDR:]LOCAL_PORT:REMOTE_ADDR:REMOTE_PORT "
              "SERVER_ADDR[:SERVER_PORT]/TOKEN\n"
              "             -p REMOTE_ADDR:REMOTE_PORT "
              "SERVER_ADDR[:SERVER_PORT]/TOKEN\n"
              "Socks v5:\n"
-             "  Forwarder: -f -x SERVER_ADDR[:SERVER_PORT/TOKEN]\n"
+             "  Forwarder: -f -x [-c CHANNELS | -M] "
+             "SERVER_ADDR[:SERVER_PORT/TOKEN]\n"
              "  Connector: -x [LOCAL_ADDR:]LOCAL_PORT "
              "SERVER_ADDR[:SERVER_PORT]/TOKEN\n");
     fprintf (stderr, "Version: %d.%d.%d\n", MAJOR_VERSION, MINOR_VERSION,
@@ -189,6 +199,71 @@ parse_set_addr_list (HevFshConfig *config, const char *str, int action)
     return 0;
 }
 
+static int
+set_peer_list (HevFshConfig *config, const char *str)
+{
+    struct sockaddr_storage ss = { 0 };
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&ss;
+    struct sockaddr_in *sa4 = (struct sockaddr_in *)&ss;
+    const char *addr = NULL;
+    const char *port = NULL;
+    socklen_t len;
+    char *b;
+
+    b = parse_addr (str, &addr, &port, NULL);
+    if (!b || !addr || !port) {
+        free (b);
+        return -1;
+    }
+
+    if (inet_pton (AF_INET, addr, &sa4->sin_addr) == 1) {
+        sa4->sin_family = AF_INET;
+        sa4->sin_port = htons (atoi (port));
+        len = sizeof (struct sockaddr_in);
+    } else if (inet_pton (AF_INET6, addr, &sa6->sin6_addr) == 1) {
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons (atoi (port));
+        len = sizeof (struct sockaddr_in6);
+    } else {
+        free (b);
+        return -1;
+    }
+
+    hev_fsh_config_peer_list_add (config, (struct sockaddr *)&ss, len);
+    free (b);
+
+    return 0;
+}
+
+static int
+parse_set_peer_list (HevFshConfig *config, const char *str)
+{
+    int s = 0;
+
+    /* parse state machine */
+    for (;;) {
+        switch (*str) {
+        case '\0':
+            return 0;
+        case ',':
+            str++;
+            s = 0;
+            break;
+        default:
+            if (s == 0) {
+                if (set_peer_list (config, str) < 0)
+                    return -1;
+                s = 1;
+            } else {
+                str++;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
 static char *
 parse_addr_pair (const char *str, const char *ps[4])
 {
@@ -416,6 +491,31 @@ parse_key (HevFshConfig *config, const char *key)
 #endif
 }
 
+static int
+parse_stack_sizes (const char *str)
+{
+    char buf[256];
+    char *sp, *role;
+
+    if (strlen (str) >= sizeof (buf))
+        return -1;
+
+    strcpy (buf, str);
+    for (role = strtok_r (buf, ",", &sp); role;
+         role = strtok_r (NULL, ",", &sp)) {
+        char *size = strchr (role, '=');
+
+        if (!size)
+            return -1;
+
+        *size++ = '\0';
+        if (hev_fsh_task_set_stack_size (role, strtoul (size, NULL, 10)) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 static int
 parse_args (HevFshConfig *config, int argc, char *argv[])
 {
@@ -432,8 +532,9 @@ parse_args (HevFshConfig *config, int argc, char *argv[])
     const char *b = NULL;
     const char *t1 = NULL;
     const char *t2 = NULL;
+    const char *opts = "46k:t:vsfpxl:u:w:b:n:c:MD:L:H:W:C:S:PU";
 
-    while ((opt = getopt (argc, argv, "46k:t:vsfpxl:u:w:b:")) != -1) {
+    while ((opt = getopt (argc, argv, opts)) != -1) {
         switch (opt) {
         case '4':
             hev_fsh_config_set_ip_type (config, 4);
@@ -474,6 +575,42 @@ parse_args (HevFshConfig *config, int argc, char *argv[])
         case 'b':
             b = optarg;
             break;
+        case 'n':
+            hev_fsh_config_set_threads (config, strtoul (optarg, NULL, 10));
+            break;
+        case 'c':
+            hev_fsh_config_set_pool_size (config, strtoul (optarg, NULL, 10));
+            break;
+        case 'M':
+            hev_fsh_config_set_mux (config, 1);
+            break;
+        case 'D':
+            hev_fsh_config_set_drain_timeout (config,
+                                              strtoul (optarg, NULL, 10));
+            break;
+        case 'L':
+            hev_fsh_config_set_login_rate (config, strtoul (optarg, NULL, 10));
+            break;
+        case 'H':
+            hev_fsh_config_set_handover_path (config, optarg);
+            break;
+        case 'W':
+            hev_fsh_config_set_snapshot_path (config, optarg);
+            break;
+        case 'C':
+            if (parse_set_peer_list (config, optarg) < 0)
+                return -1;
+            break;
+        case 'S':
+            if (parse_stack_sizes (optarg) < 0)
+                return -1;
+            break;
+        case 'P':
+            hev_fsh_task_set_profile (1);
+            break;
+        case 'U':
+            hev_fsh_uring_set_enabled (1);
+            break;
         default:
             return -1;
         }
@@ -506,6 +643,20 @@ parse_args (HevFshConfig *config, int argc, char *argv[])
     return 0;
 }
 
+static void
+report_stats (void)
+{
+    static int done;
+
+    if (done)
+        return;
+    done = 1;
+
+    hev_fsh_task_report ();
+    hev_fsh_io_report ();
+    hev_fsh_splice_report ();
+}
+
 static void
 signal_handler (int signum)
 {
@@ -553,6 +704,8 @@ main (int argc, char *argv[])
     if (hev_logger_init (level, path) < 0)
         return -1;
 
+    if (atexit (report_stats) != 0)
+        return -1;
     if (signal (SIGPIPE, SIG_IGN) == SIG_ERR)
         return -1;
     if (signal (SIGINT, signal_handler) == SIG_ERR)
@@ -575,6 +728,7 @@ main (int argc, char *argv[])
     hev_object_unref (HEV_OBJECT (instance));
     hev_fsh_config_destroy (config);
     hev_task_system_fini ();
+    report_stats ();
     hev_logger_fini ();
 
     return 0;
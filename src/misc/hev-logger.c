@@ -58,7 +58,7 @@ hev_logger_log (HevLoggerLevel level, const char *fmt, ...)
     struct iovec iov[4];
     const char *ts_fmt;
     char msg[1024];
-    struct tm *ti;
+    struct tm ti;
     char ts[32];
     time_t now;
     va_list ap;
@@ -68,11 +68,11 @@ hev_logger_log (HevLoggerLevel level, const char *fmt, ...)
         return;
 
     time (&now);
-    ti = localtime (&now);
+    localtime_r (&now, &ti);
 
     ts_fmt = "[%04u-%02u-%02u %02u:%02u:%02u] ";
-    len = snprintf (ts, sizeof (ts), ts_fmt, 1900 + ti->tm_year, 1 + ti->tm_mon,
-                    ti->tm_mday, ti->tm_hour, ti->tm_min, ti->tm_sec);
+    len = snprintf (ts, sizeof (ts), ts_fmt, 1900 + ti.tm_year, 1 + ti.tm_mon,
+                    ti.tm_mday, ti.tm_hour, ti.tm_min, ti.tm_sec);
 
     iov[0].iov_base = ts;
     iov[0].iov_len = len;
@@ -8,19 +8,60 @@
  */
 
 #include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
 #include <hev-circular-buffer.h>
 
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#define ENABLE_ZEROCOPY
+#endif
+
 #include "hev-task-io-us.h"
 
+/*
+ * Zero copy pays off above ~10 KB per send. Bulk directions, seen as
+ * consecutive full reads, move to slots sent with MSG_ZEROCOPY; a slot
+ * is reused once the kernel reports its sends complete.
+ */
+#define TASK_IO_ZC_SLOTS (4)
+#define TASK_IO_ZC_SLOT_SIZE (65536)
+#define TASK_IO_ZC_SMALL (TASK_IO_ZC_SLOT_SIZE / 8)
+#define TASK_IO_ZC_GROW_READS (2)
+#define TASK_IO_ZC_SHRINK_READS (8)
+
 typedef struct _HevTaskIOSplicer HevTaskIOSplicer;
+typedef struct _HevTaskIOZCSlot HevTaskIOZCSlot;
+
+struct _HevTaskIOZCSlot
+{
+    unsigned int off;
+    unsigned int len;
+    unsigned int seq;
+    unsigned int nr_zc;
+    unsigned int nr_done;
+};
 
 struct _HevTaskIOSplicer
 {
     HevCircularBuffer *buf;
+#ifdef ENABLE_ZEROCOPY
+    char *zc_buf;
+    HevTaskIOZCSlot zc_slots[TASK_IO_ZC_SLOTS];
+    unsigned int zc_head;
+    unsigned int zc_send;
+    unsigned int zc_tail;
+    unsigned int zc_seq;
+    int zc_state;
+    unsigned int full_reads;
+    unsigned int small_reads;
+#endif
 };
 
 static int
@@ -30,6 +71,17 @@ task_io_splicer_init (HevTaskIOSplicer *self, size_t buf_size)
     if (!self->buf)
         return -1;
 
+#ifdef ENABLE_ZEROCOPY
+    self->zc_buf = NULL;
+    self->zc_head = 0;
+    self->zc_send = 0;
+    self->zc_tail = 0;
+    self->zc_seq = 0;
+    self->zc_state = 0;
+    self->full_reads = 0;
+    self->small_reads = 0;
+#endif
+
     return 0;
 }
 
@@ -38,17 +90,222 @@ task_io_splicer_fini (HevTaskIOSplicer *self)
 {
     if (self->buf)
         hev_circular_buffer_unref (self->buf);
+
+#ifdef ENABLE_ZEROCOPY
+    if (self->zc_buf)
+        munmap (self->zc_buf, TASK_IO_ZC_SLOTS * TASK_IO_ZC_SLOT_SIZE);
+#endif
+}
+
+#ifdef ENABLE_ZEROCOPY
+
+static void
+task_io_zc_complete (HevTaskIOSplicer *self, unsigned int lo, unsigned int hi)
+{
+    unsigned int i;
+
+    for (i = self->zc_head; i != self->zc_tail; i++) {
+        HevTaskIOZCSlot *slot = &self->zc_slots[i % TASK_IO_ZC_SLOTS];
+        int a, b;
+
+        if (!slot->nr_zc)
+            continue;
+
+        a = lo - slot->seq;
+        b = hi - slot->seq;
+        if (a < 0)
+            a = 0;
+        if (b >= (int)slot->nr_zc)
+            b = slot->nr_zc - 1;
+        if (a <= b)
+            slot->nr_done += b - a + 1;
+    }
+}
+
+static void
+task_io_zc_reap (HevTaskIOSplicer *self, int fd_out)
+{
+    while (self->zc_head != self->zc_send) {
+        char control[CMSG_SPACE (sizeof (struct sock_extended_err)) + 64];
+        struct sock_extended_err *serr;
+        struct msghdr msg = { 0 };
+        struct cmsghdr *cmsg;
+        HevTaskIOZCSlot *slot;
+
+        slot = &self->zc_slots[self->zc_head % TASK_IO_ZC_SLOTS];
+        if (slot->nr_done < slot->nr_zc) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof (control);
+            if (recvmsg (fd_out, &msg, MSG_ERRQUEUE) < 0)
+                break;
+
+            cmsg = CMSG_FIRSTHDR (&msg);
+            if (!cmsg)
+                continue;
+            if (!((cmsg->cmsg_level == SOL_IP &&
+                   cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 &&
+                   cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA (cmsg);
+            if (serr->ee_errno || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* a range of send ids [ee_info, ee_data] completed */
+            task_io_zc_complete (self, serr->ee_info, serr->ee_data);
+
+            /* the kernel copied anyway (e.g. loopback), stop asking */
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                self->zc_state = -1;
+            continue;
+        }
+
+        self->zc_head++;
+    }
 }
 
+static int
+task_io_zc_enable (HevTaskIOSplicer *self, int fd_out)
+{
+    const int one = 1;
+    void *buf;
+
+    if (setsockopt (fd_out, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one)) < 0)
+        return -1;
+
+    buf = mmap (NULL, TASK_IO_ZC_SLOTS * TASK_IO_ZC_SLOT_SIZE,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        return -1;
+
+    self->zc_buf = buf;
+
+    return 0;
+}
+
+static void
+task_io_zc_adapt (HevTaskIOSplicer *self, int fd_out, ssize_t size,
+                  size_t full)
+{
+    if (self->zc_state < 0)
+        return;
+
+    if (size >= full && size >= TASK_IO_ZC_SMALL) {
+        self->small_reads = 0;
+        if (self->zc_state || ++self->full_reads < TASK_IO_ZC_GROW_READS)
+            return;
+        if (!self->zc_buf && (task_io_zc_enable (self, fd_out) < 0)) {
+            self->zc_state = -1;
+            return;
+        }
+        self->zc_state = 1;
+    } else if (size < TASK_IO_ZC_SMALL) {
+        self->full_reads = 0;
+        if (!self->zc_state || ++self->small_reads < TASK_IO_ZC_SHRINK_READS)
+            return;
+        self->zc_state = 0;
+    }
+}
+
+static int
+task_io_zc_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
+{
+    int res = 1;
+
+    task_io_zc_reap (self, fd_out);
+
+    if (self->zc_state > 0 &&
+        (self->zc_tail - self->zc_head) < TASK_IO_ZC_SLOTS) {
+        unsigned int idx = self->zc_tail % TASK_IO_ZC_SLOTS;
+        char *buf = self->zc_buf + idx * TASK_IO_ZC_SLOT_SIZE;
+        ssize_t s = read (fd_in, buf, TASK_IO_ZC_SLOT_SIZE);
+        if (0 >= s) {
+            if ((0 > s) && (EAGAIN == errno))
+                res = 0;
+            else
+                res = -1;
+        } else {
+            HevTaskIOZCSlot *slot = &self->zc_slots[idx];
+
+            slot->off = 0;
+            slot->len = s;
+            slot->nr_zc = 0;
+            slot->nr_done = 0;
+            self->zc_tail++;
+            task_io_zc_adapt (self, fd_out, s, TASK_IO_ZC_SLOT_SIZE);
+        }
+    } else if (self->zc_send == self->zc_tail) {
+        res = 0;
+    }
+
+    while (self->zc_send != self->zc_tail) {
+        unsigned int idx = self->zc_send % TASK_IO_ZC_SLOTS;
+        HevTaskIOZCSlot *slot = &self->zc_slots[idx];
+        char *buf = self->zc_buf + idx * TASK_IO_ZC_SLOT_SIZE;
+        int flags = MSG_NOSIGNAL;
+        ssize_t s;
+
+        if (self->zc_state >= 0)
+            flags |= MSG_ZEROCOPY;
+
+        s = send (fd_out, buf + slot->off, slot->len - slot->off, flags);
+        if ((0 > s) && (flags & MSG_ZEROCOPY) &&
+            ((EOPNOTSUPP == errno) || (ENOBUFS == errno))) {
+            /* kTLS rejects it, optmem is short: copy this one */
+            if (EOPNOTSUPP == errno)
+                self->zc_state = -1;
+            flags &= ~MSG_ZEROCOPY;
+            s = send (fd_out, buf + slot->off, slot->len - slot->off, flags);
+        }
+        if (0 >= s) {
+            if ((0 > s) && (EAGAIN == errno))
+                res = 0;
+            else
+                res = -1;
+            break;
+        }
+
+        res = 1;
+        if (flags & MSG_ZEROCOPY) {
+            if (!slot->nr_zc)
+                slot->seq = self->zc_seq;
+            self->zc_seq++;
+            slot->nr_zc++;
+        }
+        slot->off += s;
+        if (slot->off < slot->len)
+            continue;
+        self->zc_send++;
+    }
+
+    if (self->zc_state <= 0 && self->zc_send == self->zc_tail && res >= 0)
+        res = 1;
+
+    return res;
+}
+
+#endif /* ENABLE_ZEROCOPY */
+
 static int
 task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
 {
     struct iovec iov[2];
     int res = 1, iovc;
 
+#ifdef ENABLE_ZEROCOPY
+    if (self->zc_state > 0 || self->zc_send != self->zc_tail)
+        return task_io_zc_splice (self, fd_in, fd_out);
+#endif
+
     iovc = hev_circular_buffer_writing (self->buf, iov);
     if (iovc) {
-        ssize_t s = readv (fd_in, iov, iovc);
+        size_t full = iov[0].iov_len;
+        ssize_t s;
+
+        if (iovc > 1)
+            full += iov[1].iov_len;
+        s = readv (fd_in, iov, iovc);
         if (0 >= s) {
             if ((0 > s) && (EAGAIN == errno))
                 res = 0;
@@ -56,6 +313,11 @@ task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
                 res = -1;
         } else {
             hev_circular_buffer_write_finish (self->buf, s);
+#ifdef ENABLE_ZEROCOPY
+            task_io_zc_adapt (self, fd_out, s, full);
+#else
+            (void)full;
+#endif
         }
     }
 
@@ -73,6 +335,11 @@ task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
         }
     }
 
+#ifdef ENABLE_ZEROCOPY
+    if (self->zc_state > 0 && hev_circular_buffer_get_use_size (self->buf))
+        self->zc_state = 0;
+#endif
+
     return res;
 }
 